@@ -0,0 +1,420 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+/*
+ * Micro benchmarks of the hot paths of fstest, on the memory backend so
+ * that no filesystem or disk is measured. Prints one CSV line per
+ * benchmark; with --baseline a former output is compared and a slowdown
+ * beyond --tolerance percent fails.
+ */
+
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "fstest.h"
+#include "config.h"
+#include "histogram.h"
+#include "iobackend.h"
+
+#define BENCH_DEFAULT_TIME_MS 500
+#define BENCH_DEFAULT_TOLERANCE 10 // percent
+#define BENCH_FILE_BITS 24 // 16 MiB files
+#define BENCH_MEM_SIZE (1ULL << 30)
+
+using namespace std;
+
+struct BenchResult {
+	string name;
+	double value;
+	string unit; // MB/s is better when higher, ns/op when lower
+};
+
+class Bench
+{
+private:
+	Filesystem *fs;
+	Dir *dir; // the deepest directory
+	File *file; // a written file, for the read benchmarks
+	uint64_t run_ns; // minimum time per benchmark
+	vector<BenchResult> results;
+
+	bool again(uint64_t start) const
+	{
+		return now_ns() - start < this->run_ns;
+	}
+
+	void add(string name, double value, string unit)
+	{
+		this->results.push_back({ name, value, unit });
+	}
+
+	void bench_fill(void);
+	void bench_compare(void);
+	void bench_read(void);
+	void bench_dir_path(void);
+	void bench_file_table(void);
+	void bench_stats(void);
+
+public:
+	Bench(uint64_t run_ns);
+
+	void run(void);
+	int report(ostream &out, string baseline, double tolerance);
+};
+
+Bench::Bench(uint64_t run_ns)
+{
+	this->run_ns = run_ns;
+	this->file = NULL;
+
+	this->fs = new Filesystem("/bench", 100, 0);
+	new Dir(this->fs->all_dirs.back(), 5);
+
+	this->dir = this->fs->all_dirs.front();
+	for (Dir *d : this->fs->all_dirs) {
+		if (d->path().size() > this->dir->path().size())
+			this->dir = d;
+	}
+}
+
+/* Pattern fill, write and checksum of complete files */
+void Bench::bench_fill(void)
+{
+	uint64_t bytes = 0, ns = 0;
+	uint64_t start = now_ns();
+
+	do {
+		File *file = new File(this->dir);
+		this->dir->add_file(file);
+
+		uint64_t t = now_ns();
+		file->fwrite();
+		ns += now_ns() - t;
+		bytes += file->get_fsize();
+
+		delete this->file;
+		this->file = file;
+	} while (this->again(start));
+
+	this->add("fill", bytes * 1E3 / ns, "MB/s");
+}
+
+/* Read and pattern compare of a complete file */
+void Bench::bench_compare(void)
+{
+	IoBackend *io = get_io_backend();
+	string path = this->file->path();
+	uint64_t bytes = 0, ns = 0;
+	uint64_t start = now_ns();
+
+	do {
+		int fd = io->open(path.c_str(), O_RDONLY, 0);
+		if (fd < 0) {
+			cerr << "Opening " << path << " failed: "
+			     << strerror(errno) << endl;
+			EXIT(1);
+		}
+
+		uint64_t t = now_ns();
+		if (this->file->check_fd(fd)) {
+			cerr << "Check of " << path << " failed" << endl;
+			EXIT(1);
+		}
+		ns += now_ns() - t;
+		bytes += this->file->get_fsize();
+
+		io->close(fd);
+	} while (this->again(start));
+
+	this->add("compare", bytes * 1E3 / ns, "MB/s");
+}
+
+/* read_fd() buffer chunking without the compare */
+void Bench::bench_read(void)
+{
+	IoBackend *io = get_io_backend();
+	string path = this->file->path();
+	uint64_t fsize = this->file->get_fsize();
+	uint64_t bytes = 0, ns = 0;
+	uint64_t start = now_ns();
+	void *buf = NULL;
+
+	if (posix_memalign(&buf, 4096, BUF_SIZE)) {
+		cerr << "Failed to allocate the read buffer" << endl;
+		EXIT(1);
+	}
+
+	int fd = io->open(path.c_str(), O_RDONLY, 0);
+	if (fd < 0) {
+		cerr << "Opening " << path << " failed: " << strerror(errno)
+		     << endl;
+		EXIT(1);
+	}
+
+	do {
+		uint64_t off = 0;
+		uint64_t t = now_ns();
+
+		while (off < fsize) {
+			if (this->file->read_fd(fd, (char *) buf, off, fsize,
+						false, cerr) <= 0) {
+				cerr << "Reading " << path << " failed" << endl;
+				EXIT(1);
+			}
+		}
+		ns += now_ns() - t;
+		bytes += fsize;
+	} while (this->again(start));
+
+	io->close(fd);
+	free(buf);
+
+	this->add("read_fd", bytes * 1E3 / ns, "MB/s");
+}
+
+/* Path construction of a file in a directory 6 levels deep */
+void Bench::bench_dir_path(void)
+{
+	uint64_t ops = 0, len = 0;
+	uint64_t start = now_ns();
+
+	do {
+		for (int i = 0; i < 1000; i++)
+			len += this->dir->path().size();
+		ops += 1000;
+	} while (this->again(start));
+
+	// len keeps the calls from being optimized away
+	this->add("dir_path", len ? (now_ns() - start) / (double) ops : 0,
+		  "ns/op");
+}
+
+/* Insert and random delete of the file table, as free_space() and
+ * write_main() do, with the default number of files
+ */
+void Bench::bench_file_table(void)
+{
+	Filesystem *fs = this->fs;
+	uint64_t ops = 0;
+
+	for (int i = 0; i < QL_FSTEST_DEFAULT_NUM_FILES; i++) {
+		File *file = new File(this->dir);
+		this->dir->add_file(file);
+		fs->insert_file(file);
+	}
+
+	uint64_t start = now_ns();
+	do {
+		for (int i = 0; i < 1000; i++) {
+			File *file = fs->files[random() % fs->files.size()];
+
+			fs->scheduler.remove(file);
+			if (!file->is_verified())
+				fs->num_unverified--;
+			fs->erase_file(file);
+			fs->insert_file(file);
+		}
+		ops += 1000;
+	} while (this->again(start));
+	double ns = (now_ns() - start) / (double) ops;
+
+	while (!fs->files.empty()) {
+		File *file = fs->files.back();
+
+		fs->scheduler.remove(file);
+		fs->files.pop_back();
+		delete file;
+	}
+	fs->num_unverified = 0;
+
+	this->add("file_table", ns, "ns/op");
+}
+
+/* The statistics update of each stats interval and file deletion */
+void Bench::bench_stats(void)
+{
+	uint64_t ops = 0;
+	uint64_t start = now_ns();
+
+	do {
+		for (int i = 0; i < 1000; i++) {
+			this->fs->stats_now.write += BUF_SIZE;
+			this->fs->stats_now.num_files++;
+			this->fs->update_stats(false);
+		}
+		ops += 1000;
+	} while (this->again(start));
+
+	this->add("stats_update", (now_ns() - start) / (double) ops, "ns/op");
+}
+
+void Bench::run(void)
+{
+	this->bench_fill();
+	this->bench_compare();
+	this->bench_read();
+	this->bench_dir_path();
+	this->bench_file_table();
+	this->bench_stats();
+}
+
+/**
+ * Print the results as CSV, with a baseline the baseline values and the
+ * change in percent, positive is faster.
+ * Returns 1 if a benchmark is slower than the baseline by more than
+ * tolerance percent.
+ */
+int Bench::report(ostream &out, string baseline, double tolerance)
+{
+	map<string, double> base;
+	int ret = 0;
+
+	if (!baseline.empty()) {
+		ifstream in(baseline);
+		string line;
+
+		if (!in) {
+			cerr << "Cannot read the baseline " << baseline << endl;
+			EXIT(1);
+		}
+
+		while (getline(in, line)) {
+			istringstream fields(line);
+			string name, value;
+
+			if (getline(fields, name, ',') &&
+			    getline(fields, value, ',') && name != "benchmark")
+				base[name] = atof(value.c_str());
+		}
+	}
+
+	out << "benchmark,value,unit";
+	if (!baseline.empty())
+		out << ",baseline,change_pct,status";
+	out << endl;
+
+	for (BenchResult &res : this->results) {
+		out << res.name << "," << res.value << "," << res.unit;
+
+		auto it = base.find(res.name);
+		if (it != base.end() && it->second > 0) {
+			double change = (res.value / it->second - 1) * 100;
+
+			if (res.unit != "MB/s")
+				change = (it->second / res.value - 1) * 100;
+
+			const char *status = "ok";
+			if (change < -tolerance) {
+				status = "regressed";
+				ret = 1;
+			} else if (change > tolerance) {
+				status = "improved";
+			}
+
+			out << "," << it->second << "," << change << ","
+			    << status;
+		} else if (!baseline.empty()) {
+			out << ",,,new";
+		}
+		out << endl;
+	}
+
+	return ret;
+}
+
+static void usage(ostream &out, const char *cmd)
+{
+	out << "Usage: " << cmd << " [options]\n"
+	    << "Runs micro benchmarks of the fstest hot paths and prints\n"
+	    << "the results as CSV.\n\n"
+	    << "--time <ms>        - minimum time per benchmark (default "
+	    << BENCH_DEFAULT_TIME_MS << ")\n"
+	    << "--baseline <file>  - compare with an earlier output\n"
+	    << "--tolerance <pct>  - fail if a benchmark is slower than the\n"
+	    << "                     baseline by more (default "
+	    << BENCH_DEFAULT_TOLERANCE << ")\n";
+}
+
+int main(int argc, char * const argv[])
+{
+	uint64_t time_ms = BENCH_DEFAULT_TIME_MS;
+	double tolerance = BENCH_DEFAULT_TOLERANCE;
+	string baseline;
+
+	const struct option longopts[] = {
+		{ "help",      0, NULL, 'h' },
+		{ "time",      1, NULL,  1  },
+		{ "baseline",  1, NULL,  2  },
+		{ "tolerance", 1, NULL,  3  },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h", longopts, NULL)) != -1) {
+		switch (opt) {
+		case 'h':
+			usage(cout, argv[0]);
+			exit(0);
+		case 1:
+			time_ms = max(atoi(optarg), 1);
+			break;
+		case 2:
+			baseline = optarg;
+			break;
+		case 3:
+			tolerance = atof(optarg);
+			break;
+		default:
+			usage(cerr, argv[0]);
+			exit(1);
+		}
+	}
+
+	Config_fstest *cfg = get_global_cfg();
+	cfg->set_min_size_bits(BENCH_FILE_BITS);
+	cfg->set_max_size_bits(BENCH_FILE_BITS);
+	set_io_backend("mem", BENCH_MEM_SIZE, "");
+
+	// the directories and the filesystem tell what they do
+	ostringstream quiet;
+	streambuf *stdout_buf = cout.rdbuf(quiet.rdbuf());
+
+	// the memory backend goes with the process, nothing to clean up
+	Bench bench(time_ms * 1000 * 1000);
+	bench.run();
+
+	cout.rdbuf(stdout_buf);
+	return bench.report(cout, baseline, tolerance);
+}
@@ -0,0 +1,199 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include <sys/wait.h>
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "fstest.h"
+#include "benchtarget.h"
+
+#define BENCH_TMP_DIR "/var/tmp" // images are not kept in memory
+
+using namespace std;
+
+static BenchTarget bench_target;
+
+BenchTarget *get_bench_target(void)
+{
+	return &bench_target;
+}
+
+/* Run a command with its output discarded, returns its exit status or -1 */
+static int run_command(vector<string> args)
+{
+	vector<char *> argv;
+	for (string &arg : args)
+		argv.push_back((char *) arg.c_str());
+	argv.push_back(NULL);
+
+	pid_t pid = fork();
+	if (pid < 0)
+		return -1;
+
+	if (pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		if (null >= 0) {
+			dup2(null, STDOUT_FILENO);
+			close(null);
+		}
+		execvp(argv[0], argv.data());
+		_exit(127);
+	}
+
+	int status;
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+		return -1;
+
+	return WEXITSTATUS(status);
+}
+
+BenchTarget::BenchTarget(void)
+{
+	this->size = 0;
+	this->mounted = false;
+}
+
+/**
+ * Mount a tmpfs or, for any other fstype, a loop mounted image formatted
+ * with mkfs -t fstype. Needs root.
+ * Returns 0 or -1 after printing the error.
+ */
+int BenchTarget::create(uint64_t size, string fstype, string mount_opts)
+{
+	this->size = size;
+	this->fstype = fstype;
+	this->mount_opts = mount_opts;
+
+	char dir_template[] = BENCH_TMP_DIR "/fstest-bench.XXXXXX";
+	if (mkdtemp(dir_template) == NULL) {
+		cerr << "Error: creating the benchmark mount point failed: "
+		     << strerror(errno) << endl;
+		return -1;
+	}
+	this->dir = dir_template;
+
+	if (fstype == "tmpfs") {
+		string opts = "size=" + to_string(size);
+		if (!mount_opts.empty())
+			opts += "," + mount_opts;
+
+		if (mount("fstest", this->dir.c_str(), "tmpfs", 0,
+			  opts.c_str())) {
+			cerr << "Error: mounting tmpfs on " << this->dir
+			     << " failed: " << strerror(errno) << endl;
+			goto out_rmdir;
+		}
+	} else {
+		this->image = this->dir + ".img";
+
+		int fd = open(this->image.c_str(), O_RDWR | O_CREAT | O_EXCL,
+			      0600);
+		if (fd < 0 || ftruncate(fd, size)) {
+			cerr << "Error: creating the image " << this->image
+			     << " failed: " << strerror(errno) << endl;
+			if (fd >= 0)
+				close(fd);
+			goto out_unlink;
+		}
+		close(fd);
+
+		if (run_command({ "mkfs", "-t", fstype, this->image })) {
+			cerr << "Error: mkfs -t " << fstype << " "
+			     << this->image << " failed" << endl;
+			goto out_unlink;
+		}
+
+		string opts = "loop";
+		if (!mount_opts.empty())
+			opts += "," + mount_opts;
+
+		if (run_command({ "mount", "-t", fstype, "-o", opts,
+				  this->image, this->dir })) {
+			cerr << "Error: mounting " << this->image << " on "
+			     << this->dir << " failed" << endl;
+			goto out_unlink;
+		}
+	}
+
+	this->mounted = true;
+	return 0;
+
+out_unlink:
+	if (!this->image.empty())
+		unlink(this->image.c_str());
+out_rmdir:
+	rmdir(this->dir.c_str());
+	return -1;
+}
+
+/* Unmount and remove the target, keep leaves it mounted for a look at it */
+void BenchTarget::destroy(bool keep)
+{
+	if (!this->mounted)
+		return;
+
+	if (keep) {
+		cout << "Keeping the benchmark target mounted on " << this->dir
+		     << endl;
+		return;
+	}
+
+	if (umount(this->dir.c_str())) {
+		cerr << "Error: unmounting " << this->dir << " failed: "
+		     << strerror(errno) << endl;
+		return;
+	}
+	this->mounted = false;
+
+	rmdir(this->dir.c_str());
+	if (!this->image.empty())
+		unlink(this->image.c_str());
+}
+
+/* e.g. "ext4 loop 1024 MiB noatime", for the reports */
+string BenchTarget::describe(void) const
+{
+	ostringstream desc;
+
+	desc << this->fstype;
+	if (!this->image.empty())
+		desc << " loop";
+	desc << " " << this->size / MEGA << " MiB";
+	if (!this->mount_opts.empty())
+		desc << " " << this->mount_opts;
+
+	return desc.str();
+}
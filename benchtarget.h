@@ -0,0 +1,64 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __BENCHTARGET_H__
+#define __BENCHTARGET_H__
+
+#include <stdint.h>
+#include <string>
+
+/* The scratch filesystem of --benchmark: a tmpfs or a loop mounted image
+ * file of a given size, mounted on a new directory and removed again
+ * after the run.
+ */
+class BenchTarget
+{
+private:
+	std::string fstype;
+	std::string mount_opts;
+	uint64_t size;
+	std::string dir;   // mount point
+	std::string image; // backing file of a loop mount
+	bool mounted;
+
+public:
+	BenchTarget(void);
+
+	int create(uint64_t size, std::string fstype, std::string mount_opts);
+	void destroy(bool keep);
+
+	std::string get_dir(void) const
+	{
+		return this->dir;
+	}
+
+	std::string describe(void) const;
+};
+
+BenchTarget *get_bench_target(void);
+
+#endif // __BENCHTARGET_H__
@@ -0,0 +1,185 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <fstream>
+#include <vector>
+
+#include "fstest.h"
+#include "config.h"
+#include "cache.h"
+#include "iobackend.h"
+
+#define BALLOON_MIN_RESERVE ((uint64_t) 256 << 20) // the balloon leaves at least this
+
+using namespace std;
+
+// global evictions are serialized, readers waiting for one re-check after it
+static pthread_mutex_t evict_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int cache_resident(int fd, uint64_t size, uint64_t &resident,
+		   uint64_t &pages)
+{
+	const uint64_t page_size = sysconf(_SC_PAGESIZE);
+
+	resident = 0;
+	pages = (size + page_size - 1) / page_size;
+	if (size == 0)
+		return 0;
+
+	// mapping the file does not read it, mincore() does not fault pages in
+	void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	vector<unsigned char> vec(pages);
+	int rc = 0;
+	if (mincore(map, size, vec.data()) == 0) {
+		for (unsigned char v : vec)
+			resident += v & 1;
+	} else
+		rc = -errno;
+
+	munmap(map, size);
+	return rc;
+}
+
+/* Value of key in /proc/meminfo, in bytes */
+static uint64_t meminfo(const string &key)
+{
+	ifstream in("/proc/meminfo");
+	string name;
+	uint64_t kb;
+
+	while (in >> name >> kb) {
+		if (name == key + ":")
+			return kb * 1024;
+		in.ignore(64, '\n');
+	}
+
+	return 0;
+}
+
+/* Write 1 (page cache only) to drop_caches, needs root. A failure is only
+ * reported once, the sample then keeps the cached pages.
+ * The evict mutex has to be locked.
+ */
+static void drop_caches(void)
+{
+	static bool warned = false;
+
+	int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd == -1 || write(fd, "1", 1) != 1) {
+		int err = errno;
+
+		if (!warned)
+			cerr << "Dropping the page cache failed: "
+			     << strerror(err) << ", not evicting" << endl;
+		warned = true;
+	}
+	if (fd != -1)
+		close(fd);
+}
+
+/* Allocate and touch nearly all available memory, the kernel has to
+ * reclaim the page cache for it. Freed again right away.
+ */
+static void inflate_balloon(void)
+{
+	const uint64_t page_size = sysconf(_SC_PAGESIZE);
+	uint64_t reserve = max(meminfo("MemTotal") / 20, BALLOON_MIN_RESERVE);
+	uint64_t avail = meminfo("MemAvailable");
+
+	if (avail <= reserve)
+		return;
+
+	uint64_t size = avail - reserve;
+	char *balloon = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE,
+				      MAP_PRIVATE | MAP_ANONYMOUS |
+				      MAP_NORESERVE, -1, 0);
+	if (balloon == MAP_FAILED) {
+		cerr << "Balloon of " << size / MEGA << " MiB failed: "
+		     << strerror(errno) << endl;
+		return;
+	}
+
+	for (uint64_t off = 0; off < size; off += page_size)
+		balloon[off] = 1;
+
+	munmap(balloon, size);
+}
+
+void cache_prepare(int fd, uint64_t size, CacheSample *sample)
+{
+	enum evict_mode mode = get_global_cfg()->get_evict_mode();
+	uint64_t resident, pages;
+
+	if (!get_io_backend()->has_page_cache())
+		return;
+
+	if (cache_resident(fd, size, resident, pages))
+		return; // no mmap support, nothing known
+
+	sample->pages = pages;
+	sample->resident = resident;
+	sample->cached = resident;
+
+	if (mode == EVICT_NONE || resident == 0)
+		return;
+
+	if (mode == EVICT_DIRECT) {
+		sample->cached = 0; // O_DIRECT reads bypass the page cache
+		return;
+	}
+
+	// cheap and only this file, but not every filesystem honors it
+	get_io_backend()->fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	cache_resident(fd, size, resident, pages);
+
+	if (resident > 0) {
+		pthread_mutex_lock(&evict_mutex);
+
+		// another reader might have evicted it in the meantime
+		cache_resident(fd, size, resident, pages);
+		if (resident > 0) {
+			if (mode == EVICT_DROP_CACHES)
+				drop_caches();
+			else
+				inflate_balloon();
+
+			cache_resident(fd, size, resident, pages);
+		}
+
+		pthread_mutex_unlock(&evict_mutex);
+	}
+
+	sample->cached = resident;
+}
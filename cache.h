@@ -0,0 +1,49 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdint.h>
+
+/* Page cache state of a file at the start of its verification */
+struct CacheSample {
+	uint64_t pages {0};    // pages of the file
+	uint64_t resident {0}; // of them in the page cache before eviction
+	uint64_t cached {0};   // still in the page cache when reading starts
+};
+
+/* Count the pages of [0, size) of fd that are in the page cache */
+int cache_resident(int fd, uint64_t size, uint64_t &resident,
+		   uint64_t &pages);
+
+/* Sample the page cache state of fd and, depending on --evict, get its
+ * pages out of the page cache before it is verified.
+ */
+void cache_prepare(int fd, uint64_t size, CacheSample *sample);
+
+#endif // __CACHE_H__
@@ -0,0 +1,31 @@
+#!/bin/bash
+
+# Injects each fault type alone on the mem backend and fails unless the
+# verification found every injected fault of it. Faults of files that were
+# not verified again before the end of the run do not count.
+
+fstest=${FSTEST:-$(dirname $0)/fstest}
+dir=${1:-/tmp}
+is_error=0
+
+for type in bitflip drop misdirect stale; do
+    out=$($fstest --io-backend mem --mem-size 64 --inject-faults ${type}=0.01 \
+        -t 8 $dir 2>&1)
+    counts=$(echo "$out" | sed -n "s/^Faults injected: .*[(,] \?${type} \([0-9]*\)\/\([0-9]*\).*/\1 \2/p")
+    pending=$(echo "$out" | sed -n "s/^Faults detected: .* undetected at exit: \([0-9]*\) .*/\1/p")
+    set -- $counts
+    if [ -z "$2" ] || [ "$2" -eq 0 ]; then
+        echo "$type: no faults injected"
+        is_error=1
+        continue
+    fi
+
+    echo "$type: detected $1 of $2 faults, ${pending:-?} still unverified"
+    if [ "$1" -ne $(($2 - ${pending:-0})) ] ||
+       ! echo "$out" | grep -q "false alarms: 0 "; then
+        echo "$out" | grep "^Faults detected:"
+        is_error=1
+    fi
+done
+
+exit ${is_error}
@@ -17,4 +17,11 @@ for i in $dir/fstest-*.err; do
     fi
 done
 
+for i in $dir/fstest-*.rc; do
+    if [ -f $i ] && [ "$(cat $i)" != "0" ]; then
+        echo "Run with exit code $(cat $i): $i"
+        is_error=1
+    fi
+done
+
 exit ${is_error}
@@ -32,6 +32,50 @@
 #define DEFAULT_MIN_SIZE_BITS 20 // 2^20 = 1MiB
 #define DEFAULT_MAX_SIZE_BITS 30 // 2^30 = 1GiB
 
+// files of at least 2^n bytes are verified by several threads in parallel
+#define DEFAULT_PARALLEL_VERIFY_BITS 28 // 2^28 = 256MiB
+
+#define DEFAULT_READ_BATCH 64 // files sorted per batch for physical read order
+
+#define DEFAULT_READ_WRITE_RATIO 1.0 // bytes verified per byte written
+
+#define DEFAULT_STALL_THRESHOLD 10 // [s] operations taking longer are reported
+
+#define DEFAULT_MEM_SIZE_MB 1024 // capacity of the memory I/O backend
+
+#define DEFAULT_BENCH_TIMEOUT 60 // [s] of --benchmark without --timeout
+
+#define DEFAULT_IO_SIZE_KB 1024 // largest write and read call, the buffer size
+#define MIN_IO_SIZE_KB 4 // O_DIRECT alignment
+
+#define DEFAULT_SWEEP_POINT_TIME 30 // [s] per --sweep point without --timeout
+
+#include "metadata.h"
+#include "faultbackend.h"
+#include "cpustats.h"
+#include "placement.h"
+
+// order in which the read thread verifies files
+enum read_order {
+	READ_ORDER_AGE,    // stalest file first
+	READ_ORDER_INODE,  // batches of stale files sorted by inode number
+	READ_ORDER_FIEMAP, // batches of stale files sorted by physical offset
+};
+
+// how the read thread gets a file out of the page cache before verifying it
+enum evict_mode {
+	EVICT_NONE,        // only fadvise hints
+	EVICT_DIRECT,      // O_DIRECT reads
+	EVICT_DROP_CACHES, // write to /proc/sys/vm/drop_caches, needs root
+	EVICT_BALLOON,     // allocate memory until the kernel reclaims the cache
+};
+
+// how a written file is synced
+enum sync_policy {
+	SYNC_FDATASYNC,
+	SYNC_FSYNC,
+	SYNC_NONE, // left to the writeback, not with --manifest
+};
 
 class Config_fstest {
 public:
@@ -41,7 +85,11 @@ private:
 	size_t usage_percent {MAX_USAGE_PERCENT} ; // max fill level
 	ssize_t timeout {TIMEOUT};
 	bool immediate_check {false};
-	string testdir;
+	struct Target {
+		string dir;
+		size_t percent; // fill goal, 0 for the global one
+	};
+	vector<Target> targets;
 	size_t min_size_bits {DEFAULT_MIN_SIZE_BITS};
 	size_t max_size_bits {DEFAULT_MAX_SIZE_BITS};
 	size_t max_files {QL_FSTEST_DEFAULT_NUM_FILES};
@@ -50,6 +98,47 @@ private:
 	bool no_check {false}; // do not check writes
 	bool keep_open{ false }; // keep files open after write
 	bool stop_when_max_files{ false }; // stop when max files reached
+	enum read_order read_order {READ_ORDER_AGE};
+	size_t read_batch {DEFAULT_READ_BATCH};
+	enum evict_mode evict_mode {EVICT_NONE};
+	double read_write_ratio {DEFAULT_READ_WRITE_RATIO}; // 0 for no pacing
+	double stall_threshold {DEFAULT_STALL_THRESHOLD}; // 0 for no watchdog
+	bool stall_stacks {false}; // print the kernel stack of stalled threads
+	string io_backend {"posix"};
+	size_t mem_size_mb {DEFAULT_MEM_SIZE_MB};
+	string fault_spec; // empty for no fault injection
+	size_t bench_size_mb {0}; // --benchmark target size, 0 for none
+	string bench_fstype {"tmpfs"};
+	string bench_mount_opts;
+	string bench_csv; // summary of --benchmark, empty for none
+	bool has_seed {false};
+	unsigned seed {0};
+	size_t io_size_kb {DEFAULT_IO_SIZE_KB};
+	size_t num_streams {1}; // files each write thread writes at once
+	size_t stream_chunk_kb {0}; // per file and turn, 0 for --io-size
+	enum sync_policy sync_policy {SYNC_FDATASYNC};
+	string sweep_spec; // empty for no --sweep
+	size_t sweep_bytes_mb {0}; // per point, 0 to run for the timeout
+	string sweep_out; // CSV or, for *.json, JSON matrix of the sweep
+	enum cpu_stats_mode cpu_stats_mode {CPU_STATS_PERF};
+	string cpus_spec; // --cpus, empty for no CPU placement
+	string numa_spec; // --numa, empty for no memory node placement
+	size_t num_writers {0}; // write threads over all targets, 0 for one per target
+	size_t num_readers {1}; // read (verify) threads per target
+	size_t num_jobs {0}; // fstest processes sharing one space budget
+	size_t verify_threads {1}; // threads verifying a single large file
+	bool shared_reads {false}; // files stay schedulable while being read
+	size_t parallel_verify_bits {DEFAULT_PARALLEL_VERIFY_BITS};
+	string manifest_path; // empty for no manifest
+	size_t scan_threads {0}; // 0 for one per CPU
+	string control_path; // Unix socket, empty for none
+	bool checksum {false}; // CRC32C of each file in an xattr
+	bool keep_data {false}; // do not delete the test tree at the end
+	size_t cleanup_threads {0}; // 0 for one per CPU
+	size_t meta_threads {0}; // metadata workload threads per target
+	bool meta_only {false}; // no data write and read threads
+	size_t meta_files {DEFAULT_META_FILES}; // entries per meta thread
+	string meta_mix {DEFAULT_META_MIX};
 
 public:
 	void set_usage(size_t value)
@@ -82,25 +171,39 @@ public:
 		return this->immediate_check;
 	}
 
-	void set_testdir(string testdir)
+	/* Add a directory to test in, percent 0 means the global goal */
+	void add_target(string dir, size_t percent)
 	{
-		if ((testdir.length() > 0)
-		&& (testdir.at(testdir.length() - 1) != '/')) {
-			testdir += '/';
-		}
+		if ((dir.length() > 0) && (dir.at(dir.length() - 1) != '/'))
+			dir += '/';
 
-		// add pid to directory
-		pid_t pid = getpid();
-		stringstream str;
-		str << pid;
-		testdir += "fstest." + str.str() + "/";
+		this->targets.push_back(Target{ dir, percent });
+	}
+
+	size_t get_num_targets(void)
+	{
+		return this->targets.size();
+	}
 
-		this->testdir = testdir;
+	string get_target_dir(size_t idx)
+	{
+		return this->targets.at(idx).dir;
 	}
 
-	string get_testdir(void)
+	size_t get_target_usage(size_t idx)
 	{
-		return this->testdir;
+		size_t percent = this->targets.at(idx).percent;
+
+		return percent ? percent : this->usage_percent;
+	}
+
+	/* The directory of this process in the target, fstest.<pid>/ */
+	string get_testdir(size_t idx)
+	{
+		stringstream str;
+		str << getpid();
+
+		return get_target_dir(idx) + "fstest." + str.str() + "/";
 	}
 
 	void set_min_size_bits(int min)
@@ -188,6 +291,528 @@ public:
 		return this->stop_when_max_files;
 	}
 
+	int set_read_order(string order)
+	{
+		if (order == "age")
+			this->read_order = READ_ORDER_AGE;
+		else if (order == "inode")
+			this->read_order = READ_ORDER_INODE;
+		else if (order == "fiemap")
+			this->read_order = READ_ORDER_FIEMAP;
+		else
+			return -EINVAL;
+
+		return 0;
+	}
+
+	enum read_order get_read_order(void)
+	{
+		return this->read_order;
+	}
+
+	int set_evict_mode(string mode)
+	{
+		if (mode == "none")
+			this->evict_mode = EVICT_NONE;
+		else if (mode == "direct")
+			this->evict_mode = EVICT_DIRECT;
+		else if (mode == "drop-caches")
+			this->evict_mode = EVICT_DROP_CACHES;
+		else if (mode == "balloon")
+			this->evict_mode = EVICT_BALLOON;
+		else
+			return -EINVAL;
+
+		return 0;
+	}
+
+	enum evict_mode get_evict_mode(void)
+	{
+		return this->evict_mode;
+	}
+
+	/* A power of 2 from MIN_IO_SIZE_KB up to the buffer size,
+	 * returns -EINVAL otherwise */
+	int set_io_size_kb(size_t kb)
+	{
+		if (kb < MIN_IO_SIZE_KB || kb > DEFAULT_IO_SIZE_KB ||
+		    (kb & (kb - 1)))
+			return -EINVAL;
+
+		this->io_size_kb = kb;
+		return 0;
+	}
+
+	size_t get_io_size(void)
+	{
+		return this->io_size_kb * 1024;
+	}
+
+	/* "<files>[:<KiB>]", returns -EINVAL for a bad count or chunk */
+	int set_streams(string spec)
+	{
+		size_t colon = spec.find(':');
+		size_t chunk_kb = 0;
+
+		if (colon != string::npos) {
+			string chunk = spec.substr(colon + 1);
+
+			if (chunk.empty() ||
+			    chunk.find_first_not_of("0123456789") != string::npos)
+				return -EINVAL;
+			chunk_kb = atol(chunk.c_str());
+			if (chunk_kb < MIN_IO_SIZE_KB ||
+			    chunk_kb % MIN_IO_SIZE_KB)
+				return -EINVAL;
+			spec.erase(colon);
+		}
+
+		if (spec.empty() ||
+		    spec.find_first_not_of("0123456789") != string::npos ||
+		    atoi(spec.c_str()) <= 0)
+			return -EINVAL;
+
+		this->num_streams = atoi(spec.c_str());
+		this->stream_chunk_kb = chunk_kb;
+		return 0;
+	}
+
+	size_t get_num_streams(void)
+	{
+		return this->num_streams;
+	}
+
+	/* bytes written to one file before the next one's turn */
+	size_t get_stream_chunk(void)
+	{
+		if (this->stream_chunk_kb == 0)
+			return this->get_io_size();
+
+		return this->stream_chunk_kb * 1024;
+	}
+
+	int set_sync_policy(string policy)
+	{
+		if (policy == "fdatasync")
+			this->sync_policy = SYNC_FDATASYNC;
+		else if (policy == "fsync")
+			this->sync_policy = SYNC_FSYNC;
+		else if (policy == "none")
+			this->sync_policy = SYNC_NONE;
+		else
+			return -EINVAL;
+
+		return 0;
+	}
+
+	enum sync_policy get_sync_policy(void)
+	{
+		return this->sync_policy;
+	}
+
+	int set_cpu_stats_mode(string mode)
+	{
+		if (mode == "off")
+			this->cpu_stats_mode = CPU_STATS_OFF;
+		else if (mode == "rusage")
+			this->cpu_stats_mode = CPU_STATS_RUSAGE;
+		else if (mode == "perf")
+			this->cpu_stats_mode = CPU_STATS_PERF;
+		else
+			return -EINVAL;
+
+		return 0;
+	}
+
+	enum cpu_stats_mode get_cpu_stats_mode(void)
+	{
+		return this->cpu_stats_mode;
+	}
+
+	/* Returns -EINVAL for an invalid spec */
+	int set_cpus_spec(string spec)
+	{
+		Placement placement;
+
+		if (placement.parse_cpus(spec))
+			return -EINVAL;
+
+		this->cpus_spec = spec;
+		return 0;
+	}
+
+	string get_cpus_spec(void)
+	{
+		return this->cpus_spec;
+	}
+
+	/* Returns -EINVAL for an invalid spec */
+	int set_numa_spec(string spec)
+	{
+		Placement placement;
+
+		if (placement.parse_numa(spec))
+			return -EINVAL;
+
+		this->numa_spec = spec;
+		return 0;
+	}
+
+	string get_numa_spec(void)
+	{
+		return this->numa_spec;
+	}
+
+	void set_read_write_ratio(double ratio)
+	{
+		this->read_write_ratio = ratio;
+	}
+
+	double get_read_write_ratio(void)
+	{
+		return this->read_write_ratio;
+	}
+
+	void set_stall_threshold(double seconds)
+	{
+		this->stall_threshold = seconds;
+	}
+
+	double get_stall_threshold(void)
+	{
+		return this->stall_threshold;
+	}
+
+	void set_stall_stacks(void)
+	{
+		this->stall_stacks = true;
+	}
+
+	bool get_stall_stacks(void)
+	{
+		return this->stall_stacks;
+	}
+
+	/* Returns -EINVAL for an unknown backend */
+	int set_io_backend(string name)
+	{
+		if (name != "posix" && name != "mem")
+			return -EINVAL;
+
+		this->io_backend = name;
+		return 0;
+	}
+
+	string get_io_backend(void)
+	{
+		return this->io_backend;
+	}
+
+	void set_mem_size_mb(size_t size)
+	{
+		this->mem_size_mb = size;
+	}
+
+	size_t get_mem_size_mb(void)
+	{
+		return this->mem_size_mb;
+	}
+
+	/* Returns -EINVAL for an invalid spec */
+	int set_fault_spec(string spec)
+	{
+		double rates[FAULT_NUM_TYPES];
+
+		if (FaultBackend::parse_spec(spec, rates))
+			return -EINVAL;
+
+		this->fault_spec = spec;
+		return 0;
+	}
+
+	string get_fault_spec(void)
+	{
+		return this->fault_spec;
+	}
+
+	/* "<MiB>[:<fstype>]", returns -EINVAL for a bad size */
+	int set_benchmark(string spec)
+	{
+		size_t colon = spec.find(':');
+
+		if (colon != string::npos) {
+			this->bench_fstype = spec.substr(colon + 1);
+			spec.erase(colon);
+		}
+
+		if (spec.empty() || this->bench_fstype.empty() ||
+		    spec.find_first_not_of("0123456789") != string::npos ||
+		    atoi(spec.c_str()) <= 0)
+			return -EINVAL;
+
+		this->bench_size_mb = atoi(spec.c_str());
+		return 0;
+	}
+
+	size_t get_bench_size_mb(void)
+	{
+		return this->bench_size_mb;
+	}
+
+	string get_bench_fstype(void)
+	{
+		return this->bench_fstype;
+	}
+
+	void set_bench_mount_opts(string opts)
+	{
+		this->bench_mount_opts = opts;
+	}
+
+	string get_bench_mount_opts(void)
+	{
+		return this->bench_mount_opts;
+	}
+
+	void set_bench_csv(string path)
+	{
+		this->bench_csv = path;
+	}
+
+	string get_bench_csv(void)
+	{
+		return this->bench_csv;
+	}
+
+	void set_seed(unsigned seed)
+	{
+		this->seed = seed;
+		this->has_seed = true;
+	}
+
+	bool get_has_seed(void)
+	{
+		return this->has_seed;
+	}
+
+	unsigned get_seed(void)
+	{
+		return this->seed;
+	}
+
+	void set_sweep_spec(string spec)
+	{
+		this->sweep_spec = spec;
+	}
+
+	string get_sweep_spec(void)
+	{
+		return this->sweep_spec;
+	}
+
+	void set_sweep_bytes_mb(size_t mb)
+	{
+		this->sweep_bytes_mb = mb;
+	}
+
+	size_t get_sweep_bytes_mb(void)
+	{
+		return this->sweep_bytes_mb;
+	}
+
+	void set_sweep_out(string path)
+	{
+		this->sweep_out = path;
+	}
+
+	string get_sweep_out(void)
+	{
+		return this->sweep_out;
+	}
+
+	void set_read_batch(size_t num)
+	{
+		this->read_batch = num;
+	}
+
+	size_t get_read_batch(void)
+	{
+		return this->read_batch;
+	}
+
+	void set_num_jobs(size_t num)
+	{
+		this->num_jobs = num;
+	}
+
+	size_t get_num_jobs(void)
+	{
+		return this->num_jobs;
+	}
+
+	void set_num_writers(size_t num)
+	{
+		this->num_writers = num;
+	}
+
+	size_t get_num_writers(void)
+	{
+		return this->num_writers;
+	}
+
+	void set_num_readers(size_t num)
+	{
+		this->num_readers = num;
+	}
+
+	size_t get_num_readers(void)
+	{
+		return this->num_readers;
+	}
+
+	void set_shared_reads(void)
+	{
+		this->shared_reads = true;
+	}
+
+	bool get_shared_reads(void)
+	{
+		return this->shared_reads;
+	}
+
+	void set_verify_threads(size_t num)
+	{
+		this->verify_threads = num;
+	}
+
+	size_t get_verify_threads(void)
+	{
+		return this->verify_threads;
+	}
+
+	void set_parallel_verify_bits(size_t bits)
+	{
+		this->parallel_verify_bits = bits;
+	}
+
+	size_t get_parallel_verify_bits(void)
+	{
+		return this->parallel_verify_bits;
+	}
+
+	void set_manifest_path(string path)
+	{
+		this->manifest_path = path;
+	}
+
+	string get_manifest_path(void)
+	{
+		return this->manifest_path;
+	}
+
+	void set_checksum(void)
+	{
+		this->checksum = true;
+	}
+
+	bool get_checksum(void)
+	{
+		return this->checksum;
+	}
+
+	void set_keep_data(void)
+	{
+		this->keep_data = true;
+	}
+
+	bool get_keep_data(void)
+	{
+		return this->keep_data;
+	}
+
+	void set_cleanup_threads(size_t num)
+	{
+		this->cleanup_threads = num;
+	}
+
+	size_t get_cleanup_threads(void)
+	{
+		if (this->cleanup_threads == 0)
+			return max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+
+		return this->cleanup_threads;
+	}
+
+	void set_meta_threads(size_t num)
+	{
+		this->meta_threads = num;
+	}
+
+	size_t get_meta_threads(void)
+	{
+		return this->meta_threads;
+	}
+
+	void set_meta_only(void)
+	{
+		this->meta_only = true;
+	}
+
+	bool get_meta_only(void)
+	{
+		return this->meta_only;
+	}
+
+	void set_meta_files(size_t num)
+	{
+		this->meta_files = num;
+	}
+
+	size_t get_meta_files(void)
+	{
+		return this->meta_files;
+	}
+
+	/* Returns -EINVAL for an invalid mix */
+	int set_meta_mix(string mix)
+	{
+		unsigned weights[META_NUM_OPS];
+
+		if (MetaWorkload::parse_mix(mix, weights))
+			return -EINVAL;
+
+		this->meta_mix = mix;
+		return 0;
+	}
+
+	string get_meta_mix(void)
+	{
+		return this->meta_mix;
+	}
+
+	void set_control_path(string path)
+	{
+		this->control_path = path;
+	}
+
+	string get_control_path(void)
+	{
+		return this->control_path;
+	}
+
+	void set_scan_threads(size_t num)
+	{
+		this->scan_threads = num;
+	}
+
+	size_t get_scan_threads(void)
+	{
+		if (this->scan_threads == 0)
+			return max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+
+		return this->scan_threads;
+	}
+
 };
 
 Config_fstest *get_global_cfg(void);
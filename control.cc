@@ -0,0 +1,487 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <functional>
+#include <map>
+
+#include "fstest.h"
+#include "control.h"
+#include "cpustats.h"
+#include "ratelimit.h"
+#include "trace.h"
+#include "watchdog.h"
+
+using namespace std;
+
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+static vector<ThreadState *> thread_states; // never freed, a few per thread
+static map<string, int> thread_counts; // per role, for the names
+static thread_local ThreadState *thread_state;
+
+static atomic<bool> paused {false};
+
+static ControlServer control_server;
+
+ControlServer *get_control_server(void)
+{
+	return &control_server;
+}
+
+/* Make the calling thread known to the control endpoint */
+void thread_register(const char *role, string target)
+{
+	ThreadState *state = new ThreadState;
+
+	pthread_mutex_lock(&threads_mutex);
+	state->name = string(role) + "-" + to_string(thread_counts[role]++);
+	state->target = target;
+	state->tid = syscall(SYS_gettid);
+	thread_states.push_back(state);
+	pthread_mutex_unlock(&threads_mutex);
+
+	thread_state = state;
+}
+
+/* Name and target of a thread, e.g. for the stall watchdog */
+string thread_describe(uint32_t tid)
+{
+	string desc = "thread " + to_string(tid);
+
+	pthread_mutex_lock(&threads_mutex);
+	// thread ids are reused, the last registered thread is the one
+	for (auto it = thread_states.rbegin(); it != thread_states.rend(); ++it) {
+		if ((*it)->tid == tid) {
+			desc = (*it)->name + " (" + desc + ", " +
+			       (*it)->target + ")";
+			break;
+		}
+	}
+	pthread_mutex_unlock(&threads_mutex);
+
+	return desc;
+}
+
+void thread_set_state(enum thread_state state, uint32_t file_id)
+{
+	if (thread_state == NULL)
+		return;
+
+	thread_state->file_id.store(file_id, memory_order_relaxed);
+	thread_state->state.store(state, memory_order_relaxed);
+}
+
+/* Block the calling test thread while paused by the control endpoint */
+void control_wait_if_paused(void)
+{
+	if (!paused)
+		return;
+
+	thread_set_state(THREAD_PAUSED);
+	while (paused)
+		usleep(100 * 1000);
+	thread_set_state(THREAD_IDLE);
+}
+
+static void *run_control_thread(void *arg)
+{
+	ControlServer *server = (ControlServer *) arg;
+
+	server->serve();
+	return NULL;
+}
+
+int ControlServer::start(string path)
+{
+	struct sockaddr_un addr;
+
+	if (path.length() >= sizeof(addr.sun_path)) {
+		cerr << "Control socket path too long: " << path << endl;
+		return -1;
+	}
+
+	this->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (this->fd == -1) {
+		cerr << "Creating control socket failed: " << strerror(errno)
+		     << endl;
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+	int rc = bind(this->fd, (struct sockaddr *) &addr, sizeof(addr));
+
+	// left over by a killed run if nobody listens on it anymore
+	if (rc != 0 && errno == EADDRINUSE) {
+		int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+		if (probe != -1 && connect(probe, (struct sockaddr *) &addr,
+					   sizeof(addr)) != 0 &&
+		    errno == ECONNREFUSED) {
+			unlink(path.c_str());
+			rc = bind(this->fd, (struct sockaddr *) &addr,
+				  sizeof(addr));
+		}
+
+		if (probe != -1)
+			close(probe);
+	}
+
+	if (rc != 0 || listen(this->fd, 16) != 0) {
+		cerr << "Binding control socket " << path << " failed: "
+		     << strerror(errno) << endl;
+		close(this->fd);
+		this->fd = -1;
+		return -1;
+	}
+
+	this->path = path;
+
+	rc = pthread_create(&this->thread, NULL, run_control_thread, this);
+	if (rc) {
+		cerr << "Failed to start the control thread: " << strerror(rc)
+		     << endl;
+		EXIT(1);
+	}
+
+	cout << "Control socket      : " << path << endl;
+	return 0;
+}
+
+void ControlServer::shutdown(void)
+{
+	if (this->fd == -1)
+		return;
+
+	this->stopped = true;
+	pthread_join(this->thread, NULL);
+
+	close(this->fd);
+	unlink(this->path.c_str());
+	this->fd = -1;
+}
+
+void ControlServer::serve(void)
+{
+	while (!this->stopped) {
+		struct pollfd pfd = { this->fd, POLLIN, 0 };
+
+		// wake up regularly to notice shutdown()
+		if (poll(&pfd, 1, 500) <= 0)
+			continue;
+
+		int client = accept4(this->fd, NULL, NULL, SOCK_CLOEXEC);
+		if (client == -1)
+			continue;
+
+		// a stuck client must not block the endpoint
+		struct timeval tv = { 2, 0 };
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+		this->handle(client);
+		close(client);
+	}
+}
+
+void ControlServer::handle(int client)
+{
+	char buf[256];
+	ssize_t len = recv(client, buf, sizeof(buf) - 1, 0);
+	if (len < 0)
+		return;
+	buf[len] = '\0';
+
+	string line(buf, strcspn(buf, "\r\n"));
+	string reply;
+
+	if (line.compare(0, 4, "GET ") == 0) {
+		string body = this->metrics();
+
+		reply = "HTTP/1.0 200 OK\r\n"
+			"Content-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: " + to_string(body.length()) +
+			"\r\n\r\n" + body;
+	} else {
+		reply = this->command(line);
+	}
+
+	size_t off = 0;
+	while (off < reply.length()) {
+		ssize_t rc = send(client, reply.data() + off,
+				  reply.length() - off, MSG_NOSIGNAL);
+		if (rc <= 0)
+			break;
+		off += rc;
+	}
+}
+
+string ControlServer::command(const string &line)
+{
+	istringstream in(line);
+	string cmd;
+
+	in >> cmd;
+
+	if (cmd.empty() || cmd == "metrics")
+		return this->metrics();
+
+	if (cmd == "pause") {
+		paused = true;
+		cout << "Paused by the control socket" << endl;
+	} else if (cmd == "resume") {
+		paused = false;
+		cout << "Resumed by the control socket" << endl;
+	} else if (cmd == "stop") {
+		cout << "Stop requested by the control socket" << endl;
+		paused = false;
+		request_stop();
+	} else if (cmd == "dump-trace") {
+		trace_dump("control");
+	} else if (cmd == "rate") {
+		string which;
+		double rate;
+
+		if (!(in >> which >> rate) || rate < 0)
+			return "error: usage: rate write|read|files <rate>\n";
+
+		RateLimits *limits = get_rate_limits();
+		if (which == "write")
+			limits->write.set_rate(rate * MEGA);
+		else if (which == "read")
+			limits->read.set_rate(rate * MEGA);
+		else if (which == "files")
+			limits->files.set_rate(rate);
+		else
+			return "error: unknown rate '" + which + "'\n";
+	} else {
+		return "error: unknown command '" + cmd + "'\n";
+	}
+
+	return "ok\n";
+}
+
+static const char *state_name(int state)
+{
+	switch (state) {
+	case THREAD_IDLE:      return "idle";
+	case THREAD_CREATING:  return "creating";
+	case THREAD_WRITING:   return "writing";
+	case THREAD_DELETING:  return "deleting";
+	case THREAD_VERIFYING: return "verifying";
+	case THREAD_WAITING:   return "waiting";
+	case THREAD_PAUSED:    return "paused";
+	case THREAD_META:      return "metadata";
+	}
+	return "unknown";
+}
+
+/* Cumulative buckets at the powers of two from 1us to 64s */
+static void print_histogram(ostream &out, const char *name,
+			    const string &labels, const LatencySnapshot &snap)
+{
+	size_t idx = 0;
+	uint64_t count = 0;
+
+	for (int bits = 10; bits <= 36; bits++) {
+		uint64_t bound = 1ULL << bits;
+
+		while (idx < snap.buckets.size() &&
+		       LatencyHistogram::bucket_upper(idx) < bound)
+			count += snap.buckets[idx++];
+
+		out << name << "_bucket{" << labels << ",le=\""
+		    << bound / 1E9 << "\"} " << count << "\n";
+	}
+
+	out << name << "_bucket{" << labels << ",le=\"+Inf\"} " << snap.count
+	    << "\n";
+	out << name << "_sum{" << labels << "} " << snap.sum_ns / 1E9 << "\n";
+	out << name << "_count{" << labels << "} " << snap.count << "\n";
+}
+
+/* A label value of the Prometheus text format */
+static string label_value(const string &value)
+{
+	string out;
+
+	for (char c : value) {
+		if (c == '\\' || c == '"')
+			out += '\\';
+		if (c == '\n')
+			out += "\\n";
+		else
+			out += c;
+	}
+
+	return out;
+}
+
+string ControlServer::metrics(void)
+{
+	ostringstream out;
+	vector<Filesystem *> &filesystems = get_filesystems();
+	size_t num = filesystems.size();
+	vector<string> labels(num);
+	vector<StatsStamp> totals(num);
+	vector<FsUsage> usages(num);
+	vector<LatencySnapshot> write_lats(num), verify_lats(num);
+
+	for (size_t i = 0; i < num; i++) {
+		labels[i] = "target=\"" +
+			    label_value(filesystems[i]->get_path()) + "\"";
+		usages[i] = filesystems[i]->get_usage();
+		filesystems[i]->get_totals(totals[i], write_lats[i],
+					   verify_lats[i]);
+	}
+
+	// the lines of a metric family have to be grouped
+	auto family = [&](const char *name, const char *type,
+			  function<uint64_t(size_t)> value) {
+		out << "# TYPE " << name << " " << type << "\n";
+		for (size_t i = 0; i < num; i++)
+			out << name << "{" << labels[i] << "} " << value(i)
+			    << "\n";
+	};
+
+	family("fstest_written_bytes_total", "counter",
+	       [&](size_t i) { return totals[i].write; });
+	family("fstest_read_bytes_total", "counter",
+	       [&](size_t i) { return totals[i].read; });
+	family("fstest_written_files_total", "counter",
+	       [&](size_t i) { return totals[i].num_written_files; });
+	family("fstest_verified_files_total", "counter",
+	       [&](size_t i) { return totals[i].num_read_files; });
+	family("fstest_cache_sampled_pages_total", "counter",
+	       [&](size_t i) { return totals[i].cache_pages; });
+	family("fstest_cache_resident_pages_total", "counter",
+	       [&](size_t i) { return totals[i].cache_resident; });
+	family("fstest_cache_hit_pages_total", "counter",
+	       [&](size_t i) { return totals[i].cache_cached; });
+	family("fstest_files", "gauge",
+	       [&](size_t i) { return usages[i].num_files; });
+	family("fstest_unverified_files", "gauge",
+	       [&](size_t i) { return usages[i].num_unverified; });
+	family("fstest_reader_lag_bytes", "gauge",
+	       [&](size_t i) { return usages[i].reader_lag; });
+	family("fstest_fs_size_bytes", "gauge",
+	       [&](size_t i) { return usages[i].size; });
+	family("fstest_fs_used_bytes", "gauge",
+	       [&](size_t i) { return usages[i].used; });
+	family("fstest_fs_goal_bytes", "gauge",
+	       [&](size_t i) { return usages[i].goal; });
+	family("fstest_error", "gauge",
+	       [&](size_t i) { return usages[i].error; });
+
+	StallStats stalls = get_watchdog()->get_stats();
+	out << "# TYPE fstest_stalls_total counter\n"
+	    << "fstest_stalls_total " << stalls.count << "\n"
+	    << "# TYPE fstest_stall_seconds_total counter\n"
+	    << "fstest_stall_seconds_total " << stalls.total_ns / 1E9 << "\n"
+	    << "# TYPE fstest_stall_max_seconds gauge\n"
+	    << "fstest_stall_max_seconds " << stalls.max_ns / 1E9 << "\n"
+	    << "# TYPE fstest_stalled_operations gauge\n"
+	    << "fstest_stalled_operations " << stalls.current << "\n";
+
+	CpuTotals cpu[CPU_NUM_PHASES];
+	for (int phase = 0; phase < CPU_NUM_PHASES; phase++)
+		cpu[phase] = cpu_stats_get(phase);
+
+	out << "# TYPE fstest_cpu_seconds_total counter\n";
+	for (int phase = 0; phase < CPU_NUM_PHASES; phase++)
+		out << "fstest_cpu_seconds_total{phase=\""
+		    << cpu_phase_name(phase) << "\",mode=\"user\"} "
+		    << cpu[phase].user_ns / 1E9 << "\n"
+		    << "fstest_cpu_seconds_total{phase=\""
+		    << cpu_phase_name(phase) << "\",mode=\"system\"} "
+		    << cpu[phase].sys_ns / 1E9 << "\n";
+	out << "# TYPE fstest_cpu_bytes_total counter\n";
+	for (int phase = 0; phase < CPU_NUM_PHASES; phase++)
+		out << "fstest_cpu_bytes_total{phase=\""
+		    << cpu_phase_name(phase) << "\"} " << cpu[phase].bytes
+		    << "\n";
+	out << "# TYPE fstest_cpu_context_switches_total counter\n";
+	for (int phase = 0; phase < CPU_NUM_PHASES; phase++)
+		out << "fstest_cpu_context_switches_total{phase=\""
+		    << cpu_phase_name(phase) << "\"} "
+		    << cpu[phase].ctx_switches << "\n";
+	out << "# TYPE fstest_cpu_perf_events_total counter\n";
+	for (int phase = 0; phase < CPU_NUM_PHASES; phase++) {
+		for (int i = 0; i < CPU_NUM_COUNTERS; i++) {
+			if (!cpu[phase].has_counter[i])
+				continue;
+			out << "fstest_cpu_perf_events_total{phase=\""
+			    << cpu_phase_name(phase) << "\",event=\""
+			    << cpu_counter_name(i) << "\"} "
+			    << cpu[phase].counters[i] << "\n";
+		}
+	}
+
+	out << "# TYPE fstest_write_latency_seconds histogram\n";
+	for (size_t i = 0; i < num; i++)
+		print_histogram(out, "fstest_write_latency_seconds",
+				labels[i], write_lats[i]);
+
+	out << "# TYPE fstest_verify_latency_seconds histogram\n";
+	for (size_t i = 0; i < num; i++)
+		print_histogram(out, "fstest_verify_latency_seconds",
+				labels[i], verify_lats[i]);
+
+	RateLimits *limits = get_rate_limits();
+	out << "# TYPE fstest_rate_limit gauge\n"
+	    << "fstest_rate_limit{kind=\"write_bytes\"} "
+	    << limits->write.get_rate() << "\n"
+	    << "fstest_rate_limit{kind=\"read_bytes\"} "
+	    << limits->read.get_rate() << "\n"
+	    << "fstest_rate_limit{kind=\"files\"} "
+	    << limits->files.get_rate() << "\n";
+
+	out << "# TYPE fstest_paused gauge\n"
+	    << "fstest_paused " << paused << "\n";
+
+	// one series per thread, the value is always 1
+	out << "# TYPE fstest_thread_state gauge\n";
+	pthread_mutex_lock(&threads_mutex);
+	for (ThreadState *state : thread_states) {
+		char file[16];
+
+		snprintf(file, sizeof(file), "%x", state->file_id.load());
+		out << "fstest_thread_state{thread=\""
+		    << label_value(state->name) << "\",target=\""
+		    << label_value(state->target) << "\",state=\""
+		    << state_name(state->state) << "\",file=\"" << file
+		    << "\"} 1\n";
+	}
+	pthread_mutex_unlock(&threads_mutex);
+
+	return out.str();
+}
@@ -0,0 +1,87 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __CONTROL_H__
+#define __CONTROL_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+enum thread_state {
+	THREAD_IDLE,
+	THREAD_CREATING,
+	THREAD_WRITING,
+	THREAD_DELETING,
+	THREAD_VERIFYING,
+	THREAD_WAITING,
+	THREAD_PAUSED,
+	THREAD_META,
+};
+
+/* What a test thread is doing right now, for the control endpoint */
+struct ThreadState {
+	std::string name;
+	std::string target;
+	uint32_t tid {0};
+	std::atomic<int> state {THREAD_IDLE};
+	std::atomic<uint32_t> file_id {0}; // pattern (name) of the current file
+};
+
+void thread_register(const char *role, std::string target);
+void thread_set_state(enum thread_state state, uint32_t file_id = 0);
+void control_wait_if_paused(void);
+std::string thread_describe(uint32_t tid);
+
+/* Serves metrics in Prometheus text format and accepts commands on a Unix
+ * socket, one request per connection:
+ *	metrics (or an empty line, or "GET /metrics" for HTTP scrapers)
+ *	pause | resume | stop | dump-trace
+ *	rate write|read <MiB/s> | rate files <files/s>
+ */
+class ControlServer
+{
+private:
+	std::string path;
+	int fd {-1};
+	pthread_t thread;
+	std::atomic<bool> stopped {false};
+
+	void handle(int client);
+	std::string command(const std::string &line);
+	std::string metrics(void);
+
+public:
+	int start(std::string path);
+	void shutdown(void);
+	void serve(void);
+};
+
+ControlServer *get_control_server(void);
+
+#endif // __CONTROL_H__
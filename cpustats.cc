@@ -0,0 +1,339 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+
+#include "fstest.h"
+#include "config.h"
+#include "cpustats.h"
+
+using namespace std;
+
+struct CpuPhaseCounters {
+	atomic<uint64_t> bytes {0};
+	atomic<uint64_t> user_ns {0};
+	atomic<uint64_t> sys_ns {0};
+	atomic<uint64_t> ctx_switches {0};
+	atomic<uint64_t> counters[CPU_NUM_COUNTERS] {};
+};
+
+static CpuPhaseCounters cpu_phases[CPU_NUM_PHASES];
+
+// 0 until the first thread tried it, then 1 if it works, -1 if not
+static atomic<int> counter_state[CPU_NUM_COUNTERS];
+static atomic<bool> user_only {false}; // kernel counting not permitted
+static mutex perf_error_mutex;
+static string perf_error; // why the first counter failed
+
+/* The perf counters of a thread, opened on its first CpuOp */
+struct ThreadCounters {
+	bool opened {false};
+	int fds[CPU_NUM_COUNTERS];
+
+	~ThreadCounters(void)
+	{
+		for (int i = 0; this->opened && i < CPU_NUM_COUNTERS; i++) {
+			if (this->fds[i] >= 0)
+				close(this->fds[i]);
+		}
+	}
+};
+
+static thread_local ThreadCounters thread_counters;
+
+const char *cpu_phase_name(int phase)
+{
+	switch (phase) {
+	case CPU_WRITE:  return "write";
+	case CPU_VERIFY: return "verify";
+	case CPU_DELETE: return "delete";
+	}
+	return "?";
+}
+
+const char *cpu_counter_name(int counter)
+{
+	switch (counter) {
+	case CPU_CYCLES:           return "cycles";
+	case CPU_INSTRUCTIONS:     return "instructions";
+	case CPU_CACHE_MISSES:     return "cache-misses";
+	case CPU_CONTEXT_SWITCHES: return "context-switches";
+	}
+	return "?";
+}
+
+/* Counter of the calling thread on any CPU, -1 with errno on failure */
+static int perf_open(int counter, bool exclude_kernel)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	switch (counter) {
+	case CPU_CYCLES:
+		attr.config = PERF_COUNT_HW_CPU_CYCLES;
+		break;
+	case CPU_INSTRUCTIONS:
+		attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+		break;
+	case CPU_CACHE_MISSES:
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		break;
+	case CPU_CONTEXT_SWITCHES:
+		attr.type = PERF_TYPE_SOFTWARE;
+		attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+		break;
+	}
+	// multiplexed hardware counters are scaled up by enabled/running
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+			   PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.exclude_kernel = exclude_kernel;
+	attr.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void open_counters(ThreadCounters &tc)
+{
+	tc.opened = true;
+
+	for (int i = 0; i < CPU_NUM_COUNTERS; i++) {
+		tc.fds[i] = -1;
+		if (counter_state[i] < 0)
+			continue;
+
+		int fd = perf_open(i, user_only);
+		if (fd < 0 && (errno == EACCES || errno == EPERM) &&
+		    !user_only) {
+			// perf_event_paranoid only allows user space counting
+			fd = perf_open(i, true);
+			if (fd >= 0)
+				user_only = true;
+		}
+
+		if (fd < 0) {
+			lock_guard<mutex> guard(perf_error_mutex);
+			if (perf_error.empty())
+				perf_error = string(cpu_counter_name(i)) + ": " +
+					     strerror(errno);
+			counter_state[i] = -1;
+			continue;
+		}
+
+		tc.fds[i] = fd;
+		counter_state[i] = 1;
+	}
+}
+
+static uint64_t timeval_ns(const struct timeval &tv)
+{
+	return tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+}
+
+static void cpu_sample(CpuSample &sample, bool perf)
+{
+	struct rusage usage;
+
+	memset(&sample, 0, sizeof(sample));
+	if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+		sample.user_ns = timeval_ns(usage.ru_utime);
+		sample.sys_ns = timeval_ns(usage.ru_stime);
+		sample.ctx_switches = usage.ru_nvcsw + usage.ru_nivcsw;
+	}
+
+	if (!perf)
+		return;
+
+	ThreadCounters &tc = thread_counters;
+	if (!tc.opened)
+		open_counters(tc);
+
+	for (int i = 0; i < CPU_NUM_COUNTERS; i++) {
+		uint64_t val[3]; // value, time enabled, time running
+
+		if (tc.fds[i] < 0 || read(tc.fds[i], val, sizeof(val)) !=
+				     (ssize_t) sizeof(val))
+			continue;
+
+		sample.counters[i] = val[2] == 0 ? 0 :
+			val[1] == val[2] ? val[0] :
+			(uint64_t) ((double) val[0] * val[1] / val[2]);
+	}
+}
+
+CpuOp::CpuOp(int phase, uint64_t bytes)
+{
+	this->phase = phase;
+	this->bytes = bytes;
+	this->active = get_global_cfg()->get_cpu_stats_mode() != CPU_STATS_OFF;
+
+	if (this->active)
+		cpu_sample(this->start, get_global_cfg()->get_cpu_stats_mode() ==
+					CPU_STATS_PERF);
+}
+
+CpuOp::~CpuOp(void)
+{
+	if (!this->active)
+		return;
+
+	CpuSample end;
+	cpu_sample(end, get_global_cfg()->get_cpu_stats_mode() ==
+			CPU_STATS_PERF);
+
+	CpuPhaseCounters &counters = cpu_phases[this->phase];
+	counters.bytes += this->bytes;
+	counters.user_ns += end.user_ns - this->start.user_ns;
+	counters.sys_ns += end.sys_ns - this->start.sys_ns;
+	counters.ctx_switches += end.ctx_switches - this->start.ctx_switches;
+
+	// a scaled multiplexed counter may go back a little
+	for (int i = 0; i < CPU_NUM_COUNTERS; i++) {
+		if (end.counters[i] > this->start.counters[i])
+			counters.counters[i] += end.counters[i] -
+						this->start.counters[i];
+	}
+}
+
+CpuTotals cpu_stats_get(int phase)
+{
+	CpuPhaseCounters &counters = cpu_phases[phase];
+	CpuTotals totals;
+
+	totals.bytes = counters.bytes;
+	totals.user_ns = counters.user_ns;
+	totals.sys_ns = counters.sys_ns;
+	totals.ctx_switches = counters.ctx_switches;
+	for (int i = 0; i < CPU_NUM_COUNTERS; i++) {
+		totals.counters[i] = counters.counters[i];
+		totals.has_counter[i] = counter_state[i] > 0;
+	}
+
+	return totals;
+}
+
+/* CPU-seconds per GiB and cycles per byte, for the stats lines */
+void print_cpu_stats(ostream &out)
+{
+	if (get_global_cfg()->get_cpu_stats_mode() == CPU_STATS_OFF)
+		return;
+
+	out << " cpu [s/GiB]";
+	for (int phase = CPU_WRITE; phase <= CPU_VERIFY; phase++) {
+		CpuTotals totals = cpu_stats_get(phase);
+		double gib = (double) totals.bytes / GIGA;
+
+		out << " " << cpu_phase_name(phase) << ": "
+		    << (gib > 0 ? (totals.user_ns + totals.sys_ns) / 1E9 / gib : 0);
+	}
+
+	if (counter_state[CPU_CYCLES] <= 0)
+		return;
+
+	out << " cycles/B";
+	for (int phase = CPU_WRITE; phase <= CPU_VERIFY; phase++) {
+		CpuTotals totals = cpu_stats_get(phase);
+
+		out << " " << cpu_phase_name(phase) << ": "
+		    << (totals.bytes ? (double) totals.counters[CPU_CYCLES] /
+				       totals.bytes : 0);
+	}
+}
+
+/* Summary table at the end of the test */
+void cpu_stats_report(ostream &out)
+{
+	enum cpu_stats_mode mode = get_global_cfg()->get_cpu_stats_mode();
+
+	if (mode == CPU_STATS_OFF)
+		return;
+
+	ios_base::fmtflags flags = out.flags();
+	streamsize precision = out.precision();
+
+	out << "CPU usage       GiB  user [s]   sys [s]  CPU-s/GiB"
+	    << "  ctx sw  cycles/B   instr/B  cache miss/MiB" << endl;
+	out << fixed;
+
+	for (int phase = 0; phase < CPU_NUM_PHASES; phase++) {
+		CpuTotals t = cpu_stats_get(phase);
+		double gib = (double) t.bytes / GIGA;
+		double bytes = max(t.bytes, (uint64_t) 1);
+
+		out << left << setw(8) << cpu_phase_name(phase) << right
+		    << setprecision(2) << setw(10) << gib
+		    << setw(10) << t.user_ns / 1E9
+		    << setw(10) << t.sys_ns / 1E9
+		    << setprecision(3) << setw(11)
+		    << (gib > 0 ? (t.user_ns + t.sys_ns) / 1E9 / gib : 0)
+		    << setprecision(0) << setw(8) << t.ctx_switches;
+
+		out << setprecision(3);
+		if (t.has_counter[CPU_CYCLES])
+			out << setw(10) << t.counters[CPU_CYCLES] / bytes;
+		else
+			out << setw(10) << "-";
+		if (t.has_counter[CPU_INSTRUCTIONS])
+			out << setw(10) << t.counters[CPU_INSTRUCTIONS] / bytes;
+		else
+			out << setw(10) << "-";
+		if (t.has_counter[CPU_CACHE_MISSES])
+			out << setw(16)
+			    << t.counters[CPU_CACHE_MISSES] / bytes * MEGA;
+		else
+			out << setw(16) << "-";
+		out << endl;
+	}
+
+	out.flags(flags);
+	out.precision(precision);
+
+	if (mode != CPU_STATS_PERF)
+		return;
+
+	lock_guard<mutex> guard(perf_error_mutex);
+	out << "perf counters:";
+	for (int i = 0; i < CPU_NUM_COUNTERS; i++) {
+		if (counter_state[i] > 0)
+			out << " " << cpu_counter_name(i);
+	}
+	if (user_only)
+		out << " (user space only)";
+	if (!perf_error.empty())
+		out << ", unavailable: " << perf_error;
+	out << endl;
+}
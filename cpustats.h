@@ -0,0 +1,98 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __CPUSTATS_H__
+#define __CPUSTATS_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <ostream>
+#include <string>
+
+// work the CPU time is accounted to
+enum cpu_phase {
+	CPU_WRITE,  // pattern fill, write and sync of a file
+	CPU_VERIFY, // reading and comparing it
+	CPU_DELETE, // unlinking it, while making space and in the cleanup
+	CPU_NUM_PHASES
+};
+
+// perf_event_open() counters of the thread
+enum cpu_counter {
+	CPU_CYCLES,
+	CPU_INSTRUCTIONS,
+	CPU_CACHE_MISSES,
+	CPU_CONTEXT_SWITCHES,
+	CPU_NUM_COUNTERS
+};
+
+enum cpu_stats_mode {
+	CPU_STATS_OFF,
+	CPU_STATS_RUSAGE, // getrusage(RUSAGE_THREAD) only
+	CPU_STATS_PERF,   // also perf counters, where permitted
+};
+
+/* Thread CPU usage at a point in time */
+struct CpuSample {
+	uint64_t user_ns, sys_ns;
+	uint64_t ctx_switches; // voluntary and involuntary, of getrusage()
+	uint64_t counters[CPU_NUM_COUNTERS];
+};
+
+/* Summed up over all threads, for one phase */
+struct CpuTotals {
+	uint64_t bytes;
+	uint64_t user_ns, sys_ns;
+	uint64_t ctx_switches;
+	uint64_t counters[CPU_NUM_COUNTERS];
+	bool has_counter[CPU_NUM_COUNTERS];
+};
+
+/* Accounts the CPU usage of the calling thread from construction to
+ * destruction to a phase, like TraceOp. bytes may be set on the way.
+ */
+class CpuOp
+{
+private:
+	int phase;
+	bool active;
+	CpuSample start;
+
+public:
+	uint64_t bytes;
+
+	CpuOp(int phase, uint64_t bytes = 0);
+	~CpuOp(void);
+};
+
+CpuTotals cpu_stats_get(int phase);
+const char *cpu_phase_name(int phase);
+const char *cpu_counter_name(int counter);
+void print_cpu_stats(std::ostream &out);
+void cpu_stats_report(std::ostream &out);
+
+#endif // __CPUSTATS_H__
@@ -44,6 +44,8 @@
 
 #include "fstest.h"
 #include "dir.h"
+#include "trace.h"
+#include "iobackend.h"
 
 using namespace std;
 
@@ -63,7 +65,13 @@ Dir::Dir(Dir *parent, int level) : parent(parent)
 	parent->sub = this;
 	string dirpath = path();
 	cout << "Creating dir " << dirpath << endl;
-	if (mkdir(dirpath.c_str(), 0700) != 0) {
+	int rc;
+	{
+		TraceOp op(TRACE_MKDIR, 0);
+		rc = get_io_backend()->mkdir(dirpath.c_str(), 0700);
+		op.result = rc ? -errno : 0;
+	}
+	if (rc != 0) {
 		cout << "Creating dir " << path();
 		perror(": ");
 		EXIT(1);
@@ -86,7 +94,7 @@ Dir::Dir(string _path, Filesystem * fs): fs(fs)
 	num_files = 1;
 	root_path = _path;
 
-	if (mkdir(path().c_str(), 0700) != 0) {
+	if (get_io_backend()->mkdir(path().c_str(), 0700) != 0) {
 		cout << "Creating working dir " << path();
 		perror(": ");
 		EXIT(1);
@@ -103,7 +111,9 @@ Dir::~Dir(void)
 	if (files != NULL) {
 		files->delete_all();
 	}
-	int res = rmdir(path().c_str());
+	TraceOp op(TRACE_RMDIR, 0);
+	int res = get_io_backend()->rmdir(path().c_str());
+	op.result = res ? -errno : 0;
 	if (res != 0 && errno != ENOENT) {
 		perror(path().c_str());
 		EXIT(1);
@@ -125,6 +135,61 @@ void Dir::remove_file(File *file)
 	file->unlink();
 }
 
+/* Delete all files of the directory, unlinked relative to the directory
+ * file descriptor. Each directory is handled by one cleanup thread.
+ * Returns the number of bytes deleted.
+ */
+uint64_t Dir::delete_files(void)
+{
+	int dirfd = get_io_backend()->open(path().c_str(),
+					   O_RDONLY | O_DIRECTORY);
+	if (dirfd == -1) {
+		cerr << "Opening dir " << path() << " failed: "
+		     << strerror(errno) << endl;
+		EXIT(1);
+	}
+
+	uint64_t size = 0;
+	File *file = this->files;
+	while (file != NULL) {
+		File *next = file->get_next();
+
+		// ~File refuses to delete it as well
+		if (!file->has_errors() ||
+		    get_io_backend()->injects_faults()) {
+			size += file->get_fsize();
+			file->unlink_file(dirfd);
+			delete file;
+		}
+
+		file = next;
+	}
+
+	get_io_backend()->close(dirfd);
+	return size;
+}
+
+/* The deepest level the tree of a test dir grows to with max_files files.
+ * A new level is only added when all directories are full, a tree of level
+ * n is n directories deep.
+ */
+int Dir::max_level(size_t max_files)
+{
+	vector<size_t> tree(1, 0); // files in the tree of each level
+	size_t capacity = 0;
+	int level = 0;
+
+	while (capacity < max_files && level < 99) {
+		level++;
+		tree.push_back((size_t) level * level);
+		for (int sub = 1; sub < level; sub++)
+			tree[level] += tree[sub];
+		capacity += tree[level];
+	}
+
+	return level;
+}
+
 string Dir::path(void) const
 {
 	if (parent == NULL) {
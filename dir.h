@@ -56,9 +56,11 @@ public:
 	~Dir(void);
 	
 	string path(void) const;
+	static int max_level(size_t max_files);
 
 	void add_file(File *file);
 	void remove_file(File *file);
+	uint64_t delete_files(void);
 
 	uint16_t get_num_files(void) const;
 
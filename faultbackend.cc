@@ -0,0 +1,495 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "faultbackend.h"
+
+#define FAULT_BUF_ALIGN 4096 // the copy of a write might be used for O_DIRECT
+
+using namespace std;
+
+// a write with a flipped bit, per thread
+static thread_local char *flip_buf;
+static thread_local size_t flip_buf_size;
+
+FaultBackend::FaultBackend(IoBackend *base, const double *rates)
+{
+	this->base = base;
+	pthread_mutex_init(&this->mutex, NULL);
+
+	for (int type = 0; type < FAULT_NUM_TYPES; type++) {
+		this->rates[type] = rates[type];
+		this->injected[type] = 0;
+		this->detected[type] = 0;
+		this->missed[type] = 0;
+	}
+	this->false_alarms = 0;
+	this->detect_max_ns = 0;
+}
+
+const char *FaultBackend::type_name(int type)
+{
+	switch (type) {
+	case FAULT_BITFLIP:   return "bitflip";
+	case FAULT_DROP:      return "drop";
+	case FAULT_MISDIRECT: return "misdirect";
+	case FAULT_STALE:     return "stale";
+	}
+	return "?";
+}
+
+/**
+ * Parse "type=rate,..." into rates, types not given get 0
+ * Returns -EINVAL on an unknown type or a rate outside of [0, 1]
+ */
+int FaultBackend::parse_spec(string spec, double *rates)
+{
+	for (int type = 0; type < FAULT_NUM_TYPES; type++)
+		rates[type] = 0;
+
+	istringstream in(spec);
+	string item;
+	while (getline(in, item, ',')) {
+		size_t eq = item.find('=');
+		if (eq == string::npos)
+			return -EINVAL;
+
+		string name = item.substr(0, eq);
+		int type;
+		for (type = 0; type < FAULT_NUM_TYPES; type++) {
+			if (name == type_name(type))
+				break;
+		}
+		if (type == FAULT_NUM_TYPES)
+			return -EINVAL;
+
+		char *end;
+		rates[type] = strtod(item.c_str() + eq + 1, &end);
+		if (*end != '\0' || rates[type] < 0 || rates[type] > 1)
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+bool FaultBackend::roll(enum fault_type type)
+{
+	return this->rates[type] > 0 &&
+	       random() < this->rates[type] * ((double) RAND_MAX + 1);
+}
+
+void FaultBackend::inject(int fd, enum fault_type type, uint64_t off,
+			  uint64_t len)
+{
+	Fault fault = { type, off, len, now_ns(), "", false };
+
+	pthread_mutex_lock(&this->mutex);
+	auto it = this->paths.find(fd);
+	if (it != this->paths.end()) {
+		this->pending[it->second].push_back(fault);
+		this->injected[type]++;
+	}
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/**
+ * Write the data into another open file instead, at an offset it has
+ * already written, and leave a hole here. Both files are damaged, the
+ * fault counts once, when either of them fails verification.
+ * Returns false if there is no other file to misdirect to.
+ */
+bool FaultBackend::misdirect(int fd, const void *buf, size_t len)
+{
+	vector<string> others;
+	string source;
+
+	pthread_mutex_lock(&this->mutex);
+	auto it = this->paths.find(fd);
+	if (it != this->paths.end())
+		source = it->second;
+	for (auto &open : this->paths) {
+		if (open.second != source)
+			others.push_back(open.second);
+	}
+	pthread_mutex_unlock(&this->mutex);
+
+	if (source.empty() || others.empty())
+		return false;
+
+	// an own fd, the file offset of the owner must not move
+	string dest = others[random() % others.size()];
+	int dest_fd = this->base->open(dest.c_str(), O_WRONLY);
+	if (dest_fd < 0)
+		return false;
+
+	struct stat st;
+	if (this->base->fstat(dest_fd, &st) || !S_ISREG(st.st_mode) ||
+	    (uint64_t) st.st_size < len) {
+		this->base->close(dest_fd);
+		return false;
+	}
+
+	off_t dest_off = random() % (st.st_size - len + 1);
+	ssize_t rc = -1;
+	if (this->base->lseek(dest_fd, dest_off, SEEK_SET) == dest_off)
+		rc = this->base->write(dest_fd, buf, len);
+	this->base->close(dest_fd);
+	if (rc != (ssize_t) len)
+		return false;
+
+	off_t off = this->base->lseek(fd, len, SEEK_CUR);
+	if (off < 0)
+		return false;
+
+	uint64_t now = now_ns();
+	Fault hole = { FAULT_MISDIRECT, (uint64_t) off - len, len, now, dest,
+		       false };
+	Fault landed = { FAULT_MISDIRECT, (uint64_t) dest_off, len, now,
+			 source, false };
+
+	pthread_mutex_lock(&this->mutex);
+	this->pending[source].push_back(hole);
+	this->pending[dest].push_back(landed);
+	this->injected[FAULT_MISDIRECT]++;
+	pthread_mutex_unlock(&this->mutex);
+
+	return true;
+}
+
+/* The other half of a misdirect was detected, the mutex has to be locked */
+void FaultBackend::count_peer(const string &path, const Fault &fault)
+{
+	auto it = this->pending.find(fault.peer);
+	if (it == this->pending.end())
+		return;
+
+	for (Fault &f : it->second) {
+		if (f.peer == path && f.inject_ns == fault.inject_ns)
+			f.counted = true;
+	}
+}
+
+/* The file is gone, its undetected faults were missed, unless the other
+ * file of a misdirect can still find it.
+ * The mutex has to be locked.
+ */
+void FaultBackend::forget(const string &path)
+{
+	auto it = this->pending.find(path);
+	if (it == this->pending.end())
+		return;
+
+	vector<Fault> faults;
+	faults.swap(it->second);
+	this->pending.erase(it);
+
+	for (Fault &fault : faults) {
+		bool peer_pending = false;
+
+		if (fault.counted)
+			continue;
+
+		if (!fault.peer.empty()) {
+			auto peer = this->pending.find(fault.peer);
+			if (peer != this->pending.end()) {
+				for (Fault &f : peer->second) {
+					if (f.peer == path &&
+					    f.inject_ns == fault.inject_ns) {
+						f.peer.clear();
+						peer_pending = true;
+					}
+				}
+			}
+		}
+
+		if (!peer_pending)
+			this->missed[fault.type]++;
+	}
+}
+
+/* Result of a verification of the file at path */
+void FaultBackend::verified(const string &path, bool corrupt)
+{
+	string name = io_normalize_path(path.c_str());
+	uint64_t now = now_ns();
+
+	pthread_mutex_lock(&this->mutex);
+	auto it = this->pending.find(name);
+	if (it == this->pending.end()) {
+		if (corrupt)
+			this->false_alarms++;
+		pthread_mutex_unlock(&this->mutex);
+		return;
+	}
+
+	vector<Fault> &faults = it->second;
+	if (corrupt) {
+		for (Fault &fault : faults) {
+			uint64_t ns = now - fault.inject_ns;
+
+			if (fault.counted)
+				continue;
+
+			this->detected[fault.type]++;
+			this->detect_lat.record(ns);
+			this->detect_max_ns = max(this->detect_max_ns, ns);
+			if (!fault.peer.empty())
+				this->count_peer(name, fault);
+		}
+		faults.clear();
+	} else {
+		// a stale read is gone with the verification that did it
+		auto stale = [](const Fault &f) { return f.type == FAULT_STALE; };
+
+		for (Fault &fault : faults) {
+			if (stale(fault))
+				this->missed[fault.type]++;
+		}
+		faults.erase(remove_if(faults.begin(), faults.end(), stale),
+			     faults.end());
+	}
+
+	if (it->second.empty())
+		this->pending.erase(it);
+	pthread_mutex_unlock(&this->mutex);
+}
+
+void FaultBackend::report(ostream &out)
+{
+	uint64_t injected = 0, detected = 0, missed = 0, undetected = 0;
+
+	pthread_mutex_lock(&this->mutex);
+	for (int type = 0; type < FAULT_NUM_TYPES; type++) {
+		injected += this->injected[type];
+		detected += this->detected[type];
+		missed += this->missed[type];
+	}
+	for (auto &file : this->pending) {
+		for (Fault &fault : file.second)
+			undetected += !fault.counted;
+	}
+
+	out << "Faults injected: " << injected << " (";
+	for (int type = 0; type < FAULT_NUM_TYPES; type++) {
+		out << (type ? ", " : "") << type_name(type) << " "
+		    << this->detected[type] << "/" << this->injected[type];
+	}
+	out << " detected)" << endl;
+
+	LatencySnapshot lat = this->detect_lat.snapshot();
+	out << "Faults detected: " << detected << " missed: " << missed
+	    << " undetected at exit: " << undetected
+	    << " false alarms: " << this->false_alarms;
+	if (injected > 0)
+		out << " missed [%]: "
+		    << 100.0 * (missed + undetected) / injected;
+	out << endl;
+
+	// histogram buckets are coarser than the exact maximum
+	uint64_t max_ns = this->detect_max_ns;
+	if (detected > 0)
+		out << "Time to detect [s] p50: "
+		    << min(lat.percentile(50), max_ns) / 1E9
+		    << " p90: " << min(lat.percentile(90), max_ns) / 1E9
+		    << " p99: " << min(lat.percentile(99), max_ns) / 1E9
+		    << " max: " << max_ns / 1E9 << endl;
+	pthread_mutex_unlock(&this->mutex);
+}
+
+int FaultBackend::open(const char *path, int flags, mode_t mode)
+{
+	int fd = this->base->open(path, flags, mode);
+
+	if (fd >= 0) {
+		pthread_mutex_lock(&this->mutex);
+		this->paths[fd] = io_normalize_path(path);
+		pthread_mutex_unlock(&this->mutex);
+	}
+
+	return fd;
+}
+
+int FaultBackend::close(int fd)
+{
+	pthread_mutex_lock(&this->mutex);
+	this->paths.erase(fd);
+	pthread_mutex_unlock(&this->mutex);
+
+	return this->base->close(fd);
+}
+
+ssize_t FaultBackend::write(int fd, const void *buf, size_t len)
+{
+	if (len == 0)
+		return this->base->write(fd, buf, len);
+
+	if (this->roll(FAULT_BITFLIP)) {
+		if (flip_buf_size < len) {
+			void *new_buf = NULL;
+
+			if (posix_memalign(&new_buf, FAULT_BUF_ALIGN, len))
+				return this->base->write(fd, buf, len);
+
+			free(flip_buf);
+			flip_buf = (char *) new_buf;
+			flip_buf_size = len;
+		}
+
+		uint64_t bit = random() % (len * 8);
+		memcpy(flip_buf, buf, len);
+		flip_buf[bit / 8] ^= 1 << (bit % 8);
+
+		off_t off = this->base->lseek(fd, 0, SEEK_CUR);
+		ssize_t rc = this->base->write(fd, flip_buf, len);
+		if (rc > (ssize_t) (bit / 8))
+			this->inject(fd, FAULT_BITFLIP, off + bit / 8, 1);
+
+		return rc;
+	}
+
+	if (this->roll(FAULT_DROP)) {
+		// leaves a hole
+		off_t off = this->base->lseek(fd, len, SEEK_CUR);
+		if (off < 0)
+			return -1;
+
+		this->inject(fd, FAULT_DROP, off - len, len);
+		return len;
+	}
+
+	// within a file every block has the same pattern, another file's
+	// block differs
+	if (this->roll(FAULT_MISDIRECT) && this->misdirect(fd, buf, len))
+		return len;
+
+	return this->base->write(fd, buf, len);
+}
+
+ssize_t FaultBackend::pread(int fd, void *buf, size_t len, off_t off)
+{
+	ssize_t rc = this->base->pread(fd, buf, len, off);
+	if (rc <= 0 || !this->roll(FAULT_STALE))
+		return rc;
+
+	// the files are written once, before that the blocks were a hole
+	memset(buf, 0, rc);
+	this->inject(fd, FAULT_STALE, off, rc);
+	return rc;
+}
+
+off_t FaultBackend::lseek(int fd, off_t off, int whence)
+{
+	return this->base->lseek(fd, off, whence);
+}
+
+int FaultBackend::fsync(int fd)
+{
+	return this->base->fsync(fd);
+}
+
+int FaultBackend::fdatasync(int fd)
+{
+	return this->base->fdatasync(fd);
+}
+
+int FaultBackend::fadvise(int fd, off_t off, off_t len, int advice)
+{
+	return this->base->fadvise(fd, off, len, advice);
+}
+
+int FaultBackend::get_flags(int fd)
+{
+	return this->base->get_flags(fd);
+}
+
+int FaultBackend::set_flags(int fd, int flags)
+{
+	return this->base->set_flags(fd, flags);
+}
+
+int FaultBackend::fstat(int fd, struct stat *st)
+{
+	return this->base->fstat(fd, st);
+}
+
+int FaultBackend::fiemap(int fd, struct fiemap *map)
+{
+	return this->base->fiemap(fd, map);
+}
+
+int FaultBackend::fsetxattr(int fd, const char *name, const void *value,
+			    size_t size)
+{
+	return this->base->fsetxattr(fd, name, value, size);
+}
+
+ssize_t FaultBackend::fgetxattr(int fd, const char *name, void *value,
+				size_t size)
+{
+	return this->base->fgetxattr(fd, name, value, size);
+}
+
+int FaultBackend::unlinkat(int dirfd, const char *path)
+{
+	int rc = this->base->unlinkat(dirfd, path);
+	if (rc)
+		return rc;
+
+	pthread_mutex_lock(&this->mutex);
+	string name = path;
+	if (dirfd != AT_FDCWD) {
+		auto it = this->paths.find(dirfd);
+		if (it != this->paths.end())
+			name = it->second + "/" + path;
+	}
+	this->forget(io_normalize_path(name.c_str()));
+	pthread_mutex_unlock(&this->mutex);
+
+	return 0;
+}
+
+int FaultBackend::mkdir(const char *path, mode_t mode)
+{
+	return this->base->mkdir(path, mode);
+}
+
+int FaultBackend::rmdir(const char *path)
+{
+	return this->base->rmdir(path);
+}
+
+int FaultBackend::statvfs(const char *path, struct statvfs *buf)
+{
+	return this->base->statvfs(path, buf);
+}
@@ -0,0 +1,117 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __FAULTBACKEND_H__
+#define __FAULTBACKEND_H__
+
+#include <pthread.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "iobackend.h"
+#include "histogram.h"
+
+enum fault_type {
+	FAULT_BITFLIP,   // one bit of a write flipped
+	FAULT_DROP,      // a write acknowledged, but not done
+	FAULT_MISDIRECT, // a write landed in another file, leaving a hole
+	FAULT_STALE,     // a read returned the block as before it was written
+	FAULT_NUM_TYPES
+};
+
+/* An injected fault, until it is detected or the file is gone */
+struct Fault {
+	enum fault_type type;
+	uint64_t offset, len;
+	uint64_t inject_ns;
+	std::string peer; // the other damaged file of a misdirect
+	bool counted;     // detected already through the peer
+};
+
+/* Wraps another backend and injects faults into its writes and reads at
+ * the given rates (per call). Each fault is kept with its file until a
+ * verification of the file fails (detected), the file is deleted or, for a
+ * stale read, its verification passes anyway (missed).
+ */
+class FaultBackend : public IoBackend
+{
+private:
+	IoBackend *base;
+	double rates[FAULT_NUM_TYPES];
+
+	pthread_mutex_t mutex;
+	std::unordered_map<int, std::string> paths; // of the open fds
+	std::unordered_map<std::string, std::vector<Fault>> pending;
+	uint64_t injected[FAULT_NUM_TYPES];
+	uint64_t detected[FAULT_NUM_TYPES];
+	uint64_t missed[FAULT_NUM_TYPES];
+	uint64_t false_alarms; // failed verifications without a fault
+	LatencyHistogram detect_lat; // time to detect
+	uint64_t detect_max_ns;
+
+	bool roll(enum fault_type type);
+	void inject(int fd, enum fault_type type, uint64_t off, uint64_t len);
+	bool misdirect(int fd, const void *buf, size_t len);
+	void count_peer(const std::string &path, const Fault &fault);
+	void forget(const std::string &path);
+
+public:
+	FaultBackend(IoBackend *base, const double *rates);
+
+	static const char *type_name(int type);
+	static int parse_spec(std::string spec, double *rates);
+
+	const char *name(void) { return this->base->name(); }
+	bool has_page_cache(void) { return this->base->has_page_cache(); }
+
+	int open(const char *path, int flags, mode_t mode = 0);
+	int close(int fd);
+	ssize_t write(int fd, const void *buf, size_t len);
+	ssize_t pread(int fd, void *buf, size_t len, off_t off);
+	off_t lseek(int fd, off_t off, int whence);
+	int fsync(int fd);
+	int fdatasync(int fd);
+	int fadvise(int fd, off_t off, off_t len, int advice);
+	int get_flags(int fd);
+	int set_flags(int fd, int flags);
+	int fstat(int fd, struct stat *st);
+	int fiemap(int fd, struct fiemap *map);
+	int fsetxattr(int fd, const char *name, const void *value,
+		      size_t size);
+	ssize_t fgetxattr(int fd, const char *name, void *value, size_t size);
+	int unlinkat(int dirfd, const char *path);
+	int mkdir(const char *path, mode_t mode);
+	int rmdir(const char *path);
+	int statvfs(const char *path, struct statvfs *buf);
+
+	bool injects_faults(void) { return true; }
+	void verified(const std::string &path, bool corrupt);
+	void report(std::ostream &out);
+};
+
+#endif // __FAULTBACKEND_H__
@@ -27,17 +27,40 @@
  ************************************************************************/
 
 #include <sys/random.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
 
 #include "fstest.h"
 #include "file.h"
 #include "config.h"
-
-const uint64_t BUF_SIZE = 1024*1024; // Must be power of 2
+#include "ratelimit.h"
+#include "manifest.h"
+#include "trace.h"
+#include "crc32c.h"
+#include "cache.h"
+#include "iobackend.h"
+#include "cpustats.h"
+#include "placement.h"
 
 #define RANDOM_SIZE 4096
+#define DIRECT_IO_ALIGN 4096 // buffers of O_DIRECT reads and writes
 
 using namespace std;
 
+/* I/O buffer, aligned so that it can be used with O_DIRECT */
+static char *alloc_buf(void)
+{
+	void *buf = NULL;
+
+	if (posix_memalign(&buf, DIRECT_IO_ALIGN, BUF_SIZE)) {
+		cerr << "Allocating the I/O buffer failed" << endl;
+		EXIT(1);
+	}
+	placement_bind_buf(buf, BUF_SIZE);
+
+	return (char *) buf;
+}
+
 File::File(Dir *dir)
 {
 	this->directory = dir;
@@ -47,6 +70,16 @@ File::File(Dir *dir)
 	this->sync_failed = false;
 	this->has_error   = false;
 	this->in_delete    = false;
+	this->verified     = false;
+	this->last_verify  = 0;
+	this->seq          = 0;
+	this->write_pos    = 0;
+	this->phys_key     = 0;
+	this->manifest_id  = 0;
+	this->unlinked     = false;
+	this->pattern_known = true;
+	this->has_csum     = false;
+	this->csum         = 0;
 
 	size_t size_min = get_global_cfg()->get_min_size_bits();
 	size_t size_max = get_global_cfg()->get_max_size_bits();
@@ -57,7 +90,7 @@ File::File(Dir *dir)
 	this->fsize += random_size; // do not let most of the the files have size of 2^n
 
 
-	pthread_mutex_init(&this->mutex, NULL);
+	pthread_rwlock_init(&this->rwlock, NULL);
 	
 	// No need to lock the file here, as it is not globally known yet 
 	// Initialization is just suffcient
@@ -77,7 +110,12 @@ retry:
 	this->id.value = random();
 	snprintf(fname, 9, "%x", id.value);
 
-	fd = open((path + this->fname).c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+	{
+		TraceOp op(TRACE_CREATE, this->id.value);
+		fd = get_io_backend()->open((path + this->fname).c_str(),
+					    O_WRONLY | O_CREAT | O_EXCL, 0600);
+		op.result = fd == -1 ? -errno : 0;
+	}
 	if (fd == -1) {
 		if (errno == EEXIST)
 			goto retry; // Try again with new name
@@ -86,7 +124,7 @@ retry:
 		EXIT(1);
 	}
 
-	int rc = close(fd);
+	int rc = get_io_backend()->close(fd);
 	if (rc)
 		cerr << "Close " << path << fname << " failed: " << strerror(errno) << endl;
 
@@ -94,6 +132,51 @@ retry:
 
 }
 
+/* An already existing file, e.g. left over by an earlier run, that is only
+ * verified. It does not belong to a directory and is never deleted.
+ */
+File::File(string path, uint32_t pattern, uint64_t size)
+{
+	this->directory = NULL;
+	this->existing_path = path;
+	this->prev = NULL;
+	this->next = NULL;
+	this->num_checks = 0;
+	this->sync_failed = false;
+	this->has_error   = false;
+	this->in_delete    = false;
+	this->verified     = false;
+	this->last_verify  = 0;
+	this->seq          = 0;
+	this->write_pos    = 0;
+	this->phys_key     = 0;
+	this->manifest_id  = 0;
+	this->unlinked     = false;
+	this->pattern_known = true;
+	this->has_csum     = false;
+	this->csum         = 0;
+	this->fsize = size;
+	this->id.value = pattern;
+	snprintf(fname, 9, "%x", id.value);
+	this->create_time = "unknown";
+
+	pthread_rwlock_init(&this->rwlock, NULL);
+
+	this->time_buf = (char *) malloc(30);
+	if (this->time_buf == NULL) {
+		cerr << "Out of memory while allocating a file" << endl;
+		EXIT(1);
+	}
+}
+
+string File::path(void) const
+{
+	if (this->directory == NULL)
+		return this->existing_path;
+
+	return this->directory->path() + this->fname;
+}
+
 /**
  * Randomly set O_DIRECT if enabled
  */
@@ -116,14 +199,55 @@ bool File::set_direct_io_flag(int &open_flags)
 	return is_o_direct;
 }
 
-/* Write a file here 
- * file needs to be locked already 
+/**
+ * Remember where the file is located, so that the read thread can verify
+ * files in physical order. Falls back to the inode number if the
+ * filesystem does not support FIEMAP.
  */
-void File::fwrite(void)
+void File::set_phys_key(int fd)
+{
+	static bool fiemap_warned = false;
+	enum read_order order = get_global_cfg()->get_read_order();
+
+	if (order == READ_ORDER_AGE)
+		return;
+
+	if (order == READ_ORDER_FIEMAP) {
+		union {
+			struct fiemap map;
+			char buf[sizeof(struct fiemap) +
+				 sizeof(struct fiemap_extent)];
+		} req;
+
+		memset(&req, 0, sizeof(req));
+		req.map.fm_length = FIEMAP_MAX_OFFSET;
+		req.map.fm_flags = FIEMAP_FLAG_SYNC;
+		req.map.fm_extent_count = 1;
+
+		int rc = get_io_backend()->fiemap(fd, &req.map);
+		if (rc == 0 && req.map.fm_mapped_extents > 0) {
+			this->phys_key = req.map.fm_extents[0].fe_physical;
+			return;
+		}
+
+		if (rc && !fiemap_warned) {
+			fiemap_warned = true;
+			cerr << "FIEMAP failed (" << strerror(errno)
+			     << "), using inode order" << endl;
+		}
+	}
+
+	struct stat st;
+	if (get_io_backend()->fstat(fd, &st) == 0)
+		this->phys_key = st.st_ino;
+}
+
+/* Open the file and fill the pattern buffer for write_chunk()
+ * file needs to be locked already
+ */
+void File::write_begin(WriteStream &ws)
 {
 	int fd;
-	int rc;
-	bool immediate_check = get_global_cfg()->get_immediate_check();
 	string path = directory->path();
 	time_t rawtime;
 	time(&rawtime);
@@ -132,13 +256,25 @@ void File::fwrite(void)
 	bool is_o_direct = set_direct_io_flag(open_flags);
 
 
-	fd = open((path + this->fname).c_str(), open_flags);
+	{
+		TraceOp op(TRACE_OPEN, this->id.value);
+		fd = get_io_backend()->open((path + this->fname).c_str(),
+					    open_flags);
+		op.result = fd == -1 ? -errno : 0;
+	}
 	if (fd == -1) {
 		std::cerr << "Failed to open " << path << fname << "o-direct=" << is_o_direct;
 		perror(" : ");
 		EXIT(1);
 	}
 
+	Manifest *manifest = get_manifest();
+	if (manifest->is_open()) {
+		this->manifest_id = manifest->new_id();
+		manifest->append(MANIFEST_CREATED, this->manifest_id, this,
+				 false);
+	}
+
 	this->create_time = string(ctime_r(&rawtime, this->time_buf));
 
 	string &tmp =  this->create_time;
@@ -146,11 +282,7 @@ void File::fwrite(void)
 		tmp.erase(tmp.length() - 1); // remove "\n"
 
 	// Create buffer and fill with id
-	char *buf = (char *)malloc(BUF_SIZE);
-	if (!buf) {
-		cerr << "malloc failed" << endl;
-		EXIT(1);
-	}
+	char *buf = alloc_buf();
 	size_t size = sizeof(this->id.checksum);
 
 	memcpy(&buf[0], this->id.checksum, size);
@@ -158,74 +290,164 @@ void File::fwrite(void)
 		memcpy(&buf[size], &buf[0], size);
 		size *= 2;
 	}
-	// write file
 
-	loff_t file_offset = 0;
-	bool file_end = false;
-	while ( ( (uint64_t) file_offset < this->fsize) && !file_end) {
-		size_t buf_offset = 0;
-		while (buf_offset < BUF_SIZE && !file_end) {
+	ws.fd = fd;
+	ws.buf = buf;
+	ws.buf_offset = 0;
+	ws.offset = 0;
+	ws.crc = 0;
+	ws.direct = is_o_direct;
+	ws.done = false;
+}
 
-			size_t remaining_buf_len = BUF_SIZE - buf_offset;
-			size_t write_len = remaining_buf_len;
+/**
+ * Write up to max_len more bytes of the file, in calls of --io-size.
+ * Returns true once the file is complete, or ended early because fstest
+ * is stopping or the disk is full.
+ */
+bool File::write_chunk(WriteStream &ws, uint64_t max_len)
+{
+	bool checksum = get_global_cfg()->get_checksum();
+	size_t io_size = get_global_cfg()->get_io_size();
+	uint64_t chunk_end = max_len >= this->fsize - ws.offset ?
+			     this->fsize : ws.offset + max_len;
+
+	while (!ws.done && ws.offset < chunk_end) {
+		if (ws.buf_offset == BUF_SIZE)
+			ws.buf_offset = 0;
+
+		// shutting down, the file ends where we stopped
+		if (is_stopping()) {
+			this->fsize = ws.offset;
+			ws.done = true;
+			break;
+		}
 
-			/* XXX needs random IO sizes */
+		size_t write_len = min(BUF_SIZE - ws.buf_offset, io_size);
 
-			if (file_offset + write_len > this->fsize) {
-				write_len = this->fsize - file_offset;
-				file_end = true;
-			}
+		/* XXX needs random IO sizes */
 
-			ssize_t written_len = write(fd, &buf[buf_offset], write_len);
-			if (written_len < 0) {
-				if (errno == ENOSPC) {
-					cout << path << fname 
-						<< ": Out of disk space, "
-						<< "probably a race with another thread" << endl;
-					goto out;
-				}
-				cerr << path << fname << " write failed "
-					<< "size: " << write_len << endl;
-				goto out_err;
-			}
+		if (ws.offset + write_len > chunk_end)
+			write_len = chunk_end - ws.offset;
 
-			buf_offset  += written_len;
-			file_offset += written_len;
+		// an unaligned tail cannot be written with O_DIRECT
+		if (ws.direct && write_len % DIRECT_IO_ALIGN) {
+			IoBackend *io = get_io_backend();
 
-			if ((size_t) file_offset > this->fsize) {
-				cerr << "Bug: Wrote more than we should write!: " <<
-					path << fname << endl;
-			}
+			io->set_flags(ws.fd, io->get_flags(ws.fd) & ~O_DIRECT);
+			ws.direct = false;
+		}
+
+		get_rate_limits()->write.acquire(write_len);
 
+		ssize_t written_len;
+		{
+			TraceOp op(TRACE_WRITE, this->id.value,
+				   ws.offset, write_len);
+			written_len = get_io_backend()->write(ws.fd,
+					&ws.buf[ws.buf_offset], write_len);
+			op.result = written_len < 0 ? -errno : written_len;
+		}
+		if (written_len < 0) {
+			if (errno == ENOSPC) {
+				cout << this->path()
+					<< ": Out of disk space, "
+					<< "probably a race with another thread" << endl;
+				// the file ends where the space ran out
+				this->fsize = ws.offset;
+				ws.done = true;
+				break;
+			}
+			cerr << this->path() << " write failed "
+				<< "size: " << write_len << endl;
+			perror(" : ");
+			cerr << "Failed to write to " + this->path()
+			     << " o-direct=" << ws.direct << endl;
+			EXIT(EXIT_FAILURE);
 		}
 
-		// cout << "file_offset: " << file_offset << " goal-fsize: " << this->fsize << endl;
+		// while the data is still in the CPU cache
+		if (checksum)
+			ws.crc = crc32c(ws.crc, &ws.buf[ws.buf_offset],
+					written_len);
+
+		ws.buf_offset += written_len;
+		ws.offset += written_len;
+
+		if (ws.offset > this->fsize) {
+			cerr << "Bug: Wrote more than we should write!: " <<
+				this->path() << endl;
+		}
 	}
 
-out:
-	rc = fdatasync(fd);
+	if (ws.offset >= this->fsize)
+		ws.done = true;
+
+	return ws.done;
+}
+
+/* Sync and close the file, a file that is not complete ends where its
+ * writing stopped
+ */
+void File::write_end(WriteStream &ws)
+{
+	int rc;
+	int fd = ws.fd;
+	bool immediate_check = get_global_cfg()->get_immediate_check();
+	bool checksum = get_global_cfg()->get_checksum();
+	enum sync_policy sync_policy = get_global_cfg()->get_sync_policy();
+	Manifest *manifest = get_manifest();
+	string path = directory->path();
+	uint64_t file_offset = ws.offset;
+
+	if (!ws.done)
+		this->fsize = file_offset;
+
+	if (checksum)
+		this->store_csum(fd, ws.crc);
+
+	rc = 0;
+	const char *sync_call = "fdatasync()";
+	// the xattr needs a full fsync()
+	if (checksum || sync_policy == SYNC_FSYNC) {
+		TraceOp op(TRACE_FSYNC, this->id.value, 0, file_offset);
+		sync_call = "fsync()";
+		rc = get_io_backend()->fsync(fd);
+		op.result = rc ? -errno : 0;
+	} else if (sync_policy == SYNC_FDATASYNC) {
+		TraceOp op(TRACE_FSYNC, this->id.value, 0, file_offset);
+		rc = get_io_backend()->fdatasync(fd);
+		op.result = rc ? -errno : 0;
+	}
 	if (rc) {
-		cerr << "fdatasync() " << path << this->fname 
+		cerr << sync_call << " " << path << this->fname
 			<< " failed (rc = " << rc << "): " 
 			<< strerror(errno) <<endl;
 		this->sync_failed = true;
 	}
-	
+
+	// only completely written and synced data has to survive a crash
+	if (this->manifest_id && !rc && file_offset == this->fsize)
+		manifest->append(MANIFEST_SYNCED, this->manifest_id, this, true);
+
+	this->set_phys_key(fd);
 
 	// Try to remove pages from memory to let the kernel re-read the file
 	// from disk on later reads
-	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	get_io_backend()->fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
 
 	if (immediate_check) {
 		errno = 0; // reset errno
-		lseek(fd, 0, SEEK_SET);
+		get_io_backend()->lseek(fd, 0, SEEK_SET);
 		this->check_fd(fd); // immediately check the file now, TODO: make this an option
 	}
 
 	if (get_global_cfg()->get_keep_open()) {
 		this->fd_write = fd;
 	} else {
-		rc = close(fd);
+		TraceOp op(TRACE_CLOSE, this->id.value);
+		rc = get_io_backend()->close(fd);
+		op.result = rc ? -errno : 0;
 		if (rc) {
 		cerr << "close() " << path << this->fname
 		     << " failed: (rc = " << rc << "): "
@@ -233,54 +455,90 @@ out:
 		     this->sync_failed = true;
 		}
 	}
-	free(buf);
-	return;
+	free(ws.buf);
+	ws.buf = NULL;
+	ws.fd = -1;
+}
 
-out_err:
-	perror(" : ");
-	cerr << "Failed to write to " + path + this->fname << " o-direct=" <<
-	         is_o_direct << endl;
-	EXIT(EXIT_FAILURE);
+/* Write a file here 
+ * file needs to be locked already 
+ */
+void File::fwrite(void)
+{
+	WriteStream ws;
+
+	this->write_begin(ws);
+	this->write_chunk(ws, UINT64_MAX);
+	this->write_end(ws);
 }
 
 
 /* file destructor - delete a file
- * the filesystem has to be locked before calling this
+ * the filesystem has to be locked before calling this, the file itself
+ * must not be locked anymore
  */
 File::~File(void)
 {
 #ifdef DEBUG
-	cout << "~File(" << this->directory->path() + this->fname << ")" << endl;
+	cout << "~File(" << this->path() << ")" << endl;
 #endif
 
-	if (this->has_error) {
+	// not ours, just verified
+	if (this->directory == NULL) {
+		free(this->time_buf);
+		pthread_rwlock_destroy(&this->rwlock);
+		RETURNV;
+	}
+
+	if (this->has_error && !get_io_backend()->injects_faults()) {
 		cout << "Refusing to delete " 
 			<< this->directory->path() + this->fname << endl;
-		this->unlock();
 		RETURNV;
 	}
 
 	// Remove from dir
 	directory->remove_file(this);
-	// delete file
-	if (::unlink((directory->path() + fname).c_str()) != 0)
-	{
-		cerr << "Deleting file " << directory->path() << fname << " failed:" <<
-			strerror(errno) << std::endl;
-		if (errno != ENOENT)
-			EXIT(1);
 
-	}
+	// delete file, unless the cleanup did it already
+	if (!this->unlinked)
+		this->unlink_file(AT_FDCWD);
 
 	free(this->time_buf);
 
-        this->unlock();
-
         if (this->fd_write != -1) {
-                close(this->fd_write);
+                get_io_backend()->close(this->fd_write);
         }
 
-	pthread_mutex_destroy(&this->mutex);
+	pthread_rwlock_destroy(&this->rwlock);
+}
+
+/* Delete the file on disk, relative to the directory file descriptor
+ * dirfd or by its path for AT_FDCWD. The object still has to be deleted.
+ */
+void File::unlink_file(int dirfd)
+{
+	// recorded before the unlink, a crash in between must not look like
+	// lost data
+	if (this->manifest_id)
+		get_manifest()->append(MANIFEST_DELETED, this->manifest_id,
+				       this, true);
+
+	string path = directory->path() + fname;
+
+	TraceOp op(TRACE_UNLINK, this->id.value, 0, this->fsize);
+	op.result = get_io_backend()->unlinkat(dirfd, dirfd == AT_FDCWD ?
+					       path.c_str() : fname);
+	if (op.result != 0)
+	{
+		op.result = -errno;
+		cerr << "Deleting file " << path << " failed:" <<
+			strerror(errno) << std::endl;
+		if (errno != ENOENT)
+			EXIT(1);
+
+	}
+
+	this->unlinked = true;
 }
 
 void File::delete_all(void)
@@ -310,21 +568,42 @@ void File::unlink()
 	prev = next = NULL;
 }
 
-int64_t File::read_fd(int fd, char *buf, uint64_t &off)
+/* Read the next buffer of the range [off, end) into buf.
+ * The last range of the file also tries to read beyond the file size, to
+ * see if the file is larger than expected.
+ */
+int64_t File::read_fd(int fd, char *buf, uint64_t &off, uint64_t end,
+		      bool direct, ostream &err)
 {
 	uint64_t buff_off = 0; /* offset within the buffer */
 	int64_t ret;
 	bool eof = false;
+	bool last_range = (end == this->fsize);
+	size_t io_size = get_global_cfg()->get_io_size();
 
 	while (buff_off < BUF_SIZE && !eof) {
 		ssize_t rc;
+		size_t len = min(BUF_SIZE - buff_off, (uint64_t) io_size);
+
+		if (!last_range)
+			len = min(len, (size_t) (end - off));
+		if (len == 0)
+			break;
 
 		/* XXX Needs random IO sizes */
 
-		rc = pread(fd, &buf[buff_off], BUF_SIZE - buff_off, off);
+		// the last read of the file probes beyond its size
+		get_rate_limits()->read.acquire(min(len, this->fsize > off ?
+						    (size_t) (this->fsize - off) : 0));
+
+		{
+			TraceOp op(TRACE_READ, this->id.value, off, len);
+			rc = get_io_backend()->pread(fd, &buf[buff_off], len,
+						     off);
+			op.result = rc < 0 ? -errno : rc;
+		}
 		if (rc < 0) {
-			cerr << "Read from " << directory->path()
-				<< fname << " failed: "
+			err << "Read from " << this->path() << " failed: "
 				<< strerror(errno) << endl;
 			ret = rc;
 			goto out;
@@ -333,11 +612,12 @@ int64_t File::read_fd(int fd, char *buf, uint64_t &off)
 		off += rc;
 		buff_off += rc;
 
-		if (rc == 0) {
+		// the next O_DIRECT read would be unaligned and fail
+		if (rc == 0 || (direct && (size_t) rc < len)) {
 			eof = true;
-			if (off < this->fsize) {
-				cerr << "File smaller than expected: " <<
-					directory->path() << fname <<
+			if (off < end) {
+				err << "File smaller than expected: " <<
+					this->path() <<
 					" expected: " << this->fsize <<
 					" got: " << off << endl;
 				ret = -1; /* fail */
@@ -349,8 +629,8 @@ int64_t File::read_fd(int fd, char *buf, uint64_t &off)
 		}
 
 		if (off > this->fsize) {
-			cerr << "File larger than expected: " <<
-				directory->path() << fname 	<<
+			err << "File larger than expected: " <<
+				this->path() <<
 				" expected: " << this->fsize	<<
 				" got: " << off <<endl;
 			ret = -1; /* fail */
@@ -363,7 +643,7 @@ int64_t File::read_fd(int fd, char *buf, uint64_t &off)
 
 out:
 #if 0
-	cout 	<< directory->path() + fname
+	cout 	<< this->path()
 		<< " " << "read-len: " << ret
 		<< " " << "new-off: " << off
 		<< " " << "File-Size: " << this->fsize << endl;
@@ -371,8 +651,84 @@ out:
 	return ret;
 }
 
+/* Compare the range [start, end) of the file against the pattern.
+ * Runs in its own thread for parallel checks, so nothing is printed here,
+ * messages are collected in range->report.
+ */
+void File::check_range(VerifyRange *range)
+{
+	char *file_buf = alloc_buf();
+
+	uint64_t off = range->start;
+	while (off < range->end) {
+		uint64_t buf_start = off;
+		int64_t res = this->read_fd(range->fd, file_buf, off,
+					    range->end, range->direct,
+					    range->report);
+		if (res <= 0) {
+			if (res < 0)
+				range->ret = res;
+
+			/* eof, nothing new to compare */
+			break;
+		}
+
+		if (range->crc_wanted) {
+			range->crc = crc32c(range->crc, file_buf, res);
+			range->crc_len += res;
+		}
+
+		// If the filesystem was full, not the complete file was written
+		// and so the file might not have a size being a multiple of
+		// BUF_SIZE. So only compare what was read.
+		if (!this->pattern_known ||
+		    memcmp(range->pattern, file_buf, res) == 0)
+			continue;
+
+		if (!range->corrupt) {
+			range->corrupt = true;
+			range->first_corruption = buf_start;
+		}
+
+		for (int64_t ia = 0; ia < res; ia++) {
+			if (range->pattern[ia] != file_buf[ia]) {
+				char line[80];
+				snprintf(line, sizeof(line),
+					 "Expected: %x, got: %x (pos = %lu)\n",
+					 (unsigned char) range->pattern[ia],
+					 (unsigned char) file_buf[ia],
+					 (long unsigned) buf_start + ia);
+				range->report << line;
+			}
+		}
+
+		// Do not RETURN an error and abort writes, if we know
+		// this sync to disk of this file failed
+		if (!this->sync_failed) {
+			range->ret = 1;
+			break;
+		}
+	}
+
+	free(file_buf);
+}
+
+static void *run_check_range(void *arg)
+{
+	VerifyRange *range = (VerifyRange *) arg;
+
+	get_placement()->apply(ROLE_HELPER);
+
+	// the bytes are counted by the thread that started the check
+	CpuOp cpu(CPU_VERIFY);
+	range->file->check_range(range);
+	return NULL;
+}
+
 /* check the given file descriptor for corruption
  * no locking magic here, this function just does the checking of an opened file
+ * Large files are split into ranges that are verified by several threads
+ * with pread(), results are merged into one verdict and report.
  */
 int File::check_fd(int fd)
 {
@@ -381,12 +737,11 @@ int File::check_fd(int fd)
 	// Do not keep the pages in memory, later checks then have to re-read it.
 	// Disadvantage is that we do not create memory pressure then, which is
 	// usually good to stress test filesystems
-	posix_fadvise(fd, 0 ,0, POSIX_FADV_NOREUSE);
+	get_io_backend()->fadvise(fd, 0 ,0, POSIX_FADV_NOREUSE);
 
 	//Create buffer and fill with id
 	char *checksum_buf = (char *)malloc(BUF_SIZE);
-	char *file_buf = (char *)malloc(BUF_SIZE);
-	if (!checksum_buf or !file_buf) {
+	if (!checksum_buf) {
 		cerr << "Malloc failed" << endl;
 		EXIT(1);
 	}
@@ -397,71 +752,199 @@ int File::check_fd(int fd)
 		memcpy(&checksum_buf[off], this->id.checksum, sz);
 		off += sz;
 	}
-	
-	// read and compare file, try to read more to see if the sile size matches
-	off = 0;
-	bool eof = false;
-	while (off < this->fsize || eof) {
-		int64_t res = this->read_fd(fd, file_buf, off);
-		if (res <= 0) {
-			if (res < 0) {
-				ret = res;
-				goto out;
-			}
 
-			if (res == 0) {
-				eof = true;
-				/* no need to compare again, nothing new */
-				break;
-			}
+	size_t nranges = get_global_cfg()->get_verify_threads();
+	if (this->fsize < (1ULL << get_global_cfg()->get_parallel_verify_bits()))
+		nranges = 1;
+
+	// ranges start at a multiple of BUF_SIZE to keep the pattern aligned
+	uint64_t range_size = (this->fsize + nranges - 1) / nranges;
+	range_size = max((range_size + BUF_SIZE - 1) & ~(BUF_SIZE - 1),
+			 (uint64_t) BUF_SIZE);
+	nranges = max((this->fsize + range_size - 1) / range_size, 1UL);
+
+	// files of an earlier run might have a checksum xattr
+	bool want_csum = get_global_cfg()->get_checksum() ||
+			 this->directory == NULL;
+	bool direct = get_io_backend()->get_flags(fd) & O_DIRECT;
+
+	vector<VerifyRange> ranges(nranges);
+	for (size_t i = 0; i < nranges; i++) {
+		VerifyRange &range = ranges[i];
+
+		range.file = this;
+		range.crc_wanted = want_csum;
+		range.direct = direct;
+		range.fd = fd;
+		range.pattern = checksum_buf;
+		range.start = min(i * range_size, this->fsize);
+		range.end = min(range.start + range_size, this->fsize);
+		if (i == nranges - 1)
+			range.end = this->fsize;
+	}
+
+	vector<pthread_t> threads(nranges);
+	for (size_t i = 1; i < nranges; i++) {
+		int rc = pthread_create(&threads[i], NULL, run_check_range,
+					&ranges[i]);
+		if (rc) {
+			cerr << "Failed to start check thread " << i << ": "
+			     << strerror(rc) << endl;
+			EXIT(1);
 		}
+	}
 
-		// If the filesystem was full, not the complete file was written
-		// and so the file might not have a size being a multiple of
-		// BUF_SIZE. So introduce a cmp size.
-		size_t cmpsize;
-		cmpsize = min(BUF_SIZE, this->fsize - off);
-		if (memcmp(checksum_buf, file_buf, cmpsize) != 0) {
+	this->check_range(&ranges[0]);
+
+	for (size_t i = 1; i < nranges; i++)
+		pthread_join(threads[i], NULL);
+
+	// merge the results, a read error wins over a corruption
+	bool corrupt = false;
+	for (VerifyRange &range : ranges) {
+		if (range.ret < 0 && ret >= 0)
+			ret = range.ret;
+		else if (range.ret > 0 && ret == 0)
+			ret = range.ret;
+
+		if (range.corrupt && !corrupt) {
+			corrupt = true;
 			this->has_error = true;
-			cerr << "File corruption in " 
-				<< directory->path() << this->fname
+			cerr << "File corruption in " << this->path()
 				<< " (create time: " << this->create_time << ")"
-			        << " around " << off << " [pattern = "
+			        << " around " << range.first_corruption
+				<< " [pattern = "
 			        << std::hex << id.value << std::dec << "]" << endl;
 			cerr << "After n-checks: " <<  this->num_checks << endl;
-			for (unsigned ia = 0; ia < BUF_SIZE; ia++) {
-				if (memcmp(checksum_buf + ia, file_buf + ia, 1) != 0) {
-					fprintf(stderr, "Expected: %x, got: %x (pos = %lu)\n",
-					        (unsigned char) checksum_buf[ia], (unsigned char) file_buf[ia],
-					        (long unsigned) off + ia);
-				}
-			}
-			// Do not RETURN an error and abort writes, if we know
-			// this sync to disk of this file failed
-			if (!this->sync_failed) {
-				ret = 1;
-				goto out;
-			}
+
+			TraceOp op(TRACE_CORRUPT, this->id.value,
+				   range.first_corruption);
 		}
+
+		cerr << range.report.str();
 	}
 
-out:
+	if (want_csum && ret == 0) {
+		uint32_t crc = 0;
+
+		for (VerifyRange &range : ranges)
+			crc = crc32c_combine(crc, range.crc, range.crc_len);
+
+		if (this->check_csum(fd, crc)) {
+			corrupt = true;
+			this->has_error = true;
+			ret = 1;
+			TraceOp op(TRACE_CORRUPT, this->id.value);
+		}
+	}
+
+	// what else happened around it, e.g. concurrent unlinks and syncs
+	if (corrupt)
+		trace_dump("corruption");
+
 	// Try to remove pages from memory to let the kernel re-read the file
 	// on later reads
-	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	get_io_backend()->fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
 
 	free(checksum_buf);
-	free(file_buf);
 	RETURN(ret);
 }
 
+/* Store the checksum of the written data in the xattr */
+void File::store_csum(int fd, uint32_t crc)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "crc32c:%08x", crc);
+	if (get_io_backend()->fsetxattr(fd, CSUM_XATTR, buf, strlen(buf)) != 0) {
+		int err = errno;
+
+		cerr << "Setting " << CSUM_XATTR << " of " << this->path()
+		     << " failed: " << strerror(err) << endl;
+		return;
+	}
+
+	this->csum = crc;
+	this->has_csum = true;
+}
+
+/* --checksum needs user xattrs in dir, checked once before the test */
+int File::probe_csum(string dir)
+{
+	IoBackend *io = get_io_backend();
+	string path = dir + ".fstest-csum." + to_string(getpid());
+
+	int fd = io->open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		int err = errno;
+
+		cerr << "Error: creating " << path << " failed: "
+		     << strerror(err) << endl;
+		return -err;
+	}
+
+	int rc = io->fsetxattr(fd, CSUM_XATTR, "probe", 5) ? -errno : 0;
+	io->close(fd);
+	io->unlinkat(AT_FDCWD, path.c_str());
+
+	if (rc)
+		cerr << "Error: --checksum needs user xattrs, setting "
+		     << CSUM_XATTR << " in " << dir << " failed: "
+		     << strerror(-rc) << endl;
+	return rc;
+}
+
+/* Compare the checksum of the data read with the xattr
+ * Returns 1 on a mismatch
+ */
+int File::check_csum(int fd, uint32_t crc)
+{
+	char buf[32];
+	ssize_t len = get_io_backend()->fgetxattr(fd, CSUM_XATTR, buf,
+						  sizeof(buf) - 1);
+
+	if (len < 0) {
+		if (!this->has_csum)
+			return 0; // never had one
+
+		cerr << "Checksum xattr of " << this->path() << " lost: "
+		     << strerror(errno) << endl;
+		return 1;
+	}
+	buf[len] = '\0';
+
+	unsigned stored;
+	if (sscanf(buf, "crc32c:%x", &stored) != 1) {
+		cerr << "Invalid checksum xattr of " << this->path() << ": "
+		     << buf << endl;
+		return 1;
+	}
+
+	if (stored != crc || (this->has_csum && this->csum != crc)) {
+		char line[64];
+
+		snprintf(line, sizeof(line), "xattr %08x, read %08x", stored,
+			 crc);
+		cerr << "Checksum mismatch in " << this->path() << ": " << line;
+		if (this->has_csum) {
+			snprintf(line, sizeof(line), ", written %08x", this->csum);
+			cerr << line;
+		}
+		cerr << endl;
+		return 1;
+	}
+
+	return 0;
+}
+
 /* check the file for corruption
- * the file MUST be locked before calling this method
+ * the file MUST be locked (shared or exclusive) before calling this method
+ * The page cache state before the check is returned in sample, if given.
  */
-int File::check(void)
+int File::check(CacheSample *sample)
 {
 #ifdef DEBUG
-	cerr << " Checking file " << this->directory->path() << this->fname << endl;
+	cerr << " Checking file " << this->path() << endl;
 #endif
 
 	if (get_global_cfg()->get_no_check())
@@ -470,26 +953,59 @@ int File::check(void)
 	if (this->has_error)
 		RETURN(0); // No need to further check this
 
-	if (this->trylock() != EBUSY)
+	if (this->trylock() != EBUSY) {
 		cout << "Program error:  file is not locked " << this->fname << endl;
+		this->unlock();
+	}
 	
 	int open_flags = O_RDONLY;
 
-	bool is_o_direct = this->set_direct_io_flag(open_flags);
+	bool is_o_direct;
+	if (get_global_cfg()->get_evict_mode() == EVICT_DIRECT) {
+		open_flags |= O_DIRECT;
+		is_o_direct = true;
+	} else
+		is_o_direct = this->set_direct_io_flag(open_flags);
 
-	int fd = open((directory->path() + fname).c_str(), open_flags);
+	// from the open on, so that the watchdog sees a hanging open or
+	// eviction as well
+	TraceOp op(TRACE_CHECK, this->id.value, 0, this->fsize);
+
+	int fd = get_io_backend()->open(this->path().c_str(), open_flags);
 	if (fd == -1) {
-		cerr << " Checking file " << this->directory->path() << this->fname;
+		int err = errno;
+
+		op.result = -err;
+		cerr << " Checking file " << this->path();
 		perror(" : ");
-		EXIT(1);
+		if (err == EINVAL && is_o_direct) {
+			cerr << "O_DIRECT is not supported here, try --evict "
+			     << "drop-caches or balloon" << endl;
+			EXIT(1);
+		}
+
+		// gone or unreadable, the caller decides what that means
+		this->num_checks++;
+		RETURN(-err);
 	}
 
+	CacheSample unused;
+	cache_prepare(fd, this->fsize, sample ? sample : &unused);
+
 	int ret = this->check_fd(fd);
+	op.result = ret;
 	if (ret)
-		cerr << "Check for " + directory->path() + fname  + " failed, "
+		cerr << "Check for " + this->path() + " failed, "
 		     << "o-direct=" << is_o_direct << endl;
 
-	close(fd);
+	// injected faults are expected, the backend counts their detection
+	IoBackend *io = get_io_backend();
+	if (io->injects_faults()) {
+		io->verified(this->path(), ret != 0);
+		ret = 0;
+	}
+
+	get_io_backend()->close(fd);
 	
 	this->num_checks++;
 
@@ -501,9 +1017,21 @@ File * File::get_next() const
 	return this->next;
 }
 
+/* exclusive lock, to delete or rewrite the file */
 void File::lock(void)
 {
-	int rc = pthread_mutex_lock(&this->mutex);
+	int rc = pthread_rwlock_wrlock(&this->rwlock);
+	if (rc) {
+		cerr << "Failed to lock " << this->fname << " : " << strerror(rc);
+		perror(" : ");
+		EXIT(1);
+	}
+}
+
+/* shared lock, to verify the file */
+void File::lock_shared(void)
+{
+	int rc = pthread_rwlock_rdlock(&this->rwlock);
 	if (rc) {
 		cerr << "Failed to lock " << this->fname << " : " << strerror(rc);
 		perror(" : ");
@@ -513,7 +1041,7 @@ void File::lock(void)
 
 void File::unlock(void)
 {
-	int rc = pthread_mutex_unlock(&this->mutex);
+	int rc = pthread_rwlock_unlock(&this->rwlock);
 	if (rc) {
 		cerr << "Failed to lock " << this->fname << " : " << strerror(rc);
 		perror(" : ");
@@ -523,7 +1051,7 @@ void File::unlock(void)
 
 int File::trylock(void)
 {
-	int rc = pthread_mutex_trylock(&this->mutex);
+	int rc = pthread_rwlock_trywrlock(&this->rwlock);
 	if (rc && rc != EBUSY) {
 		cerr << "Failed to lock " << this->fname << " : " << strerror(rc);
 		perror(" : ");
@@ -531,4 +1059,3 @@ int File::trylock(void)
 	}
 	RETURN(rc);
 }
-
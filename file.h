@@ -47,11 +47,46 @@
 #include <cassert>
 #include <vector>
 #include <cstring>
+#include <atomic>
+
+const uint64_t BUF_SIZE = 1024*1024; // Must be power of 2
+
+class File;
+struct CacheSample;
+
+/* A part of a file, verified by one thread */
+struct VerifyRange {
+	File *file;
+	int fd;
+	uint64_t start, end;
+	const char *pattern; // BUF_SIZE bytes of the expected pattern
+	bool direct {false}; // fd has O_DIRECT, a short read is the end of file
+
+	int ret {0};
+	bool corrupt {false};
+	bool crc_wanted {false};
+	uint32_t crc {0}; // CRC32C of the bytes read
+	uint64_t crc_len {0};
+	uint64_t first_corruption {0};
+	std::ostringstream report; // collected error messages
+};
+
+/* A file being written, from File::write_begin() to write_end() */
+struct WriteStream {
+	int fd;
+	char *buf; // BUF_SIZE bytes of the pattern
+	size_t buf_offset; // next write from here
+	uint64_t offset; // bytes written
+	uint32_t crc; // CRC32C of the written bytes, with --checksum
+	bool direct; // fd has O_DIRECT
+	bool done; // complete, or ended early
+};
 
 class File
 {
 private:
 	Dir *directory;
+	string existing_path; // path of a file not created by us
 	File *prev, *next; // only per directory, not globally
 	uint64_t fsize; // the file size
 
@@ -61,39 +96,67 @@ private:
 
 	}id;  // checksum pattern
 
-	pthread_mutex_t mutex;
+	// shared by verifying threads, exclusive to delete or rewrite
+	pthread_rwlock_t rwlock;
 	char *time_buf; // for ctime_r(time, time_buf)
 	string create_time; //create time 
 
 	bool sync_failed; // fsync() or close() failed
-	bool has_error;
-	bool in_delete; // the write thread is going to delete it, the read thread shall ignore it
-
-	int64_t read_fd(int fd, char *buf, uint64_t &off);
+	std::atomic<bool> has_error;
+	std::atomic<bool> in_delete; // the write thread is going to delete it, the read thread shall ignore it
+
+	bool verified; // the read thread went over it at least once
+	time_t last_verify; // last successful check, initially the write time
+	uint64_t seq; // write order, assigned by the filesystem
+	uint64_t write_pos; // bytes written to the filesystem up to this file
+	uint64_t phys_key; // inode number or physical offset, for the read order
+	uint64_t manifest_id; // 0 without a manifest
+	bool unlinked; // deleted on disk by the cleanup
+	bool pattern_known; // false: only the checksum xattr can be checked
+	bool has_csum; // csum was stored in the xattr by fwrite()
+	uint32_t csum;
+
+	void set_phys_key(int fd);
+	void store_csum(int fd, uint32_t crc);
+	int check_csum(int fd, uint32_t crc);
+
+	int64_t read_fd(int fd, char *buf, uint64_t &off, uint64_t end,
+			bool direct, std::ostream &err);
 
         int fd_write{-1}; // file descriptor for write
 
+	friend class Bench; // measures the hot paths in isolation
+
 public:
 	char fname[9]; // file name
 	File(Dir *dir);
+	File(string path, uint32_t pattern, uint64_t size);
 
 	~File(void);
 
+	string path(void) const;
 	bool set_direct_io_flag(int &open_flags);
 	void fwrite(void);
+	void write_begin(WriteStream &ws);
+	bool write_chunk(WriteStream &ws, uint64_t max_len);
+	void write_end(WriteStream &ws);
 	void delete_all(void);
+	void unlink_file(int dirfd);
 	
 	void link(File *file);
 	void unlink(void);
 	int check_fd(int fd);
-	int check(void);
+	void check_range(VerifyRange *range);
+	int check(CacheSample *sample = NULL);
+	static int probe_csum(string dir);
 	void lock(void);
+	void lock_shared(void);
 	void unlock(void);
 	int  trylock(void);
 	
 	File *get_next(void) const;
 
-	int num_checks; // how often this file aready has been verified
+	std::atomic<int> num_checks; // how often this file aready has been verified
 	
 	size_t get_fsize() const
 	{
@@ -110,6 +173,66 @@ public:
 		this->in_delete = true;
 	}
 
+	bool is_verified(void) const
+	{
+		return this->verified;
+	}
+
+	void set_verified(void)
+	{
+		this->verified = true;
+	}
+
+	time_t get_last_verify(void) const
+	{
+		return this->last_verify;
+	}
+
+	void set_last_verify(time_t time)
+	{
+		this->last_verify = time;
+	}
+
+	uint64_t get_seq(void) const
+	{
+		return this->seq;
+	}
+
+	void set_seq(uint64_t seq)
+	{
+		this->seq = seq;
+	}
+
+	uint64_t get_write_pos(void) const
+	{
+		return this->write_pos;
+	}
+
+	void set_write_pos(uint64_t pos)
+	{
+		this->write_pos = pos;
+	}
+
+	uint64_t get_phys_key(void) const
+	{
+		return this->phys_key;
+	}
+
+	void set_pattern_unknown(void)
+	{
+		this->pattern_known = false;
+	}
+
+	bool has_errors(void) const
+	{
+		return this->has_error;
+	}
+
+	uint32_t get_pattern(void) const
+	{
+		return this->id.value;
+	}
+
 	
 };
 
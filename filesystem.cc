@@ -28,6 +28,15 @@
 
 #include "fstest.h"
 #include "config.h"
+#include "jobs.h"
+#include "ratelimit.h"
+#include "control.h"
+#include "cache.h"
+#include "watchdog.h"
+#include "iobackend.h"
+#include "cpustats.h"
+#include "placement.h"
+#include <algorithm>
 
 static int stats_interval = 60;
 //int size_max = 35; // 32GiB
@@ -36,15 +45,22 @@ static int stats_interval = 60;
 using namespace std;
 
 /* filesystem constructor */
-Filesystem::Filesystem(string dir, size_t percent)
+Filesystem::Filesystem(string dir, size_t percent, size_t target_idx)
 {
-	this->last_read_index = 0;
+	this->level = 1;
+	this->budget = NULL;
+	if (get_job_shared() != NULL)
+		this->budget = &get_job_shared()->budgets[target_idx];
+
+	this->next_seq = 0;
+	this->num_unverified = 0;
 
 	this->goal_percent = percent;
 	pthread_mutex_init(&this->mutex, NULL);
 	this->error_detected = false;
 	this->terminated = false;
 	this->max_files = get_global_cfg()->get_max_files();
+	this->pacer.init(1ULL << get_global_cfg()->get_max_size_bits());
 
 	// Create working dir
 	root_dir = new Dir(dir, this);
@@ -63,7 +79,9 @@ Filesystem::Filesystem(string dir, size_t percent)
 	cout << "Filesystem use-goal : " << this->fs_use_goal / KILO << "kiB" << endl;
 
 
-	if ( (fssize - fsfree) >= this->fs_use_goal) {
+	// with --jobs the coordinator checked it, other jobs might already
+	// have written data
+	if (get_job_shared() == NULL && (fssize - fsfree) >= this->fs_use_goal) {
 		cerr 	<< "Error: Filesystem already above % used goal: "
 			<< this->fsused * 100.0 / fssize << " >= "
 			<< goal_percent << endl;
@@ -72,25 +90,117 @@ Filesystem::Filesystem(string dir, size_t percent)
 
 
 	was_full = false;
+
+	new Dir(root_dir, 1);
+	stats_all.time = time(NULL);
+	this->phases.start();
+	cout << "Starting test       : " << ctime(&stats_old.time);
 }
 
+/* The test tree is deleted by cleanup(), a kept tree is not freed */
 Filesystem::~Filesystem(void)
 {
-	this->lock();
-	if (this->root_dir != NULL && !this->error_detected) {
-		delete root_dir;
-		root_dir = NULL;
-	}
-	this->unlock();
 	pthread_mutex_destroy(&this->mutex);
 }
 
-void Filesystem::check_terminate_and_sleep(unsigned seconds)
+struct CleanupWork {
+	Filesystem *fs;
+	std::atomic<size_t> next_dir {0};
+	std::atomic<uint64_t> bytes {0};
+};
+
+static void *run_cleanup_thread(void *arg)
+{
+	CleanupWork *work = (CleanupWork *) arg;
+	vector<Dir *> &dirs = work->fs->all_dirs;
+
+	get_placement()->apply(ROLE_HELPER);
+
+	while (true) {
+		size_t idx = work->next_dir++;
+		if (idx >= dirs.size())
+			break;
+
+		CpuOp cpu(CPU_DELETE);
+		cpu.bytes = dirs[idx]->delete_files();
+		work->bytes += cpu.bytes;
+	}
+
+	return NULL;
+}
+
+/**
+ * Delete the test tree after all test threads are done. The files are
+ * unlinked by num_threads threads, each one taking a directory at a time,
+ * then the directories are removed. After an error or with --keep-data
+ * everything is kept.
+ */
+void Filesystem::cleanup(size_t num_threads)
+{
+	if (this->error_detected) {
+		cout << "Error detected, keeping " << this->get_path() << endl;
+		return;
+	}
+
+	if (get_global_cfg()->get_keep_data()) {
+		cout << "Keeping " << this->get_path() << endl;
+		return;
+	}
+
+	size_t num_files = this->files.size();
+	uint64_t start = now_ns();
+
+	CleanupWork work;
+	work.fs = this;
+
+	num_threads = max(min(num_threads, this->all_dirs.size()), (size_t) 1);
+	vector<pthread_t> threads(num_threads);
+	for (size_t i = 0; i < num_threads; i++) {
+		int rc = pthread_create(&threads[i], NULL, run_cleanup_thread,
+					&work);
+		if (rc) {
+			cerr << "Failed to start cleanup thread " << i << ": "
+			     << strerror(rc) << endl;
+			EXIT(1);
+		}
+	}
+
+	for (pthread_t &thread : threads)
+		pthread_join(thread, NULL);
+
+	this->files.clear();
+	if (this->budget != NULL)
+		this->budget->release(work.bytes);
+
+	delete this->root_dir;
+	this->root_dir = NULL;
+
+	double t = max((now_ns() - start) / 1E9, 1E-3);
+	cout << "Cleaned up " << num_files << " files in " << t << " s ("
+	     << num_files / t << " files/s, " << num_threads << " threads)"
+	     << endl;
+}
+
+void Filesystem::set_error_detected(void)
+{
+	this->error_detected = true;
+
+	JobSlot *slot = get_job_slot();
+	if (slot != NULL)
+		slot->error_detected = true;
+}
+
+/* Returns true if the test is terminated, otherwise sleeps */
+bool Filesystem::check_terminate_and_sleep(unsigned seconds)
 {
 	if (this->terminated)
-		pthread_exit(NULL);
+		return true;
 
+	thread_set_state(THREAD_WAITING);
 	usleep(seconds * 1E6);
+	control_wait_if_paused();
+
+	return false;
 }
 
 
@@ -101,7 +211,7 @@ void Filesystem::update_stats(bool size_only)
 	struct statvfs statvfsbuf;
 
 	// Get FS stats
-	if (statvfs(root_dir->path().c_str(), &statvfsbuf) != 0) {
+	if (get_io_backend()->statvfs(root_dir->path().c_str(), &statvfsbuf) != 0) {
 		perror("statvfs(): ");
 		EXIT(1);
 	}
@@ -126,6 +236,9 @@ void Filesystem::update_stats(bool size_only)
 	this->stats_all.num_files += this->stats_now.num_files;
 	this->stats_all.num_read_files += this->stats_now.num_read_files;
 	this->stats_all.num_written_files += this->stats_now.num_written_files;
+	this->stats_all.cache_pages += this->stats_now.cache_pages;
+	this->stats_all.cache_resident += this->stats_now.cache_resident;
+	this->stats_all.cache_cached += this->stats_now.cache_cached;
 
 	memset(&stats_old, 0, sizeof(stats_old));
 	memset(&stats_now, 0, sizeof(stats_now));
@@ -135,84 +248,140 @@ void Filesystem::update_stats(bool size_only)
 }
 
 
+/* Add a written file to the file table and the read schedule
+ * Filesystem has to be locked */
+void Filesystem::insert_file(File *file)
+{
+	this->files.push_back(file);
+
+	file->set_seq(this->next_seq++);
+	file->set_write_pos(this->pacer.add_written(file->get_fsize()));
+	file->set_last_verify(time(NULL));
+	this->scheduler.add(file);
+	this->num_unverified++;
+}
+
+/* Remove a file from the file table, it is already out of the read schedule
+ * Filesystem has to be locked */
+void Filesystem::erase_file(File *file)
+{
+	this->files.erase(find(this->files.begin(), this->files.end(), file));
+}
+
 /**
- * free some disk space if usage above goal
+ * free some disk space if usage above goal, pending are the bytes still to
+ * be written to files already being written
+ * Returns false if the write thread has to stop instead
  */
-void Filesystem::free_space(size_t fsize)
+bool Filesystem::free_space(size_t fsize, uint64_t pending)
 {
 	if (this->error_detected || this->terminated)
-		pthread_exit(NULL); // Don't delete anything, just exit immediately
+		return false; // Don't delete anything, just leave
 
+	this->lock();
 	this->update_stats(true);
+	this->unlock();
 
 	int retry_count = 0;
+	TargetBudget *budget = this->budget;
+
+	while (true) {
+		this->lock();
+		size_t nfiles = this->files.size();
+		bool over_goal = this->fsused + (uint64_t)fsize + pending >
+				 this->fs_use_goal;
+		this->unlock();
+
+		if (nfiles < this->max_files) {
+			// with --jobs the space is also reserved in the
+			// budget shared by all jobs, statvfs() alone races
+			// with the other jobs
+			if (!over_goal && budget != NULL) {
+				if (budget->try_reserve(fsize))
+					break;
+				over_goal = true;
+			}
+
+			if (!over_goal)
+				break;
 
-	while ((this->fsused + (uint64_t)fsize > this->fs_use_goal &&
-		this->files.size() > QL_FSTEST_MIN_NUM_FILES) ||
-	       this->files.size() >= this->max_files) {
+			if (nfiles <= QL_FSTEST_MIN_NUM_FILES) {
+				if (budget != NULL)
+					budget->reserve(fsize);
+				break;
+			}
+		}
 
 		retry_count++;
 
 		if (!this->was_full) {
 			this->was_full = true;
 			cout << "Going into write/delete mode" << endl;
+			this->phases.set_full(this->fs_use_goal);
 		}
 
 		// Remove a file
 
 		this->lock();
-		int nfiles = this->files.size();
+		nfiles = this->files.size();
 		if (nfiles < 1) {
 			this->unlock();
 			break;
 		}
 		int idx = random() % nfiles;
 
-		this->file_iter = this->files.begin() + idx;
-		File *file = *this->file_iter;
+		File *file = this->files[idx];
 
-		// Don't delete a file that is in read or not checked yet
-		// Our read loop does not like that
-		if (file->trylock()) {
-			// File probably just in read
+		// another write thread is deleting it already
+		if (file->is_being_deleted()) {
 			this->unlock();
 			continue;
 		}
+
+		// The read threads must not pick it up again. Files that are
+		// just in read are skipped by the readers once they are done.
+		file->set_in_delete();
+		this->scheduler.remove(file);
+		if (!file->is_verified())
+			this->num_unverified--;
 		this->unlock();
 
-		string fname = file->fname;
-		int nchecks = file->num_checks;
+		// Wait for in-flight verifications of the file to finish
+		thread_set_state(THREAD_DELETING, file->get_pattern());
+		file->lock();
 
-#if 0
-		// Check if read-thread already has verified it
-		if (nchecks == 0) {
-			file->unlock();
-			continue;
-		}
-#endif
-
-		file->set_in_delete();
+		int nchecks = file->num_checks;
 
 		// check the file a last time
 		if (nchecks < 10) {
 			// cout << "num-files: " << this->files.size() <<
 			// 	" Unlink check: " << fname << endl;
+			CpuOp cpu(CPU_VERIFY, file->get_fsize());
 			if (file->check() ) {
-				this->error_detected = true;
+				this->set_error_detected();
 				// we exit the write_main thread
 
 				file->unlock();
-				pthread_exit(NULL);
+				return false;
 			}
 			// cout << "Unlink check done: " << fname << endl;
 		}
 
 		file->unlock();
 
+		// may sleep, not with the filesystem locked
+		get_rate_limits()->files.acquire(1);
+
 		this->lock();
 
-		delete file;
-		this->files.erase(this->file_iter);
+		// nobody else knows about the file anymore
+		if (budget != NULL)
+			budget->release(file->get_fsize());
+		this->erase_file(file);
+		{
+			CpuOp cpu(CPU_DELETE, file->get_fsize());
+			delete file;
+		}
 
 		this->update_stats(true);
 
@@ -229,22 +398,81 @@ void Filesystem::free_space(size_t fsize)
 			endl;
 #endif
 
+	return true;
 }
 
+/* Make a written file known to the readers and account it, reserved is
+ * the size free_space() was asked for
+ * Filesystem has to be locked */
+void Filesystem::add_written_file(File *file, Dir *dir, uint64_t reserved)
+{
+	// cut short by ENOSPC or a stop, only the written size is released
+	// when the file is deleted
+	if (this->budget != NULL && file->get_fsize() < reserved)
+		this->budget->release(reserved - file->get_fsize());
+
+	dir->add_file(file);
+	this->insert_file(file);
+
+	this->stats_now.write += file->get_fsize();
+	this->stats_now.num_files++;
+	this->stats_now.num_written_files++;
+
+	JobSlot *slot = get_job_slot();
+	if (slot != NULL) {
+		slot->write += file->get_fsize();
+		slot->num_written_files++;
+		slot->num_files = this->files.size();
+	}
+	// cout << "dir->num_files: " << active_dirs[num]->fsize() << endl;
+	// cout << "files: " << files.size() << endl;
+
+	// Remove dir from active_dirs if full, another write thread
+	// might have done that already
+	if (dir->get_num_files() >= dir->get_max_files()) {
+		auto it = find(this->active_dirs.begin(),
+			       this->active_dirs.end(), dir);
+		if (it != this->active_dirs.end())
+			this->active_dirs.erase(it);
+	}
+
+	if (active_dirs.size() == 0) {
+		++level;
+		cout << "Going to level " << level << endl;
+		active_dirs = all_dirs;
+		new Dir(root_dir, level);
+	};
+}
+
+/* A file of write_main() that is being written */
+struct OpenFile {
+	File *file;
+	Dir *dir;
+	WriteStream ws;
+	uint64_t reserved; // the planned size
+	uint64_t start_ns;
+};
+
 /** write_main thread
  * when it deletes a file, it will start a read, though
  */
 void Filesystem::write_main(void)
 {
-	int level = 1;
-	new Dir(root_dir, 1);
 	ssize_t timeout = get_global_cfg()->get_timeout();
-	stats_all.time = time(NULL);
+	uint64_t stop_bytes = get_global_cfg()->get_sweep_bytes_mb() * MEGA;
 
-	cout << "Starting test       : " << ctime(&stats_old.time);
+	size_t num_streams = get_global_cfg()->get_num_streams();
+	// a single file is written in one go
+	uint64_t chunk = num_streams > 1 ?
+			 get_global_cfg()->get_stream_chunk() : UINT64_MAX;
+	vector<OpenFile> open_files;
+	size_t next_stream = 0;
 
+	thread_register("writer", this->get_path());
 
 	while((this->error_detected == false) && (this->terminated == false)) {
+		control_wait_if_paused();
+
 		// cout << "all_dirs: " << all_dirs.size() << endl;
 		// cout << "active_dirs: " << active_dirs.size() << endl;
 
@@ -255,42 +483,85 @@ void Filesystem::write_main(void)
 			break;
 		}
 
-		// Pick a random directory
-		unsigned dir_idx = random() % active_dirs.size();
-		// cout << "Picked " << active_dirs[num]->path() << endl;
+		// Start files until --streams of them are being written
+		bool no_space = false;
+		while (open_files.size() < num_streams) {
+			// Pick a random directory
+			this->lock();
+			unsigned dir_idx = random() % active_dirs.size();
+			// cout << "Picked " << active_dirs[num]->path() << endl;
 
-		Dir* dir = active_dirs[dir_idx];
-
-		// Create file
-		File *file = new File(dir);
+			Dir* dir = active_dirs[dir_idx];
+			this->unlock();
 
-		// free some space by inDelete a file,
-		this->free_space(file->get_fsize() );
+			// Create file
+			thread_set_state(THREAD_CREATING);
+			get_rate_limits()->files.acquire(1);
+			File *file = new File(dir);
+
+			uint64_t pending = 0;
+			for (OpenFile &open : open_files)
+				pending += open.file->get_fsize() - open.ws.offset;
+
+			// free some space by inDelete a file,
+			if (!this->free_space(file->get_fsize(), pending)) {
+				// nobody knows about the empty file yet
+				this->lock();
+				dir->add_file(file);
+				delete file;
+				this->unlock();
+				no_space = true;
+				break;
+			}
 
-		file->fwrite();
+			OpenFile open;
+			open.file = file;
+			open.dir = dir;
+			open.reserved = file->get_fsize();
+			open.start_ns = now_ns();
+			thread_set_state(THREAD_WRITING, file->get_pattern());
+			{
+				CpuOp cpu(CPU_WRITE);
+				file->write_begin(open.ws);
+			}
+			open_files.push_back(open);
+		}
+		if (no_space)
+			break;
 
-		// cout << "Lock file sytem" << endl;
-		this->lock(); // LOCK FILESYSTEM
+		// a chunk per file in turn, until one of them is complete
+		size_t idx;
+		while (true) {
+			idx = next_stream++ % open_files.size();
+			OpenFile &open = open_files[idx];
+			uint64_t offset = open.ws.offset;
+
+			thread_set_state(THREAD_WRITING, open.file->get_pattern());
+			CpuOp cpu(CPU_WRITE);
+			bool done = open.file->write_chunk(open.ws, chunk);
+			cpu.bytes = open.ws.offset - offset;
+			if (done)
+				break;
+		}
 
-		dir->add_file(file);
-		this->files.push_back(file);
+		// the file after it moves up and has the next turn
+		OpenFile open = open_files[idx];
+		open_files.erase(open_files.begin() + idx);
+		next_stream = idx;
 
-		this->stats_now.write += file->get_fsize();
-		this->stats_now.num_files++;
-		this->stats_now.num_written_files++;
-		// cout << "dir->num_files: " << active_dirs[num]->fsize() << endl;
-		// cout << "files: " << files.size() << endl;
+		File *file = open.file;
+		{
+			CpuOp cpu(CPU_WRITE);
+			file->write_end(open.ws);
+		}
+		uint64_t write_ns = now_ns() - open.start_ns;
+		this->write_lat.record(write_ns);
+		this->phases.written(file->get_fsize(), write_ns);
 
-		// Remove dir from active_dirs if full
-		if (dir->get_num_files() >= dir->get_max_files())
-			this->active_dirs.erase(this->active_dirs.begin() + dir_idx);
+		// cout << "Lock file sytem" << endl;
+		this->lock(); // LOCK FILESYSTEM
 
-		if (active_dirs.size() == 0) {
-			++level;
-			cout << "Going to level " << level << endl;
-			active_dirs = all_dirs;
-			new Dir(root_dir, level);
-		};
+		this->add_written_file(file, open.dir, open.reserved);
 
 		// Output stats
 		stats_now.time = time(NULL);
@@ -299,15 +570,49 @@ void Filesystem::write_main(void)
 			double write = (stats_now.write - stats_old.write) / t / MEGA;
 			double read = (stats_now.read - stats_old.read) / t / MEGA;
 			double files = (stats_now.num_files - stats_old.num_files) / t;
+			VerifyAge age = this->get_verify_age();
+			LatencySnapshot write_lat = this->write_lat.snapshot();
+			LatencySnapshot verify_lat = this->verify_lat.snapshot();
+			LatencySnapshot write_diff = write_lat - this->write_lat_old;
+			LatencySnapshot verify_diff = verify_lat - this->verify_lat_old;
+
+			if (get_global_cfg()->get_num_targets() > 1)
+				cout << "[" << this->root_dir->path() << "] ";
 			cout << stats_now.time << " write: " << stats_now.write / GIGA
 				<< " GiB [" << write << " MiB/s] read: " << stats_now.read / GIGA
 				<< " GiB [" << read << " MiB/s] Files: " << stats_now.num_files
 				<< " [" << files << " files/s] # " << ctime(&stats_now.time)
-				<< " idx write: " << this->files.size()
-				<< " idx read: " << this->last_read_index
-				<< endl;
+				<< " files: " << this->files.size()
+				<< " unverified: " << this->num_unverified
+				<< " time since last verify [s] p50: " << age.p50
+				<< " p90: " << age.p90
+				<< " p99: " << age.p99
+				<< " max: " << age.max
+				<< " write lat [ms] p50: " << write_diff.percentile(50) / 1E6
+				<< " p99: " << write_diff.percentile(99) / 1E6
+				<< " verify lat [ms] p50: " << verify_diff.percentile(50) / 1E6
+				<< " p99: " << verify_diff.percentile(99) / 1E6
+				<< " reader lag [MiB]: " << this->pacer.get_lag() / MEGA
+				<< " read:write: "
+				<< (stats_now.write ? (double) stats_now.read / stats_now.write : 0);
+
+			// pages in the page cache when the verification began,
+			// and when its reads started after the eviction
+			if (stats_now.cache_pages > 0) {
+				double pages = stats_now.cache_pages;
+
+				cout << " cache [%] resident: "
+				     << 100 * stats_now.cache_resident / pages
+				     << " hit: "
+				     << 100 * stats_now.cache_cached / pages;
+			}
+			print_cpu_stats(cout);
+			print_stall_stats(cout);
+			cout << endl;
 
 			cout.flush();
+			this->write_lat_old = write_lat;
+			this->verify_lat_old = verify_lat;
 			this->update_stats(false);
 		}
 
@@ -315,24 +620,37 @@ void Filesystem::write_main(void)
 		ssize_t passed_time = stats_now.time - stats_all.time;
 		//cout << "Init-t: "  << stats_all.time << " now-t: " << stats_now.time
         //             << " passed-t: " << passed_time << " timeout: " << timeout << std::endl;
-		if ((timeout != -1) && (passed_time > timeout)) {
+		if ((timeout != -1) && (passed_time > timeout) && !this->terminated) {
 			cout << "Timeout reached. Now leaving!" << endl;
 			this->terminated = true;
 		}
 
+		// a --sweep point may run for a byte count instead
+		if (stop_bytes && this->pacer.get_written() >= stop_bytes &&
+		    !this->terminated) {
+			cout << "Byte count reached. Now leaving!" << endl;
+			this->terminated = true;
+		}
+
 		// cout << "UnLock file sytem" << endl;
 		this->unlock(); // UNLOCK FILESYSTEM
 
 		// Some filesystems prefer writes over reads. But we don't want
-		// to let the reads to fall too far behind. Use arbitrary limit
-		// of 20 files
-		if (!this->was_full) {
-			while (this->last_read_index + 100 < this->files.size())
-				check_terminate_and_sleep(1);
-		} else {
-			while  (this->stats_now.num_written_files > this->stats_now.num_read_files + 20)
-				check_terminate_and_sleep(1);
+		// to let the reads fall too far behind.
+		thread_set_state(THREAD_WAITING);
+		this->pacer.wait_write(this->terminated);
+	}
+
+	// the files still being written end where they are
+	for (OpenFile &open : open_files) {
+		{
+			CpuOp cpu(CPU_WRITE);
+			open.file->write_end(open.ws);
 		}
+
+		this->lock();
+		this->add_written_file(open.file, open.dir, open.reserved);
+		this->unlock();
 	}
 
 	if (this->error_detected)
@@ -346,49 +664,142 @@ void Filesystem::write_main(void)
 		}
 
 	}
+}
+
+/* Totals since the start, for the stats summed up over all targets */
+void Filesystem::get_totals(StatsStamp &total, LatencySnapshot &write_lat,
+			    LatencySnapshot &verify_lat)
+{
+	this->lock();
+	total = this->stats_all;
+	total.write += this->stats_now.write;
+	total.read += this->stats_now.read;
+	total.num_files += this->stats_now.num_files;
+	total.num_read_files += this->stats_now.num_read_files;
+	total.num_written_files += this->stats_now.num_written_files;
+	total.cache_pages += this->stats_now.cache_pages;
+	total.cache_resident += this->stats_now.cache_resident;
+	total.cache_cached += this->stats_now.cache_cached;
+	this->unlock();
 
-	pthread_exit(NULL);
+	write_lat = this->write_lat.snapshot();
+	verify_lat = this->verify_lat.snapshot();
 }
 
-/* Read from the beginning to the end, if end is reached
- * continue at the beginning
- */
-void Filesystem::read_main(void)
+FsUsage Filesystem::get_usage(void)
 {
-	unsigned long index = 0;
-start_again:
+	FsUsage usage;
+
 	this->lock();
-	// wait until the 2nd file is being written
-	while (this->files.size() < 2 && !this->error_detected) {
-		this->unlock();
-		sched_yield();
-		check_terminate_and_sleep(1);
-		goto start_again;
+	usage.size = this->fssize;
+	usage.used = this->fsused;
+	usage.goal = this->fs_use_goal;
+	usage.num_files = this->files.size();
+	usage.num_unverified = this->num_unverified;
+	usage.error = this->error_detected;
+	usage.reader_lag = this->pacer.get_lag();
+	this->unlock();
+
+	return usage;
+}
+
+string Filesystem::get_path(void) const
+{
+	return this->root_dir->path();
+}
+
+/* Return the next file to verify or NULL if there is none yet.
+ * Filesystem has to be locked
+ */
+File *Filesystem::next_to_verify(void)
+{
+	uint64_t max_write_pos = UINT64_MAX;
+
+	// As long as the filesystem is not full we want writes to be
+	// ahead of reads, due to the page cache
+	if (!this->was_full) {
+		uint64_t written = this->pacer.get_written();
+		uint64_t lag = this->pacer.get_lag();
+
+		if (written < lag)
+			return NULL;
+		max_write_pos = written - lag;
 	}
 
-#ifdef DEBUG
-	cerr << "Starting to read files" << endl;
-#endif
+	return this->scheduler.peek(max_write_pos);
+}
+
+/* Distribution of the time since the last verify over all files
+ * Filesystem has to be locked
+ */
+VerifyAge Filesystem::get_verify_age(void)
+{
+	time_t now = time(NULL);
+	vector<time_t> ages;
+	ages.reserve(this->files.size());
 
-	File *file = this->get_file_locked(index);
+	for (File *file : this->files)
+		ages.push_back(now - file->get_last_verify());
 
-	// now lock the file, still a chance of a race, until the unlink()
-	// methods also lock the filesystem first -> FIXME
-	file->lock();
-	this->unlock();
+	VerifyAge age;
+	age.compute(ages);
+	return age;
+}
+
+/* Verify files in the order given by the scheduler, the file that has
+ * gone unverified for the longest time first
+ */
+void Filesystem::read_main(void)
+{
+	bool shared_reads = get_global_cfg()->get_shared_reads();
+
+	thread_register("reader", this->get_path());
+
+	while (!this->terminated) {
+		control_wait_if_paused();
+
+		thread_set_state(THREAD_WAITING);
+		this->pacer.wait_read(this->terminated);
+
+		this->lock();
+		File *file = this->next_to_verify();
+		if (file == NULL) {
+			this->unlock();
+			this->pacer.wait_new_write(this->terminated);
+			continue;
+		}
+
+		// Taken out of the scheduler while in read, so that no other
+		// reader picks it. With --shared-reads it is queued again as
+		// just verified, other readers take it when it is the stalest
+		// file again, e.g. with fewer files than readers. Only a delete
+		// takes the file lock exclusively and the file is not in the
+		// scheduler then, so this does not block.
+		this->scheduler.remove(file);
+		if (shared_reads) {
+			file->set_last_verify(time(NULL));
+			this->scheduler.add(file);
+		}
+		file->lock_shared();
+		this->unlock();
 
-	while(true) {
-		// file is locked here
 		int fsize = file->get_fsize();
 
-		if (file->is_being_deleted() ) {
-			file->unlock();
-			goto newindex;
+		thread_set_state(THREAD_VERIFYING, file->get_pattern());
+		uint64_t start = now_ns();
+		CacheSample sample;
+		int rc;
+		{
+			CpuOp cpu(CPU_VERIFY, fsize);
+			rc = file->check(&sample);
 		}
+		uint64_t verify_ns = now_ns() - start;
+		this->verify_lat.record(verify_ns);
+		this->phases.verified(fsize, verify_ns);
 
-		if (file->check() )
+		if (rc)
 		{
-			this->error_detected = true;
+			this->set_error_detected();
 
 			if (get_global_cfg()->get_error_immediate_stop())
 			{
@@ -397,68 +808,38 @@ start_again:
 			}
 		}
 
-		if (this->terminated)
-			pthread_exit(NULL);
-
+		// Taking the filesystem lock with the file locked shared is
+		// fine, nobody waits for a file lock while holding the
+		// filesystem lock
+		this->lock();
+		// the write thread is waiting to delete it, it already took
+		// the file out of the accounting
+		if (!file->is_being_deleted()) {
+			if (!file->is_verified()) {
+				file->set_verified();
+				this->num_unverified--;
+			}
+			file->set_last_verify(time(NULL));
+			this->scheduler.remove(file);
+			this->scheduler.add(file);
+		}
 		file->unlock();
 
-		this->lock();
-		this->last_read_index = index;
 		this->stats_now.read += fsize;
 		this->stats_now.num_read_files++;
+		this->stats_now.cache_pages += sample.pages;
+		this->stats_now.cache_resident += sample.resident;
+		this->stats_now.cache_cached += sample.cached;
 		this->unlock();
 
-		// no lock here anymore
-newindex:
-		index++;
-
-		if (this->was_full == false) {
-			while (index + 20 >= this->files.size() &&
-				!this->error_detected) {
-				// we want writes to be slightly ahead of reads
-				// due to the page cache
-
-				// give it some time to write_main new data
-				check_terminate_and_sleep(1);
-				if (this->was_full) {
-					// Filesystem was full
-					cout << "Re-starting to read from index 0 (was "
-						<< index << ")" << endl;
-					index = 0;
-					break;
-				}
+		this->pacer.add_read(fsize, sample);
 
-			}
-		} else if (index >= this->files.size()) {
-			// Filesystem was full
-			cout << "Re-starting to read from index 0 (was "
-				<< index << ")" << endl;
-			index = 0;
+		JobSlot *slot = get_job_slot();
+		if (slot != NULL) {
+			slot->read += fsize;
+			slot->num_read_files++;
 		}
-
-		this->lock();
-
-		// double check, now that we have locked it
-		if (index >= this->files.size()) {
-			this->unlock();
-			index = 0;
-			goto start_again;
-		}
-
-		File *tmp;
-		tmp = this->files.at(index);
-
-		if (tmp->trylock()) {
-			this->unlock();
-			// file is busy, take next file
-			goto newindex;
-		}
-
-		this->unlock();
-		file = tmp;
 	}
-
-
 }
 
 
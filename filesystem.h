@@ -27,6 +27,10 @@
 
 #include "dir.h"
 #include "file.h"
+#include "scheduler.h"
+#include "histogram.h"
+#include "pacer.h"
+#include "phase.h"
 #include <pthread.h>
 #include <atomic>
 #include <vector>
@@ -38,8 +42,19 @@ struct StatsStamp {
 	time_t time;
 	uint64_t write, read;
 	uint64_t num_files, num_read_files, num_written_files;
+	uint64_t cache_pages, cache_resident, cache_cached; // of verified files
 };
 
+/* Fill level of a target, for the control endpoint */
+struct FsUsage {
+	uint64_t size, used, goal;
+	size_t num_files, num_unverified;
+	uint64_t reader_lag;
+	bool error;
+};
+
+struct TargetBudget;
+
 class Filesystem
 {
 private:
@@ -52,38 +67,84 @@ private:
 	size_t goal_percent;
 	size_t max_files;
 	bool was_full;
-	unsigned long last_read_index; // last index read in
+	int level; // depth of the directory tree
+
+	// with --jobs, budget of this target shared by all jobs
+	TargetBudget *budget;
+
+	// latency of writing a file and of verifying it
+	LatencyHistogram write_lat;
+	LatencyHistogram verify_lat;
+	LatencySnapshot write_lat_old; // at the last stats output
+	LatencySnapshot verify_lat_old;
+
+	VerifyScheduler scheduler; // which file the reader verifies next
+	uint64_t next_seq; // write order of the next file
+	size_t num_unverified; // files not checked by the reader yet
+	Pacer pacer; // keeps the write and read threads in balance
+	PhaseStats phases; // fill, transition and steady state
 
 	StatsStamp stats_old;
 	StatsStamp stats_now;
 	StatsStamp stats_all;
 
 	void update_stats(bool size_only);
-	void free_space(size_t fsize);
+	void insert_file(File *file);
+	void erase_file(File *file);
+	void add_written_file(File *file, Dir *dir, uint64_t reserved);
+	bool free_space(size_t fsize, uint64_t pending = 0);
+	File *next_to_verify(void);
+	VerifyAge get_verify_age(void);
 
 	std::atomic<bool> error_detected;
 	std::atomic<bool> terminated;
 
 	// protect file and directory addition/removal and stats
 	pthread_mutex_t mutex;
+
+	friend class Bench; // measures the hot paths in isolation
 public:
-	Filesystem(string dir, size_t percent);
+	Filesystem(string dir, size_t percent, size_t target_idx);
 	~Filesystem(void);
 
 	void write_main(void);
 	void read_main(void);
+	void cleanup(size_t num_threads);
 
 	// Global options
 	std::vector<Dir*> all_dirs;
 	std::vector<Dir*> active_dirs;
 	std::vector<File*> files;
-	std::vector<File*>::iterator file_iter;
 
 	void lock(void);
 	void unlock(void);
 	int  trylock(void);
 
-	void check_terminate_and_sleep(unsigned int seconds);
+	bool check_terminate_and_sleep(unsigned int seconds);
+	void set_error_detected(void);
+
+	bool is_terminated(void) const
+	{
+		return this->terminated;
+	}
+
+	/* Let the threads stop after their current operation */
+	void terminate(void)
+	{
+		this->terminated = true;
+		this->pacer.wake();
+	}
+
+	void get_totals(StatsStamp &total, LatencySnapshot &write_lat,
+			LatencySnapshot &verify_lat);
+	FsUsage get_usage(void);
+
+	PhaseStats *get_phases(void)
+	{
+		return &this->phases;
+	}
+
+	string get_path(void) const;
 
 private:
 
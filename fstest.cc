@@ -26,12 +26,33 @@
  ************************************************************************/
 #include <execinfo.h>
 #include <random>
+#include <signal.h>
 
 #include "fstest.h"
 #include "config.h"
+#include "jobs.h"
+#include "ratelimit.h"
+#include "manifest.h"
+#include "verify.h"
+#include "trace.h"
+#include "control.h"
+#include "metadata.h"
+#include "crc32c.h"
+#include "watchdog.h"
+#include "iobackend.h"
+#include "benchtarget.h"
+#include "sweep.h"
+#include "cpustats.h"
+#include "placement.h"
+
+#include <sys/utsname.h>
 
 static Config_fstest global_cfg;
 
+static int stats_interval = 60;
+
+static bool bench_keep = false; // keep the --benchmark target mounted
+
 #define BACKTRACE_MAX_SIZE 1024 * 1024
 static void* backtrace_buffer[BACKTRACE_MAX_SIZE];
 
@@ -65,7 +86,12 @@ void usage(ostream &out)
 {
 	out << endl;
 	out << cmd << " -h|--help         - show help." << endl;
-	out << cmd << " [options] <dir> - directory on filesystem to test in." << endl;
+	out << cmd << " [options] <dir>[:<percent>] [<dir>[:<percent>] ...]" << endl
+	    << "                       - directories on the filesystems to test in," << endl
+	    << "                         optionally with their own goal percentage." << endl;
+	out << cmd << " --benchmark <MiB>[:<fstype>] [options]" << endl
+	    << "                       - run a fixed-seed benchmark on a new tmpfs, or a loop" << endl
+	    << "                         mounted image made with mkfs -t <fstype> (needs root)." << endl;
 	out << endl;
 	out << "Options:\n";
 	out << " -f|--max-files <int>   - maximum number of files created [" <<
@@ -85,6 +111,103 @@ void usage(ostream &out)
 	out << "--no-check            - do not check files for correctness.\n";
 	out << "--keep-open           - keep files open after write.\n";
 	out << "--stop-when-max-files - stop when max files reached.\n";
+	out << "--read-order <order>  - order of verification: age (stalest file first),\n"
+	    << "                        inode or fiemap (batches of stale files sorted\n"
+	    << "                        by inode or physical offset, for HDD/RAID) [age].\n";
+	out << "--read-batch <int>    - files per sorted batch of the read order ["
+	    << DEFAULT_READ_BATCH << "].\n";
+	out << "--jobs <int>          - run that many fstest processes, each in its own\n"
+	    << "                        fstest.<pid> directory. They share one space\n"
+	    << "                        budget for the fill goal, stats are summed up\n"
+	    << "                        and the exit code is non-zero if any job failed.\n";
+	out << "--writers <int>       - number of write threads, distributed over the\n"
+	    << "                        target dirs [one per target].\n";
+	out << "--readers <int>       - number of read (verify) threads per target [1].\n";
+	out << "--shared-reads        - a file being verified may be picked by another\n"
+	    << "                        reader, once it is the stalest file again.\n";
+	out << "--write-rate <MiB/s>  - limit the write bandwidth of the process [unlimited].\n";
+	out << "--read-rate <MiB/s>   - limit the read bandwidth of the process [unlimited].\n";
+	out << "--file-rate <files/s> - limit file creates plus unlinks [unlimited].\n";
+	out << "--rate-schedule <file> - rates by time of day, lines of\n"
+	    << "                        \"HH:MM <write MiB/s> <read MiB/s> <files/s>\",\n"
+	    << "                        0 is unlimited.\n";
+	out << "--verify-threads <int> - threads verifying one large file in parallel,\n"
+	    << "                        each one an offset range with pread() [1].\n";
+	out << "--parallel-verify-bits <int> - only files of at least 2^n bytes are\n"
+	    << "                        verified in parallel [" << DEFAULT_PARALLEL_VERIFY_BITS << "].\n";
+	out << "--manifest <file>     - log created, synced and deleted files to an\n"
+	    << "                        append-only manifest (<file>.<pid> with --jobs).\n";
+	out << "--verify-manifest <file> - verify the files of a manifest, e.g. after a\n"
+	    << "                        crash, and exit. Synced files must be intact.\n";
+	out << "--verify-only <dir>   - verify all files below dir, e.g. a fstest.<pid>\n"
+	    << "                        directory left over by an earlier run, and exit.\n"
+	    << "                        The pattern is taken from the file name.\n";
+	out << "--scan-threads <int>  - threads reading directories and verifying files\n"
+	    << "                        of --verify-only and --verify-manifest [one per CPU].\n";
+	out << "--trace-prefix <path> - the operations of each thread are traced into a\n"
+	    << "                        ring buffer, dumped to <path>.<pid>.<n> on\n"
+	    << "                        corruption or SIGUSR1 [fstest-trace].\n";
+	out << "--decode-trace <file> - print a trace dump as text and exit.\n";
+	out << "--meta-threads <int>  - metadata workload threads per target, each one\n"
+	    << "                        creating, renaming, linking, ... small files in\n"
+	    << "                        its own directories, checked against a model [0].\n";
+	out << "--meta-only           - only run the metadata workload.\n";
+	out << "--meta-files <int>    - names per metadata thread [" << DEFAULT_META_FILES << "].\n";
+	out << "--meta-mix <mix>      - weights of the metadata operations\n"
+	    << "                        [" << DEFAULT_META_MIX << "].\n";
+	out << "--read-write-ratio <float> - bytes verified per byte written, the\n"
+	    << "                        faster side waits for the other one, 0 to\n"
+	    << "                        disable [" << DEFAULT_READ_WRITE_RATIO << "].\n";
+	out << "--stall-threshold <seconds> - report operations (open, write, fsync,\n"
+	    << "                        unlink, ...) running longer, 0 to disable\n"
+	    << "                        [" << DEFAULT_STALL_THRESHOLD << "].\n";
+	out << "--stall-stacks        - also print the kernel stack of a stalled thread.\n";
+	out << "--io-backend <name>   - posix, or mem for a filesystem in memory, e.g. to\n"
+	    << "                        measure the overhead of fstest itself [posix].\n";
+	out << "--mem-size <MiB>      - capacity of the mem backend [" << DEFAULT_MEM_SIZE_MB << "].\n";
+	out << "--inject-faults <spec> - inject faults into writes and reads, with rates\n"
+	    << "                        per call, e.g. bitflip=0.001,drop=0.001,\n"
+	    << "                        misdirect=0.001,stale=0.001, and report the\n"
+	    << "                        time to detect them and how many were missed.\n";
+	out << "--bench-mount-opts <opts> - mount options of the --benchmark target.\n";
+	out << "--bench-csv <file>    - append the --benchmark summary to a CSV file.\n";
+	out << "--io-size <KiB>       - largest write and read call, a power of 2 from\n"
+	    << "                        " << MIN_IO_SIZE_KB << " to " << DEFAULT_IO_SIZE_KB
+	    << " [" << DEFAULT_IO_SIZE_KB << "].\n";
+	out << "--streams <n>[:<KiB>] - files each write thread keeps open and writes\n"
+	    << "                        round robin, KiB per file and turn\n"
+	    << "                        [1, --io-size].\n";
+	out << "--sync <policy>       - fdatasync, fsync or none after writing a file\n"
+	    << "                        [fdatasync, fsync with --checksum].\n";
+	out << "--sweep <spec>        - run the test once per combination of parameter\n"
+	    << "                        values, e.g. threads=1-16:io-size=64,1024:\n"
+	    << "                        file-bits=20,24:qd=1,4:sync=fdatasync,direct\n"
+	    << "                        (qd: read threads), each for --timeout seconds\n"
+	    << "                        [" << DEFAULT_SWEEP_POINT_TIME << "] or --sweep-bytes.\n";
+	out << "--sweep-bytes <MiB>   - run each sweep point until this much was written.\n";
+	out << "--sweep-out <file>    - write the sweep matrix as CSV, or JSON for *.json.\n";
+	out << "--cpu-stats <mode>    - account the CPU time of writing, verifying and\n"
+	    << "                        deleting: off, rusage (getrusage()) or perf\n"
+	    << "                        (also perf counters, where permitted) [perf].\n";
+	out << "--cpus <spec>         - CPUs of the threads, a list like 0-3,8 for all\n"
+	    << "                        or per role: writer=0-3:reader=4-7:helper=8-15\n"
+	    << "                        (verify ranges, cleanup and meta threads).\n";
+	out << "--numa <spec>         - memory node of the threads and their I/O\n"
+	    << "                        buffers, like --cpus: 0 or writer=0:reader=1.\n"
+	    << "                        Also the CPUs of roles without --cpus.\n";
+	out << "--seed <int>          - seed of the random file sizes, names and choices\n"
+	    << "                        [1 with --benchmark, otherwise fixed by libc].\n";
+	out << "--evict <mode>        - get files out of the page cache before they are\n"
+	    << "                        verified: none, direct (O_DIRECT reads),\n"
+	    << "                        drop-caches (needs root) or balloon [none].\n";
+	out << "--checksum            - store a CRC32C of each file in the " CSUM_XATTR "\n"
+	    << "                        xattr while writing it and check it on verify.\n";
+	out << "--keep-data           - do not delete the test files at the end.\n";
+	out << "--cleanup-threads <int> - threads deleting the test files at the end\n"
+	    << "                        [one per CPU].\n";
+	out << "--control <socket>    - serve metrics (Prometheus text format) and accept\n"
+	    << "                        pause, resume, rate, dump-trace and stop commands\n"
+	    << "                        on a Unix socket (<socket>.<pid> with --jobs).\n";
 	out << endl;
 
 }
@@ -93,59 +216,343 @@ void usage(ostream &out)
 void *run_write_thread(void *arg)
 {
 	Filesystem* t =  (Filesystem *) arg;
+	get_placement()->apply(ROLE_WRITER);
 	t->write_main();
 	return NULL;
 }
 
+/* Start a thread of the metadata workload here */
+void *run_meta_thread(void *arg)
+{
+	MetaWorkload *meta = (MetaWorkload *) arg;
+	get_placement()->apply(ROLE_HELPER);
+	meta->run();
+	return NULL;
+}
+
 /* Start the write_main thread here */
 void *run_read_thread(void *arg)
 {
 	Filesystem* t =  (Filesystem *) arg;
+	get_placement()->apply(ROLE_READER);
 	t->read_main();
 	return NULL;
 }
 
 
+static vector<Filesystem *> filesystems;
+
+/**
+ * Return the filesystems (targets) under test
+ */
+vector<Filesystem *> &get_filesystems(void)
+{
+	return filesystems;
+}
+
+static std::atomic<bool> stopping {false};
+static volatile sig_atomic_t stop_signal = 0;
+
+/**
+ * Stop the test: the threads finish their current operation, interrupted
+ * writes end the file where they are, then the test tree is cleaned up
+ */
+void request_stop(void)
+{
+	stopping = true;
+	for (Filesystem *fs : filesystems)
+		fs->terminate();
+}
+
+bool is_stopping(void)
+{
+	return stopping;
+}
+
+static void stop_signal_handler(int sig)
+{
+	static int64_t first_ns;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+
+	// the same signal again, e.g. a second Ctrl-C, stops immediately.
+	// Not within a second of the first one, timeout(1) signals the
+	// process and then its process group.
+	if (stop_signal == sig) {
+		if (ns - first_ns < 1000000000LL)
+			return;
+
+		signal(sig, SIG_DFL);
+		raise(sig);
+		return;
+	}
+
+	first_ns = ns;
+	stop_signal = sig;
+}
+
+/* SIGINT and SIGTERM stop gracefully, the monitoring loop handles them */
+void install_stop_signals(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_signal_handler;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+int get_stop_signal(void)
+{
+	return stop_signal;
+}
+
+/* Print the stats summed up over all targets */
+static void print_total_stats(StatsStamp &old, LatencySnapshot &write_old,
+			      LatencySnapshot &verify_old)
+{
+	StatsStamp now;
+	LatencySnapshot write_now, verify_now;
+
+	memset(&now, 0, sizeof(now));
+	for (Filesystem *fs : filesystems) {
+		StatsStamp total;
+		LatencySnapshot write_lat, verify_lat;
+
+		fs->get_totals(total, write_lat, verify_lat);
+		now.write += total.write;
+		now.read += total.read;
+		now.num_written_files += total.num_written_files;
+		now.num_read_files += total.num_read_files;
+		write_now.add(write_lat);
+		verify_now.add(verify_lat);
+	}
+	now.time = time(NULL);
+
+	double t = max(now.time - old.time, (time_t) 1);
+	LatencySnapshot write_diff = write_now - write_old;
+	LatencySnapshot verify_diff = verify_now - verify_old;
+
+	cout << "[all targets] " << now.time
+		<< " write: " << now.write / GIGA << " GiB ["
+		<< (now.write - old.write) / t / MEGA << " MiB/s] read: "
+		<< now.read / GIGA << " GiB ["
+		<< (now.read - old.read) / t / MEGA << " MiB/s] Files: "
+		<< now.num_written_files << " ["
+		<< (now.num_written_files - old.num_written_files) / t
+		<< " files/s]"
+		<< " write lat [ms] p50: " << write_diff.percentile(50) / 1E6
+		<< " p99: " << write_diff.percentile(99) / 1E6
+		<< " verify lat [ms] p50: " << verify_diff.percentile(50) / 1E6
+		<< " p99: " << verify_diff.percentile(99) / 1E6;
+	print_cpu_stats(cout);
+	print_stall_stats(cout);
+	cout << endl;
+	cout.flush();
+
+	old = now;
+	write_old = write_now;
+	verify_old = verify_now;
+}
+
+/* Summary of --benchmark per phase, on stdout and into the CSV file */
+static void print_benchmark(Filesystem *fs)
+{
+	BenchTarget *target = get_bench_target();
+	PhaseStats *phases = fs->get_phases();
+
+	cout << endl << "Benchmark: " << target->describe() << endl;
+	cout << "Placement: " << get_placement()->describe() << endl;
+	phases->report(cout);
+	cout << endl;
+
+	bench_keep = fs->get_usage().error || global_cfg.get_keep_data();
+
+	string csv = global_cfg.get_bench_csv();
+	if (csv.empty())
+		return;
+
+	struct utsname uts;
+	string kernel = uname(&uts) ? "unknown" : uts.release;
+
+	// mount options have commas
+	ostringstream label;
+	label << kernel << ",\"" << target->describe() << "\","
+	      << global_cfg.get_seed();
+	phases->write_csv(csv, label.str());
+}
+
+/* --cpus and --numa, the threads place themselves when they start */
+static void setup_placement(void)
+{
+	Placement *placement = get_placement();
+
+	placement->parse_cpus(global_cfg.get_cpus_spec());
+	placement->parse_numa(global_cfg.get_numa_spec());
+	if (placement->setup())
+		EXIT(1);
+	placement->report(cout);
+}
+
 void start_threads(void)
 {
-	string dir = global_cfg.get_testdir();
-	size_t goal_percent = global_cfg.get_usage();
+	size_t num_targets = global_cfg.get_num_targets();
+	size_t num_writers = global_cfg.get_num_writers();
+	size_t num_readers = global_cfg.get_num_readers();
+
+	// every job logs into its own manifest
+	string manifest_path = global_cfg.get_manifest_path();
+	if (!manifest_path.empty()) {
+		if (global_cfg.get_num_jobs() > 0)
+			manifest_path += "." + to_string(getpid());
+		if (get_manifest()->open(manifest_path))
+			EXIT(1);
+	}
+
+	setup_placement();
+
+	for (size_t i = 0; i < num_targets; i++) {
+		string dir = global_cfg.get_testdir(i);
+		size_t goal_percent = global_cfg.get_target_usage(i);
+
+		cout << "Target              : " << dir << endl;
+		filesystems.push_back(new Filesystem(dir, goal_percent, i));
+	}
+
+	// at least one write thread per target, the others round robin
+	num_writers = max(num_writers, num_targets);
+	if (global_cfg.get_meta_only()) {
+		num_writers = 0;
+		num_readers = 0;
+	}
+
+	size_t num_meta = global_cfg.get_meta_threads();
+	vector<MetaWorkload *> metas;
+	for (size_t i = 0; num_meta > 0 && i < num_targets; i++)
+		metas.push_back(new MetaWorkload(filesystems[i]));
+
+	get_rate_limits()->update_schedule();
+	trace_install_signal();
+	install_stop_signals();
+
+	string control_path = global_cfg.get_control_path();
+	if (!control_path.empty()) {
+		if (global_cfg.get_num_jobs() > 0)
+			control_path += "." + to_string(getpid());
+		if (get_control_server()->start(control_path))
+			EXIT(1);
+	}
 
-	Filesystem * filesystem = new Filesystem(dir, goal_percent);
+	if (get_watchdog()->start(global_cfg.get_stall_threshold(),
+				  global_cfg.get_stall_stacks()))
+		EXIT(1);
 
 	int rc;
-	pthread_t threads[2];
+	size_t num_data_threads = num_writers + num_targets * num_readers;
+	size_t num_threads = num_data_threads + num_targets * num_meta;
+	vector<pthread_t> threads(num_threads);
+	vector<bool> finished(num_threads, false);
 	// struct pthread_arg tinfo[2];
 
 
 	// FIXME: We need a pthread wrapper class, our current way is ugly
 
-	int i = 0;
-	rc = pthread_create(&threads[i], NULL, run_write_thread, filesystem);
-	if (rc) {
-		cerr << "Failed to start thread " << i << ": "
-			<< strerror(rc) << endl;
-		EXIT(1);
+	size_t i;
+	for (i = 0; i < num_threads; i++) {
+		if (i >= num_data_threads) {
+			rc = pthread_create(&threads[i], NULL, run_meta_thread,
+					    metas[(i - num_data_threads) / num_meta]);
+		} else {
+			bool writer = i < num_writers;
+			Filesystem *filesystem = writer ?
+				filesystems[i % num_targets] :
+				filesystems[(i - num_writers) / num_readers];
+
+			rc = pthread_create(&threads[i], NULL,
+					    writer ? run_write_thread :
+						     run_read_thread,
+					    filesystem);
+		}
+		if (rc) {
+			cerr << "Failed to start thread " << i << ": "
+				<< strerror(rc) << endl;
+			EXIT(1);
+		}
 	}
 
-	i = 1;
-	rc = pthread_create(&threads[i], NULL, run_read_thread, filesystem);
-	if (rc) {
-		cerr << "Failed to start thread " << i << ": "
-			<< strerror(rc) << endl;
-		EXIT(1);
+	StatsStamp old;
+	LatencySnapshot write_old, verify_old;
+	memset(&old, 0, sizeof(old));
+	old.time = time(NULL);
+
+	size_t num_finished = 0;
+	while (num_finished < num_threads) {
+		for (i = 0; i < num_threads; i++) {
+			if (finished[i] || pthread_tryjoin_np(threads[i], NULL))
+				continue;
+
+			finished[i] = true;
+			num_finished++;
+			cout << "Thread " << i << " finished" << endl;
+		}
+
+		if (num_targets > 1 && time(NULL) - old.time > stats_interval)
+			print_total_stats(old, write_old, verify_old);
+
+		get_rate_limits()->update_schedule();
+		if (trace_dump_requested())
+			trace_dump("signal");
+
+		if (stop_signal && !is_stopping()) {
+			cout << "Signal " << stop_signal
+			     << " received, stopping" << endl;
+			request_stop();
+		}
+
+		if (num_finished < num_threads)
+			sleep(1);
+	}
+
+	if (num_targets > 1)
+		print_total_stats(old, write_old, verify_old);
+
+	for (Filesystem *fs : filesystems) {
+		fs->get_phases()->finish();
+		sweep_record(fs->get_phases(), fs->get_usage().error);
+	}
+
+	if (global_cfg.get_bench_size_mb() > 0) {
+		for (Filesystem *fs : filesystems)
+			print_benchmark(fs);
 	}
 
-	for (i = 0; i < 2; i++) {
-		pthread_join(threads[i], NULL);
-		cout << "Thread " << i << " finished" << endl;
+	get_control_server()->shutdown();
+
+	for (MetaWorkload *meta : metas)
+		delete meta;
+
+	for (Filesystem *fs : filesystems) {
+		fs->cleanup(global_cfg.get_cleanup_threads());
+		delete fs;
 	}
+	filesystems.clear();
+
+	get_watchdog()->shutdown();
+	cpu_stats_report(cout);
+	get_io_backend()->report(cout);
 }
 
+// the benchmark binary has its own main()
+#ifndef FSTEST_BENCH
 int main(int argc, char * const argv[])
 {
 	int res;
 	struct stat statbuf;
+	string verify_manifest;
+	string verify_only;
 
 	cmd = argv[0];
 
@@ -164,13 +571,56 @@ int main(int argc, char * const argv[])
 		{ "no-check" ,  0, NULL, 'n'},
 		{ "keep-open" ,  0, NULL, 'k'},
 		{ "stop-when-max-files" ,  0, NULL, 's'},
+		{ "read-order",  1, NULL,  4  },
+		{ "read-batch",  1, NULL,  5  },
+		{ "verify-threads", 1, NULL, 6 },
+		{ "parallel-verify-bits", 1, NULL, 7 },
+		{ "readers",    1, NULL,  8  },
+		{ "jobs",       1, NULL,  9  },
+		{ "writers",    1, NULL, 10  },
+		{ "write-rate", 1, NULL, 11  },
+		{ "read-rate",  1, NULL, 12  },
+		{ "file-rate",  1, NULL, 13  },
+		{ "rate-schedule", 1, NULL, 14 },
+		{ "manifest",   1, NULL, 15  },
+		{ "verify-manifest", 1, NULL, 16 },
+		{ "scan-threads", 1, NULL, 17 },
+		{ "verify-only", 1, NULL, 18  },
+		{ "trace-prefix", 1, NULL, 19 },
+		{ "decode-trace", 1, NULL, 20 },
+		{ "control",    1, NULL, 21  },
+		{ "keep-data",  0, NULL, 22  },
+		{ "cleanup-threads", 1, NULL, 23 },
+		{ "meta-threads", 1, NULL, 24 },
+		{ "meta-only",  0, NULL, 25  },
+		{ "meta-files", 1, NULL, 26  },
+		{ "meta-mix",   1, NULL, 27  },
+		{ "checksum",   0, NULL, 28  },
+		{ "evict",      1, NULL, 29  },
+		{ "read-write-ratio", 1, NULL, 30 },
+		{ "stall-threshold", 1, NULL, 31 },
+		{ "stall-stacks", 0, NULL, 32 },
+		{ "io-backend", 1, NULL, 33  },
+		{ "mem-size",   1, NULL, 34  },
+		{ "inject-faults", 1, NULL, 35 },
+		{ "benchmark",  1, NULL, 36  },
+		{ "bench-mount-opts", 1, NULL, 37 },
+		{ "bench-csv",  1, NULL, 38  },
+		{ "seed",       1, NULL, 39  },
+		{ "io-size",    1, NULL, 40  },
+		{ "sync",       1, NULL, 41  },
+		{ "sweep",      1, NULL, 42  },
+		{ "sweep-bytes", 1, NULL, 43 },
+		{ "sweep-out",  1, NULL, 44  },
+		{ "cpu-stats",  1, NULL, 45  },
+		{ "cpus",       1, NULL, 46  },
+		{ "numa",       1, NULL, 47  },
+		{ "streams",    1, NULL, 48  },
+		{ "shared-reads", 0, NULL, 49 },
 		{ NULL       ,  0, NULL,  0  }
 	};
 	int longindex = 0;
 
-	// Arguments
-	string testdir = "";
-
 	while((res = getopt_long(argc, argv, optstring, longopts, &longindex)) != -1) {
 		switch(res) {
 		case 'h':
@@ -213,6 +663,193 @@ int main(int argc, char * const argv[])
 		case 3:
 			global_cfg.set_error_immediate_stop();
 			break;
+		case 4:
+			if (global_cfg.set_read_order(optarg)) {
+				cerr << "Error: invalid read order '" << optarg << "'\n";
+				usage(cerr);
+				exit(1);
+			}
+			break;
+		case 5:
+			global_cfg.set_read_batch(atoi(optarg));
+			break;
+		case 6:
+			global_cfg.set_verify_threads(max(atoi(optarg), 1));
+			break;
+		case 7:
+			global_cfg.set_parallel_verify_bits(atoi(optarg));
+			break;
+		case 8:
+			global_cfg.set_num_readers(max(atoi(optarg), 1));
+			break;
+		case 9:
+			global_cfg.set_num_jobs(atoi(optarg));
+			break;
+		case 10:
+			global_cfg.set_num_writers(atoi(optarg));
+			break;
+		case 11:
+			get_rate_limits()->write.set_rate(atof(optarg) * MEGA);
+			break;
+		case 12:
+			get_rate_limits()->read.set_rate(atof(optarg) * MEGA);
+			break;
+		case 13:
+			get_rate_limits()->files.set_rate(atof(optarg));
+			break;
+		case 14:
+			if (get_rate_limits()->load_schedule(optarg))
+				exit(1);
+			break;
+		case 15:
+			global_cfg.set_manifest_path(optarg);
+			break;
+		case 16:
+			verify_manifest = optarg;
+			break;
+		case 17:
+			global_cfg.set_scan_threads(atoi(optarg));
+			break;
+		case 18:
+			verify_only = optarg;
+			break;
+		case 19:
+			trace_set_prefix(optarg);
+			break;
+		case 20:
+			exit(trace_decode(optarg));
+			break;
+		case 21:
+			global_cfg.set_control_path(optarg);
+			break;
+		case 22:
+			global_cfg.set_keep_data();
+			break;
+		case 23:
+			global_cfg.set_cleanup_threads(atoi(optarg));
+			break;
+		case 24:
+			global_cfg.set_meta_threads(atoi(optarg));
+			break;
+		case 25:
+			global_cfg.set_meta_only();
+			break;
+		case 26:
+			global_cfg.set_meta_files(max(atoi(optarg), 1));
+			break;
+		case 27:
+			if (global_cfg.set_meta_mix(optarg)) {
+				cerr << "Error: invalid metadata mix '" << optarg << "'\n";
+				usage(cerr);
+				exit(1);
+			}
+			break;
+		case 28:
+			global_cfg.set_checksum();
+			break;
+		case 29:
+			if (global_cfg.set_evict_mode(optarg)) {
+				cerr << "Error: invalid evict mode '" << optarg << "'\n";
+				usage(cerr);
+				exit(1);
+			}
+			break;
+		case 30:
+			global_cfg.set_read_write_ratio(max(atof(optarg), 0.0));
+			break;
+		case 31:
+			global_cfg.set_stall_threshold(max(atof(optarg), 0.0));
+			break;
+		case 32:
+			global_cfg.set_stall_stacks();
+			break;
+		case 33:
+			if (global_cfg.set_io_backend(optarg)) {
+				cerr << "Error: invalid I/O backend '" << optarg << "'\n";
+				usage(cerr);
+				exit(1);
+			}
+			break;
+		case 34:
+			global_cfg.set_mem_size_mb(max(atoi(optarg), 1));
+			break;
+		case 35:
+			if (global_cfg.set_fault_spec(optarg)) {
+				cerr << "Error: invalid fault spec '" << optarg << "'\n";
+				usage(cerr);
+				exit(1);
+			}
+			break;
+		case 36:
+			if (global_cfg.set_benchmark(optarg)) {
+				cerr << "Error: invalid benchmark target '" << optarg << "'\n";
+				usage(cerr);
+				exit(1);
+			}
+			break;
+		case 37:
+			global_cfg.set_bench_mount_opts(optarg);
+			break;
+		case 38:
+			global_cfg.set_bench_csv(optarg);
+			break;
+		case 39:
+			global_cfg.set_seed(strtoul(optarg, NULL, 0));
+			break;
+		case 40:
+			if (global_cfg.set_io_size_kb(atoi(optarg))) {
+				cerr << "Error: invalid I/O size '" << optarg << "'\n";
+				usage(cerr);
+				exit(1);
+			}
+			break;
+		case 41:
+			if (global_cfg.set_sync_policy(optarg)) {
+				cerr << "Error: invalid sync policy '" << optarg << "'\n";
+				usage(cerr);
+				exit(1);
+			}
+			break;
+		case 42:
+			global_cfg.set_sweep_spec(optarg);
+			break;
+		case 43:
+			global_cfg.set_sweep_bytes_mb(max(atoi(optarg), 1));
+			break;
+		case 44:
+			global_cfg.set_sweep_out(optarg);
+			break;
+		case 45:
+			if (global_cfg.set_cpu_stats_mode(optarg)) {
+				cerr << "Error: invalid CPU stats mode '" << optarg << "'\n";
+				usage(cerr);
+				exit(1);
+			}
+			break;
+		case 46:
+			if (global_cfg.set_cpus_spec(optarg)) {
+				cerr << "Error: invalid CPU placement '" << optarg << "'\n";
+				usage(cerr);
+				exit(1);
+			}
+			break;
+		case 47:
+			if (global_cfg.set_numa_spec(optarg)) {
+				cerr << "Error: invalid NUMA placement '" << optarg << "'\n";
+				usage(cerr);
+				exit(1);
+			}
+			break;
+		case 48:
+			if (global_cfg.set_streams(optarg)) {
+				cerr << "Error: invalid streams '" << optarg << "'\n";
+				usage(cerr);
+				exit(1);
+			}
+			break;
+		case 49:
+			global_cfg.set_shared_reads();
+			break;
 		default:
 			fprintf (stderr, "Error: unknown option '%c'\n", res);
 			usage(cerr);
@@ -220,35 +857,143 @@ int main(int argc, char * const argv[])
 		}
 	}
 
-	// Get optional arg <testdir> and add trailing '/'
-	if (optind < argc) {
-		testdir = argv[optind++];
+	if (!verify_manifest.empty())
+		RETURN(Manifest::verify(verify_manifest,
+					global_cfg.get_scan_threads()));
+
+	if (!verify_only.empty()) {
+		setup_placement();
+		RETURN(verify_tree(verify_only,
+				   global_cfg.get_scan_threads()));
+	}
+
+	bool benchmark = global_cfg.get_bench_size_mb() > 0;
+	if (benchmark) {
+		if (optind < argc) {
+			cerr << "Error: --benchmark creates its own target, "
+			     << "no test directory please\n";
+			exit(1);
+		}
+
+		if (global_cfg.get_io_backend() != "posix" ||
+		    global_cfg.get_num_jobs() > 0 || global_cfg.get_meta_only()) {
+			cerr << "Error: --benchmark does not work with "
+			     << "--io-backend, --jobs or --meta-only\n";
+			exit(1);
+		}
+
+		if (geteuid() != 0) {
+			cerr << "Error: --benchmark needs root to mount its target\n";
+			exit(1);
+		}
+
+		// the same workload for every run
+		if (!global_cfg.get_has_seed())
+			global_cfg.set_seed(1);
+		if (global_cfg.get_timeout() < 0 &&
+		    global_cfg.get_sweep_spec().empty())
+			global_cfg.set_timeout(DEFAULT_BENCH_TIMEOUT);
 	}
 
-	if (optind < argc) {
-		int i;
-		cerr << "Error: extra args:";
-		for(i = optind; i < argc; ++i) {
-			cerr << " '" << argv[i] << "'";
+	Sweep sweep;
+	bool sweeping = !global_cfg.get_sweep_spec().empty();
+	if (sweeping) {
+		if (sweep.parse(global_cfg.get_sweep_spec())) {
+			cerr << "Error: invalid sweep '"
+			     << global_cfg.get_sweep_spec() << "'\n";
+			usage(cerr);
+			exit(1);
+		}
+
+		if (global_cfg.get_num_jobs() > 0 || global_cfg.get_meta_only()) {
+			cerr << "Error: --sweep does not work with --jobs or "
+			     << "--meta-only\n";
+			exit(1);
 		}
-		cerr << endl;
-		usage(cerr);
+
+		// the same workload for every point
+		if (!global_cfg.get_has_seed())
+			global_cfg.set_seed(1);
+		if (global_cfg.get_timeout() < 0 &&
+		    global_cfg.get_sweep_bytes_mb() == 0)
+			global_cfg.set_timeout(DEFAULT_SWEEP_POINT_TIME);
+	}
+
+	if (global_cfg.get_read_order() != READ_ORDER_AGE &&
+	    global_cfg.get_read_batch() == 0) {
+		cerr << "Error: --read-order inode and fiemap need a --read-batch\n";
+		exit(1);
+	}
+
+	if ((global_cfg.get_sync_policy() == SYNC_NONE ||
+	     sweep.has_value(SWEEP_SYNC, "none")) &&
+	    !global_cfg.get_manifest_path().empty()) {
+		cerr << "Error: --manifest needs the files to be synced\n";
 		exit(1);
 	}
 
-	// Check that testdir exists and is a directory
-	if (testdir.length() == 0) {
+	if (global_cfg.get_has_seed())
+		srandom(global_cfg.get_seed());
+
+	// Remaining args are the target dirs, optionally with a fill goal
+	if (optind >= argc && !benchmark) {
 		cerr << "Error: " << "please specify test directory\n";
 		exit(1);
 	}
 
-	if (stat(testdir.c_str(), &statbuf) != 0) {
-		perror(testdir.c_str());
+	for (; optind < argc; optind++) {
+		string testdir = argv[optind];
+		size_t percent = 0;
+
+		size_t colon = testdir.rfind(':');
+		if (colon != string::npos && colon + 1 < testdir.length() &&
+		    testdir.find_first_not_of("0123456789", colon + 1) == string::npos) {
+			percent = atoi(testdir.c_str() + colon + 1);
+			testdir.erase(colon);
+		}
+
+		// the memory backend creates it
+		if (global_cfg.get_io_backend() == "posix") {
+			if (stat(testdir.c_str(), &statbuf) != 0) {
+				perror(testdir.c_str());
+				exit(1);
+			}
+
+			if (!S_ISDIR(statbuf.st_mode)) {
+				cerr << "Error: " << testdir << " is not a directory\n";
+				exit(1);
+			}
+		}
+
+		global_cfg.add_target(testdir, percent);
+	}
+
+	// the rest still works on the real filesystem
+	if (global_cfg.get_io_backend() == "mem" &&
+	    (global_cfg.get_num_jobs() > 0 || global_cfg.get_meta_threads() > 0 ||
+	     global_cfg.get_meta_only() ||
+	     global_cfg.get_evict_mode() != EVICT_NONE)) {
+		cerr << "Error: --io-backend mem does not work with --jobs, the "
+		     << "metadata workload or --evict\n";
+		exit(1);
+	}
+	if (sweeping && global_cfg.get_num_targets() > 1) {
+		cerr << "Error: --sweep takes a single target\n";
+		exit(1);
+	}
+
+	if (set_io_backend(global_cfg.get_io_backend(),
+			   (uint64_t) global_cfg.get_mem_size_mb() * MEGA,
+			   global_cfg.get_fault_spec())) {
+		cerr << "Error: setting up the I/O backend failed\n";
 		exit(1);
 	}
 
-	if (!S_ISDIR(statbuf.st_mode)) {
-		cerr << "Error: " << testdir << " is not a directory\n";
+	if (global_cfg.get_meta_only() && global_cfg.get_meta_threads() == 0)
+		global_cfg.set_meta_threads(1);
+
+	if (global_cfg.get_evict_mode() == EVICT_DROP_CACHES && geteuid() != 0) {
+		cerr << "Error: --evict drop-caches needs root\n";
 		exit(1);
 	}
 
@@ -260,14 +1005,71 @@ int main(int argc, char * const argv[])
 		exit(1);
 	}
 
+	// after all checks, an exit() would leave the mount behind
+	BenchTarget *bench_target = get_bench_target();
+	if (benchmark) {
+		if (bench_target->create(global_cfg.get_bench_size_mb() * MEGA,
+					 global_cfg.get_bench_fstype(),
+					 global_cfg.get_bench_mount_opts()))
+			exit(1);
+		global_cfg.add_target(bench_target->get_dir(), 0);
+	}
+
+	if (!global_cfg.get_manifest_path().empty()) {
+		for (size_t i = 0; i < global_cfg.get_num_targets(); i++) {
+			if (Manifest::check_path_len(global_cfg.get_target_dir(i),
+						     global_cfg.get_max_files())) {
+				bench_target->destroy(false);
+				exit(1);
+			}
+		}
+	}
 
-	global_cfg.set_testdir(testdir);
+	// the mem backend has xattrs, other file systems might not
+	if (global_cfg.get_checksum() && global_cfg.get_io_backend() == "posix") {
+		for (size_t i = 0; i < global_cfg.get_num_targets(); i++) {
+			if (File::probe_csum(global_cfg.get_target_dir(i))) {
+				bench_target->destroy(false);
+				exit(1);
+			}
+		}
+	}
 
 	cout << "fstest v0.1\n";
-	cout << "Directory           : " << testdir << endl;
+	if (global_cfg.get_io_backend() != "posix")
+		cout << "I/O backend         : " << get_io_backend()->name()
+		     << " (" << global_cfg.get_mem_size_mb() << " MiB)" << endl;
+	if (!global_cfg.get_fault_spec().empty())
+		cout << "Fault injection     : " << global_cfg.get_fault_spec()
+		     << endl;
+	if (benchmark)
+		cout << "Benchmark target    : " << bench_target->describe()
+		     << ", seed " << global_cfg.get_seed() << ", "
+		     << global_cfg.get_timeout() << " s" << endl;
+	if (global_cfg.get_checksum())
+		cout << "Checksum            : crc32c (" << crc32c_impl() << ")"
+		     << endl;
+	for (size_t i = 0; i < global_cfg.get_num_targets(); i++)
+		cout << "Directory           : "
+		     << global_cfg.get_target_dir(i) << endl;
+
+	if (global_cfg.get_num_jobs() > 0) {
+		res = run_jobs(global_cfg.get_num_jobs());
+		cout << "Done.\n";
+		RETURN(res);
+	}
+
+	if (sweeping) {
+		res = sweep.run();
+		bench_target->destroy(false);
+		cout << "Done.\n";
+		RETURN(res);
+	}
 
 	start_threads();
+	bench_target->destroy(bench_keep);
 
 	cout << "Done.\n";
 	RETURN(0);
 }
+#endif // FSTEST_BENCH
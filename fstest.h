@@ -58,6 +58,12 @@ using namespace std;
 #define QL_FSTEST_DEFAULT_NUM_FILES 1000
 
 extern int do_exit(const char* func, const char *file, unsigned line, int code);
+extern void start_threads(void);
+extern std::vector<Filesystem *> &get_filesystems(void);
+extern void request_stop(void);
+extern bool is_stopping(void);
+extern void install_stop_signals(void);
+extern int get_stop_signal(void);
 
 #if DEBUG > 2
 static inline void print_return(const char* func, const char *file, unsigned line, int value=0)
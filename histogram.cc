@@ -0,0 +1,133 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include "histogram.h"
+
+using namespace std;
+
+LatencyHistogram::LatencyHistogram(void)
+{
+	for (int i = 0; i < NUM_BUCKETS; i++)
+		this->buckets[i] = 0;
+	this->sum_ns = 0;
+}
+
+/* The first 2^SUB_BITS values get a bucket each, then every power of two
+ * is split into 2^SUB_BITS buckets.
+ */
+int LatencyHistogram::bucket_index(uint64_t ns)
+{
+	const uint64_t sub = 1ULL << SUB_BITS;
+
+	if (ns < sub)
+		return ns;
+
+	int msb = 63 - __builtin_clzll(ns);
+	int shift = msb - SUB_BITS;
+	int idx = ((shift + 1) << SUB_BITS) + ((ns >> shift) & (sub - 1));
+
+	return min(idx, NUM_BUCKETS - 1);
+}
+
+uint64_t LatencyHistogram::bucket_upper(int idx)
+{
+	const uint64_t sub = 1ULL << SUB_BITS;
+
+	if (idx < (int) sub)
+		return idx;
+
+	int shift = (idx >> SUB_BITS) - 1;
+	uint64_t mantissa = sub + (idx & (sub - 1));
+
+	if (shift + SUB_BITS >= 63)
+		return UINT64_MAX;
+
+	return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+	this->buckets[bucket_index(ns)].fetch_add(1, memory_order_relaxed);
+	this->sum_ns.fetch_add(ns, memory_order_relaxed);
+}
+
+LatencySnapshot LatencyHistogram::snapshot(void) const
+{
+	LatencySnapshot snap;
+
+	snap.buckets.resize(NUM_BUCKETS);
+	for (int i = 0; i < NUM_BUCKETS; i++) {
+		snap.buckets[i] = this->buckets[i].load(memory_order_relaxed);
+		snap.count += snap.buckets[i];
+	}
+	snap.sum_ns = this->sum_ns.load(memory_order_relaxed);
+
+	return snap;
+}
+
+void LatencySnapshot::add(const LatencySnapshot &other)
+{
+	if (this->buckets.size() < other.buckets.size())
+		this->buckets.resize(other.buckets.size());
+
+	for (size_t i = 0; i < other.buckets.size(); i++)
+		this->buckets[i] += other.buckets[i];
+	this->count += other.count;
+	this->sum_ns += other.sum_ns;
+}
+
+LatencySnapshot LatencySnapshot::operator-(const LatencySnapshot &old) const
+{
+	LatencySnapshot diff = *this;
+
+	for (size_t i = 0; i < old.buckets.size() && i < diff.buckets.size(); i++)
+		diff.buckets[i] -= old.buckets[i];
+	diff.count -= old.count;
+	diff.sum_ns -= old.sum_ns;
+
+	return diff;
+}
+
+/* Upper bound of the bucket holding the p-th percentile, 0 if empty */
+uint64_t LatencySnapshot::percentile(double p) const
+{
+	if (this->count == 0)
+		return 0;
+
+	uint64_t rank = (uint64_t) (p / 100.0 * this->count);
+	if (rank >= this->count)
+		rank = this->count - 1;
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < this->buckets.size(); i++) {
+		seen += this->buckets[i];
+		if (seen > rank)
+			return LatencyHistogram::bucket_upper(i);
+	}
+
+	return LatencyHistogram::bucket_upper(this->buckets.size() - 1);
+}
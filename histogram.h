@@ -0,0 +1,82 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+
+/* A copy of the bucket counts, to compute percentiles and differences
+ * between two points in time.
+ */
+struct LatencySnapshot {
+	std::vector<uint64_t> buckets;
+	uint64_t count {0};
+	uint64_t sum_ns {0};
+
+	void add(const LatencySnapshot &other);
+	LatencySnapshot operator-(const LatencySnapshot &old) const;
+
+	uint64_t percentile(double p) const; // in ns
+};
+
+/* Log-linear latency histogram: 8 buckets per power of two, so a
+ * percentile is accurate to about 12%. Lock free, any thread may record.
+ */
+class LatencyHistogram
+{
+public:
+	static const int SUB_BITS = 3;
+	static const int NUM_BUCKETS = 64 << SUB_BITS;
+
+private:
+	std::atomic<uint64_t> buckets[NUM_BUCKETS];
+	std::atomic<uint64_t> sum_ns;
+
+public:
+	LatencyHistogram(void);
+
+	void record(uint64_t ns);
+	LatencySnapshot snapshot(void) const;
+
+	static int bucket_index(uint64_t ns);
+	static uint64_t bucket_upper(int idx);
+};
+
+/* monotonic clock in ns, for latencies */
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif // __HISTOGRAM_H__
@@ -0,0 +1,177 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/xattr.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+
+#include "iobackend.h"
+#include "membackend.h"
+#include "faultbackend.h"
+
+using namespace std;
+
+static PosixBackend posix_backend;
+static IoBackend *io_backend = &posix_backend;
+
+IoBackend *get_io_backend(void)
+{
+	return io_backend;
+}
+
+// the backends live until the exit
+int set_io_backend(string name, uint64_t mem_size, string fault_spec)
+{
+	if (name == "posix")
+		io_backend = &posix_backend;
+	else if (name == "mem")
+		io_backend = new MemBackend(mem_size);
+	else
+		return -EINVAL;
+
+	if (!fault_spec.empty()) {
+		double rates[FAULT_NUM_TYPES];
+
+		if (FaultBackend::parse_spec(fault_spec, rates))
+			return -EINVAL;
+		io_backend = new FaultBackend(io_backend, rates);
+	}
+
+	return 0;
+}
+
+/* Without double and trailing slashes, e.g. as a key of a path */
+string io_normalize_path(const char *path)
+{
+	string out;
+
+	for (const char *p = path; *p; p++) {
+		if (*p == '/' && !out.empty() && out.back() == '/')
+			continue;
+		out += *p;
+	}
+
+	if (out.size() > 1 && out.back() == '/')
+		out.pop_back();
+
+	return out;
+}
+
+int PosixBackend::open(const char *path, int flags, mode_t mode)
+{
+	return ::open(path, flags, mode);
+}
+
+int PosixBackend::close(int fd)
+{
+	return ::close(fd);
+}
+
+ssize_t PosixBackend::write(int fd, const void *buf, size_t len)
+{
+	return ::write(fd, buf, len);
+}
+
+ssize_t PosixBackend::pread(int fd, void *buf, size_t len, off_t off)
+{
+	return ::pread(fd, buf, len, off);
+}
+
+off_t PosixBackend::lseek(int fd, off_t off, int whence)
+{
+	return ::lseek(fd, off, whence);
+}
+
+int PosixBackend::fsync(int fd)
+{
+	return ::fsync(fd);
+}
+
+int PosixBackend::fdatasync(int fd)
+{
+	return ::fdatasync(fd);
+}
+
+int PosixBackend::fadvise(int fd, off_t off, off_t len, int advice)
+{
+	return posix_fadvise(fd, off, len, advice);
+}
+
+int PosixBackend::get_flags(int fd)
+{
+	return fcntl(fd, F_GETFL);
+}
+
+int PosixBackend::set_flags(int fd, int flags)
+{
+	return fcntl(fd, F_SETFL, flags);
+}
+
+int PosixBackend::fstat(int fd, struct stat *st)
+{
+	return ::fstat(fd, st);
+}
+
+int PosixBackend::fiemap(int fd, struct fiemap *map)
+{
+	return ioctl(fd, FS_IOC_FIEMAP, map);
+}
+
+int PosixBackend::fsetxattr(int fd, const char *name, const void *value,
+			    size_t size)
+{
+	return ::fsetxattr(fd, name, value, size, 0);
+}
+
+ssize_t PosixBackend::fgetxattr(int fd, const char *name, void *value,
+				size_t size)
+{
+	return ::fgetxattr(fd, name, value, size);
+}
+
+int PosixBackend::unlinkat(int dirfd, const char *path)
+{
+	return ::unlinkat(dirfd, path, 0);
+}
+
+int PosixBackend::mkdir(const char *path, mode_t mode)
+{
+	return ::mkdir(path, mode);
+}
+
+int PosixBackend::rmdir(const char *path)
+{
+	return ::rmdir(path);
+}
+
+int PosixBackend::statvfs(const char *path, struct statvfs *buf)
+{
+	return ::statvfs(path, buf);
+}
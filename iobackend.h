@@ -0,0 +1,118 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __IOBACKEND_H__
+#define __IOBACKEND_H__
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <stdint.h>
+#include <ostream>
+#include <string>
+
+struct fiemap;
+
+/* The file system calls of the test engine (File, Dir, Filesystem), so that
+ * it can run against something else than the kernel, e.g. to measure its
+ * own overhead. Errors are returned like by the system calls, -1 and errno.
+ */
+class IoBackend
+{
+public:
+	virtual ~IoBackend(void) {}
+
+	virtual const char *name(void) = 0;
+	virtual bool has_page_cache(void) = 0;
+
+	virtual int open(const char *path, int flags, mode_t mode = 0) = 0;
+	virtual int close(int fd) = 0;
+	virtual ssize_t write(int fd, const void *buf, size_t len) = 0;
+	virtual ssize_t pread(int fd, void *buf, size_t len, off_t off) = 0;
+	virtual off_t lseek(int fd, off_t off, int whence) = 0;
+	virtual int fsync(int fd) = 0;
+	virtual int fdatasync(int fd) = 0;
+	virtual int fadvise(int fd, off_t off, off_t len, int advice) = 0;
+	virtual int get_flags(int fd) = 0; // of open()
+	virtual int set_flags(int fd, int flags) = 0; // F_SETFL
+	virtual int fstat(int fd, struct stat *st) = 0;
+	virtual int fiemap(int fd, struct fiemap *map) = 0;
+	virtual int fsetxattr(int fd, const char *name, const void *value,
+			      size_t size) = 0;
+	virtual ssize_t fgetxattr(int fd, const char *name, void *value,
+				  size_t size) = 0;
+	virtual int unlinkat(int dirfd, const char *path) = 0;
+	virtual int mkdir(const char *path, mode_t mode) = 0;
+	virtual int rmdir(const char *path) = 0;
+	virtual int statvfs(const char *path, struct statvfs *buf) = 0;
+
+	// fault injection, see FaultBackend: the engine tells the backend
+	// about the verification results instead of stopping on an error
+	virtual bool injects_faults(void) { return false; }
+	virtual void verified(const std::string &, bool) {}
+	virtual void report(std::ostream &) {}
+};
+
+/* The system calls, the default */
+class PosixBackend : public IoBackend
+{
+public:
+	const char *name(void) { return "posix"; }
+	bool has_page_cache(void) { return true; }
+
+	int open(const char *path, int flags, mode_t mode = 0);
+	int close(int fd);
+	ssize_t write(int fd, const void *buf, size_t len);
+	ssize_t pread(int fd, void *buf, size_t len, off_t off);
+	off_t lseek(int fd, off_t off, int whence);
+	int fsync(int fd);
+	int fdatasync(int fd);
+	int fadvise(int fd, off_t off, off_t len, int advice);
+	int get_flags(int fd);
+	int set_flags(int fd, int flags);
+	int fstat(int fd, struct stat *st);
+	int fiemap(int fd, struct fiemap *map);
+	int fsetxattr(int fd, const char *name, const void *value,
+		      size_t size);
+	ssize_t fgetxattr(int fd, const char *name, void *value, size_t size);
+	int unlinkat(int dirfd, const char *path);
+	int mkdir(const char *path, mode_t mode);
+	int rmdir(const char *path);
+	int statvfs(const char *path, struct statvfs *buf);
+};
+
+IoBackend *get_io_backend(void);
+std::string io_normalize_path(const char *path);
+
+/* "posix" or "mem", the memory backend has mem_size bytes, wrapped into
+ * a FaultBackend for a non-empty fault spec.
+ * Returns -EINVAL for an unknown backend or an invalid spec.
+ */
+int set_io_backend(std::string name, uint64_t mem_size,
+		   std::string fault_spec);
+
+#endif // __IOBACKEND_H__
@@ -0,0 +1,314 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+#include "fstest.h"
+#include "config.h"
+#include "jobs.h"
+#include "trace.h"
+
+using namespace std;
+
+static int stats_interval = 60;
+
+static JobShared *job_shared; // NULL unless running with --jobs
+static JobSlot *job_slot; // slot of this job
+
+JobShared *get_job_shared(void)
+{
+	return job_shared;
+}
+
+JobSlot *get_job_slot(void)
+{
+	return job_slot;
+}
+
+/* Reserve space for a new file, fails if that would exceed the budget */
+bool TargetBudget::try_reserve(uint64_t size)
+{
+	uint64_t used = this->space_used.load();
+
+	do {
+		if (used + size > this->space_goal)
+			return false;
+	} while (!this->space_used.compare_exchange_weak(used, used + size));
+
+	return true;
+}
+
+/* Reserve space even if above the budget, a job has to write something */
+void TargetBudget::reserve(uint64_t size)
+{
+	this->space_used += size;
+}
+
+void TargetBudget::release(uint64_t size)
+{
+	this->space_used -= size;
+}
+
+/* Sum up the counters of all jobs */
+static void sum_jobs(JobShared *shared, StatsStamp &sum, size_t &num_errors)
+{
+	memset(&sum, 0, sizeof(sum));
+	num_errors = 0;
+
+	for (size_t i = 0; i < shared->num_jobs; i++) {
+		JobSlot &slot = shared->jobs[i];
+
+		sum.write += slot.write;
+		sum.read += slot.read;
+		sum.num_files += slot.num_files;
+		sum.num_written_files += slot.num_written_files;
+		sum.num_read_files += slot.num_read_files;
+		if (slot.error_detected)
+			num_errors++;
+	}
+	sum.time = time(NULL);
+}
+
+static void print_job_stats(JobShared *shared, StatsStamp &now,
+			    StatsStamp &old, size_t running, size_t num_errors)
+{
+	double t = max(now.time - old.time, (time_t) 1);
+	double write = (now.write - old.write) / t / MEGA;
+	double read = (now.read - old.read) / t / MEGA;
+	double files = (now.num_written_files - old.num_written_files) / t;
+
+	cout << now.time << " [all jobs] running: " << running
+		<< "/" << shared->num_jobs
+		<< " write: " << now.write / GIGA << " GiB [" << write
+		<< " MiB/s] read: " << now.read / GIGA << " GiB [" << read
+		<< " MiB/s] Files: " << now.num_written_files << " [" << files
+		<< " files/s] on disk: " << now.num_files;
+
+	size_t num_targets = get_global_cfg()->get_num_targets();
+	for (size_t i = 0; i < num_targets; i++) {
+		TargetBudget &budget = shared->budgets[i];
+
+		cout << " space";
+		if (num_targets > 1)
+			cout << " " << get_global_cfg()->get_target_dir(i);
+		cout << ": " << budget.space_used / MEGA << "/"
+		     << budget.space_goal / MEGA << " MiB";
+	}
+
+	cout << " errors: " << num_errors << endl;
+	cout.flush();
+}
+
+/* Run a single job in a forked child, never returns */
+static void run_job(size_t idx)
+{
+	job_slot = &job_shared->jobs[idx];
+	job_slot->pid = getpid();
+
+	// every job writes its own file names and sizes
+	if (get_global_cfg()->get_has_seed())
+		srandom(get_global_cfg()->get_seed() + idx + 1);
+	else
+		srandom(getpid());
+
+	cout << "Job " << idx << " directory: "
+	     << get_global_cfg()->get_testdir(0) << endl;
+
+	start_threads();
+
+	exit(job_slot->error_detected ? EXIT_FAILURE : 0);
+}
+
+/* Space the jobs may write to the target together */
+static int target_budget(size_t idx, uint64_t &budget)
+{
+	struct statvfs statvfsbuf;
+	string dir = get_global_cfg()->get_target_dir(idx);
+	size_t percent = get_global_cfg()->get_target_usage(idx);
+
+	if (statvfs(dir.c_str(), &statvfsbuf) != 0) {
+		perror("statvfs(): ");
+		return 1;
+	}
+
+	uint64_t fssize = (uint64_t) statvfsbuf.f_blocks * statvfsbuf.f_frsize;
+	uint64_t fsfree = (uint64_t) statvfsbuf.f_bavail * statvfsbuf.f_frsize;
+	uint64_t goal = fssize * percent / 100;
+
+	if (fssize - fsfree >= goal) {
+		cerr << "Error: Filesystem " << dir
+		     << " already above % used goal: "
+		     << (fssize - fsfree) * 100.0 / fssize << " >= "
+		     << percent << endl;
+		return 1;
+	}
+
+	budget = goal - (fssize - fsfree);
+	return 0;
+}
+
+/* Signal the jobs that were not reaped yet */
+static void kill_jobs(JobShared *shared, int sig)
+{
+	for (size_t i = 0; i < shared->num_jobs; i++) {
+		if (!shared->jobs[i].reaped)
+			kill(shared->jobs[i].pid, sig);
+	}
+}
+
+/**
+ * Fork num_jobs fstest instances in the target dirs, all sharing one
+ * space budget per target. The coordinator aggregates their stats and
+ * returns one exit code for all of them.
+ */
+int run_jobs(size_t num_jobs)
+{
+	size_t num_targets = get_global_cfg()->get_num_targets();
+
+	if (num_jobs > MAX_JOBS) {
+		cerr << "Error: at most " << MAX_JOBS << " jobs supported"
+		     << endl;
+		return 1;
+	}
+
+	if (num_targets > MAX_TARGETS) {
+		cerr << "Error: at most " << MAX_TARGETS
+		     << " targets supported with --jobs" << endl;
+		return 1;
+	}
+
+	void *mem = mmap(NULL, sizeof(JobShared), PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		perror("mmap of the shared job state failed: ");
+		return 1;
+	}
+
+	job_shared = new (mem) JobShared();
+	job_shared->num_jobs = num_jobs;
+
+	cout << "Jobs                : " << num_jobs << endl;
+	for (size_t i = 0; i < num_targets; i++) {
+		TargetBudget &budget = job_shared->budgets[i];
+
+		if (target_budget(i, budget.space_goal))
+			return 1;
+		budget.space_used = 0;
+
+		cout << "Shared space budget : " << budget.space_goal / KILO
+		     << " kiB (" << get_global_cfg()->get_target_dir(i) << ")"
+		     << endl;
+	}
+	cout.flush();
+
+	trace_install_signal();
+	install_stop_signals();
+
+	for (size_t i = 0; i < num_jobs; i++) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork() failed: ");
+			EXIT(1);
+		}
+
+		if (pid == 0)
+			run_job(i);
+
+		job_shared->jobs[i].pid = pid;
+		job_shared->jobs[i].reaped = false;
+	}
+
+	size_t running = num_jobs;
+	int ret = 0;
+	StatsStamp old, now;
+	size_t num_errors;
+	bool stop_forwarded = false;
+	bool error_stopped = false;
+
+	sum_jobs(job_shared, old, num_errors);
+
+	while (running > 0) {
+		int status;
+		pid_t pid = waitpid(-1, &status, WNOHANG);
+
+		if (pid < 0) {
+			perror("waitpid() failed: ");
+			EXIT(1);
+		}
+
+		if (pid == 0) {
+			sleep(1);
+		} else {
+			running--;
+			for (size_t i = 0; i < num_jobs; i++) {
+				if (job_shared->jobs[i].pid == pid)
+					job_shared->jobs[i].reaped = true;
+			}
+
+			bool failed = !WIFEXITED(status) ||
+				      WEXITSTATUS(status) != 0;
+			cout << "Job " << pid << " finished"
+			     << (failed ? " with errors" : "") << endl;
+			if (failed) {
+				ret = 1;
+				// a job stopped on error, stop the others
+				if (get_global_cfg()->get_error_immediate_stop() &&
+				    !error_stopped) {
+					kill_jobs(job_shared, SIGTERM);
+					error_stopped = true;
+				}
+			}
+		}
+
+		// let the jobs stop and clean up themselves
+		if (get_stop_signal() && !stop_forwarded) {
+			cout << "Signal " << get_stop_signal()
+			     << " received, stopping the jobs" << endl;
+			kill_jobs(job_shared, SIGTERM);
+			stop_forwarded = true;
+		}
+
+		// the jobs dump their own traces
+		if (trace_dump_requested())
+			kill_jobs(job_shared, SIGUSR1);
+
+		sum_jobs(job_shared, now, num_errors);
+		if (now.time - old.time > stats_interval || running == 0) {
+			print_job_stats(job_shared, now, old, running,
+					num_errors);
+			old = now;
+		}
+	}
+
+	if (num_errors)
+		ret = 1;
+
+	cout << "All jobs finished, " << num_errors << " with errors" << endl;
+	return ret;
+}
@@ -0,0 +1,74 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __JOBS_H__
+#define __JOBS_H__
+
+#include <atomic>
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+
+#define MAX_JOBS 1024
+#define MAX_TARGETS 64
+
+/* Per job counters, updated by the job and summed up by the coordinator */
+struct JobSlot {
+	pid_t pid;
+	std::atomic<uint64_t> write, read;
+	std::atomic<uint64_t> num_written_files, num_read_files;
+	std::atomic<uint64_t> num_files; // files currently on disk
+	std::atomic<bool> error_detected;
+	bool reaped; // by the coordinator, its pid may be reused
+};
+
+/* All jobs account the size of their files in a target against one
+ * space budget, so that together they do not overshoot the fill goal.
+ */
+struct TargetBudget {
+	uint64_t space_goal; // bytes all jobs together may write
+	std::atomic<uint64_t> space_used; // bytes reserved by all jobs
+
+	bool try_reserve(uint64_t size);
+	void reserve(uint64_t size);
+	void release(uint64_t size);
+};
+
+/* Lives in shared memory, mapped before the jobs are forked */
+struct JobShared {
+	TargetBudget budgets[MAX_TARGETS];
+
+	size_t num_jobs;
+	JobSlot jobs[MAX_JOBS];
+};
+
+JobShared *get_job_shared(void);
+JobSlot *get_job_slot(void);
+
+int run_jobs(size_t num_jobs);
+
+#endif // __JOBS_H__
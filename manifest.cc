@@ -0,0 +1,302 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <limits.h>
+#include <sys/mman.h>
+#include <unordered_map>
+
+#include "fstest.h"
+#include "dir.h"
+#include "manifest.h"
+#include "verify.h"
+
+using namespace std;
+
+static_assert(sizeof(ManifestRecord) == 256, "manifest record size changed");
+
+#define MANIFEST_GROW (16 * MEGA)
+
+static Manifest manifest;
+
+Manifest *get_manifest(void)
+{
+	return &manifest;
+}
+
+Manifest::Manifest(void)
+{
+	pthread_mutex_init(&this->mutex, NULL);
+	this->fd = -1;
+	this->map = NULL;
+	this->map_size = 0;
+	this->num_records = 0;
+	this->next_id = 1;
+}
+
+Manifest::~Manifest(void)
+{
+	if (this->map != NULL) {
+		msync(this->map, this->map_size, MS_SYNC);
+		munmap(this->map, this->map_size);
+	}
+
+	if (this->fd != -1)
+		close(this->fd);
+
+	pthread_mutex_destroy(&this->mutex);
+}
+
+/* Create a new manifest, an existing one is not overwritten */
+/* The deepest path below a target dir has to fit into a record */
+int Manifest::check_path_len(string dir, size_t max_files)
+{
+	if (dir[0] != '/') {
+		char buf[PATH_MAX];
+		if (getcwd(buf, sizeof(buf)) == NULL) {
+			cerr << "getcwd() failed: " << strerror(errno) << endl;
+			return -1;
+		}
+		dir = string(buf) + "/" + dir;
+	}
+
+	// the fstest.<pid>/ of any job, "dNN/" per level, then a file name
+	// of up to 8 hex digits
+	size_t len = dir.length() + strlen("fstest.4194304/") +
+		     Dir::max_level(max_files) * 5 + 8;
+	if (len >= MANIFEST_PATH_SIZE) {
+		cerr << "Error: paths below " << dir << " get up to " << len
+		     << " bytes long, the manifest only takes "
+		     << MANIFEST_PATH_SIZE - 1 << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+int Manifest::open(string path)
+{
+	char buf[PATH_MAX];
+	if (getcwd(buf, sizeof(buf)) == NULL) {
+		cerr << "getcwd() failed: " << strerror(errno) << endl;
+		return -1;
+	}
+	this->cwd = string(buf) + "/";
+
+	this->path = path;
+	this->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (this->fd == -1) {
+		cerr << "Creating manifest " << path << " failed: "
+		     << strerror(errno) << endl;
+		return -1;
+	}
+
+	this->grow();
+
+	cout << "Manifest            : " << path << endl;
+	return 0;
+}
+
+/* Extend the file and the mapping, manifest has to be locked */
+void Manifest::grow(void)
+{
+	size_t new_size = this->map_size + MANIFEST_GROW;
+
+	if (ftruncate(this->fd, new_size) != 0) {
+		cerr << "Extending manifest " << this->path << " failed: "
+		     << strerror(errno) << endl;
+		EXIT(1);
+	}
+
+	// the new size has to be on disk before records in it are synced
+	if (fsync(this->fd) != 0) {
+		cerr << "fsync() of manifest " << this->path << " failed: "
+		     << strerror(errno) << endl;
+		EXIT(1);
+	}
+
+	void *map;
+	if (this->map == NULL)
+		map = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   this->fd, 0);
+	else
+		map = mremap(this->map, this->map_size, new_size,
+			     MREMAP_MAYMOVE);
+
+	if (map == MAP_FAILED) {
+		cerr << "Mapping manifest " << this->path << " failed: "
+		     << strerror(errno) << endl;
+		EXIT(1);
+	}
+
+	this->map = (char *) map;
+	this->map_size = new_size;
+}
+
+uint64_t Manifest::new_id(void)
+{
+	pthread_mutex_lock(&this->mutex);
+	uint64_t id = this->next_id++;
+	pthread_mutex_unlock(&this->mutex);
+
+	return id;
+}
+
+void Manifest::append(enum manifest_state state, uint64_t file_id,
+		      const File *file, bool sync)
+{
+	ManifestRecord rec;
+	string path = file->path();
+
+	if (path[0] != '/')
+		path = this->cwd + path;
+
+	if (path.length() >= sizeof(rec.path)) {
+		cerr << "Path too long for the manifest: " << path << endl;
+		EXIT(1);
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	rec.magic = MANIFEST_MAGIC;
+	rec.state = state;
+	rec.file_id = file_id;
+	rec.size = file->get_fsize();
+	rec.pattern = file->get_pattern();
+	rec.time = time(NULL);
+	strncpy(rec.path, path.c_str(), sizeof(rec.path) - 1);
+
+	pthread_mutex_lock(&this->mutex);
+
+	size_t off = this->num_records * sizeof(rec);
+	if (off + sizeof(rec) > this->map_size)
+		this->grow();
+
+	memcpy(this->map + off, &rec, sizeof(rec));
+	this->num_records++;
+
+	if (sync) {
+		size_t page = sysconf(_SC_PAGESIZE);
+		size_t start = off & ~(page - 1);
+
+		if (msync(this->map + start, off + sizeof(rec) - start,
+			  MS_SYNC) != 0) {
+			cerr << "msync() of manifest " << this->path
+			     << " failed: " << strerror(errno) << endl;
+			EXIT(1);
+		}
+	}
+
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/**
+ * Verify all files of a manifest with num_threads threads, e.g. after a
+ * reboot. Returns non-zero if acknowledged data is corrupt or lost.
+ */
+int Manifest::verify(string path, size_t num_threads)
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd == -1) {
+		cerr << "Opening manifest " << path << " failed: "
+		     << strerror(errno) << endl;
+		return 1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		cerr << "Manifest " << path << " is empty" << endl;
+		close(fd);
+		return 1;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		cerr << "Mapping manifest " << path << " failed: "
+		     << strerror(errno) << endl;
+		close(fd);
+		return 1;
+	}
+
+	// The latest record of each file. Records without magic (unused or
+	// torn) are skipped, not taken as the end of the log: unsynced
+	// CREATED records may be lost in a crash while later synced
+	// records survived.
+	const ManifestRecord *recs = (const ManifestRecord *) map;
+	size_t max_records = st.st_size / sizeof(ManifestRecord);
+	unordered_map<uint64_t, const ManifestRecord *> latest;
+	size_t num_records = 0;
+	size_t num_invalid = 0; // slots before the last record
+	size_t num_unused = 0;
+
+	for (size_t i = 0; i < max_records; i++) {
+		const ManifestRecord *rec = &recs[i];
+
+		if (rec->magic != MANIFEST_MAGIC ||
+		    rec->state < MANIFEST_CREATED ||
+		    rec->state > MANIFEST_DELETED) {
+			num_unused++;
+			continue;
+		}
+
+		num_invalid += num_unused;
+		num_unused = 0;
+		num_records++;
+		latest[rec->file_id] = rec;
+	}
+
+	cout << "Manifest            : " << path << " (" << num_records
+	     << " records, " << latest.size() << " files, " << num_invalid
+	     << " lost)" << endl;
+
+	VerifyPool pool(num_threads);
+	size_t num_deleted = 0;
+
+	for (auto &it : latest) {
+		const ManifestRecord *rec = it.second;
+
+		if (rec->state == MANIFEST_DELETED) {
+			num_deleted++;
+			continue;
+		}
+
+		VerifyItem item;
+		item.path = string(rec->path, strnlen(rec->path, sizeof(rec->path)));
+		item.pattern = rec->pattern;
+		item.size = rec->size;
+		item.synced = rec->state == MANIFEST_SYNCED;
+		pool.push(item);
+	}
+
+	pool.finish();
+
+	cout << "Deleted files       : " << num_deleted << endl;
+	pool.print_summary(cout);
+
+	munmap(map, st.st_size);
+	close(fd);
+
+	return pool.has_errors() ? 1 : 0;
+}
@@ -0,0 +1,97 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __MANIFEST_H__
+#define __MANIFEST_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+
+class File;
+
+#define MANIFEST_MAGIC 0x4d465351 // "QSFM"
+#define MANIFEST_PATH_SIZE 216
+
+enum manifest_state {
+	MANIFEST_CREATED = 1, // data is being written, not synced yet
+	MANIFEST_SYNCED  = 2, // fdatasync() succeeded, the data must survive
+	MANIFEST_DELETED = 3, // about to be unlinked
+};
+
+/* Fixed size record, appended for every state change of a file */
+struct ManifestRecord {
+	uint32_t magic;
+	uint32_t state;
+	uint64_t file_id;
+	uint64_t size;
+	uint32_t pattern;
+	uint32_t pad;
+	int64_t time;
+	char path[MANIFEST_PATH_SIZE]; // absolute path
+};
+
+/* Append-only, memory mapped log of the files and their sync state, so
+ * that the test files can still be verified after a crash or power cut.
+ * A SYNCED record is written to disk before fwrite() returns, a DELETED
+ * record before the file is unlinked.
+ */
+class Manifest
+{
+private:
+	pthread_mutex_t mutex;
+	std::string path;
+	std::string cwd; // record paths are absolute
+	int fd;
+	char *map;
+	size_t map_size;
+	size_t num_records;
+	uint64_t next_id;
+
+	void grow(void);
+
+public:
+	Manifest(void);
+	~Manifest(void);
+
+	static int check_path_len(std::string dir, size_t max_files);
+	int open(std::string path);
+	bool is_open(void) const
+	{
+		return this->fd != -1;
+	}
+
+	uint64_t new_id(void);
+	void append(enum manifest_state state, uint64_t file_id,
+		    const File *file, bool sync);
+
+	static int verify(std::string path, size_t num_threads);
+};
+
+Manifest *get_manifest(void);
+
+#endif // __MANIFEST_H__
@@ -0,0 +1,534 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+
+#include "membackend.h"
+
+using namespace std;
+
+MemInode::MemInode(uint64_t ino, bool dir) : ino(ino), dir(dir)
+{
+	pthread_rwlock_init(&this->lock, NULL);
+}
+
+MemInode::~MemInode(void)
+{
+	pthread_rwlock_destroy(&this->lock);
+}
+
+static string parent_of(const string &path)
+{
+	size_t pos = path.rfind('/');
+
+	if (pos == string::npos)
+		return ".";
+	if (pos == 0)
+		return "/";
+
+	return path.substr(0, pos);
+}
+
+static uint64_t num_blocks(uint64_t size)
+{
+	return (size + MEM_BLOCK_SIZE - 1) / MEM_BLOCK_SIZE;
+}
+
+MemBackend::MemBackend(uint64_t capacity)
+{
+	pthread_mutex_init(&this->mutex, NULL);
+	this->capacity = capacity / MEM_BLOCK_SIZE * MEM_BLOCK_SIZE;
+	this->used = 0;
+}
+
+MemBackend::~MemBackend(void)
+{
+	for (MemOpenFile *file : this->fds)
+		delete file;
+
+	pthread_mutex_destroy(&this->mutex);
+}
+
+/* The mutex has to be locked */
+MemOpenFile *MemBackend::get_file(int fd)
+{
+	size_t idx = fd - MEM_FD_BASE;
+
+	if (fd < MEM_FD_BASE || idx >= this->fds.size() ||
+	    this->fds[idx] == NULL) {
+		errno = EBADF;
+		return NULL;
+	}
+
+	return this->fds[idx];
+}
+
+/* The mutex has to be locked */
+shared_ptr<MemInode> MemBackend::lookup(const string &path)
+{
+	auto it = this->names.find(path);
+
+	if (it == this->names.end())
+		return NULL;
+
+	return it->second;
+}
+
+int MemBackend::open(const char *path, int flags, mode_t mode)
+{
+	string name = io_normalize_path(path);
+	int err = 0;
+	int fd = -1;
+
+	(void) mode;
+
+	pthread_mutex_lock(&this->mutex);
+	shared_ptr<MemInode> inode = this->lookup(name);
+
+	if (inode == NULL) {
+		shared_ptr<MemInode> parent = this->lookup(parent_of(name));
+
+		if (!(flags & O_CREAT) || parent == NULL || !parent->dir) {
+			err = ENOENT;
+			goto out;
+		}
+
+		inode = make_shared<MemInode>(this->next_ino++, false);
+		this->names[name] = inode;
+		parent->children++;
+	} else if ((flags & O_CREAT) && (flags & O_EXCL)) {
+		err = EEXIST;
+		goto out;
+	} else if ((flags & O_DIRECTORY) && !inode->dir) {
+		err = ENOTDIR;
+		goto out;
+	} else if (inode->dir && (flags & O_ACCMODE) != O_RDONLY) {
+		err = EISDIR;
+		goto out;
+	}
+
+	{
+		MemOpenFile *file = new MemOpenFile;
+
+		file->inode = inode;
+		file->path = name;
+		file->flags = flags;
+
+		if (!this->free_fds.empty()) {
+			fd = this->free_fds.back();
+			this->free_fds.pop_back();
+			this->fds[fd - MEM_FD_BASE] = file;
+		} else {
+			fd = MEM_FD_BASE + this->fds.size();
+			this->fds.push_back(file);
+		}
+	}
+
+out:
+	pthread_mutex_unlock(&this->mutex);
+	if (err)
+		errno = err;
+
+	return fd;
+}
+
+int MemBackend::close(int fd)
+{
+	pthread_mutex_lock(&this->mutex);
+	MemOpenFile *file = this->get_file(fd);
+	if (file != NULL) {
+		this->fds[fd - MEM_FD_BASE] = NULL;
+		this->free_fds.push_back(fd);
+	}
+	pthread_mutex_unlock(&this->mutex);
+
+	if (file == NULL)
+		return -1;
+
+	delete file;
+	return 0;
+}
+
+/* Account the growth of a file to off + len, shortens len to
+ * what fits. The mutex has to be locked.
+ */
+int MemBackend::reserve(MemInode *inode, uint64_t off, size_t &len)
+{
+	uint64_t free_blocks = (this->capacity - this->used) / MEM_BLOCK_SIZE;
+	uint64_t max_end = (inode->blocks + free_blocks) * MEM_BLOCK_SIZE;
+
+	if (off + len > max_end)
+		len = max_end > off ? max_end - off : 0;
+
+	if (len == 0)
+		return -ENOSPC;
+
+	uint64_t end = off + len;
+	if (end > inode->size) {
+		uint64_t blocks = num_blocks(end);
+
+		this->used += (blocks - inode->blocks) * MEM_BLOCK_SIZE;
+		inode->blocks = blocks;
+		inode->size = end;
+	}
+
+	return 0;
+}
+
+ssize_t MemBackend::write(int fd, const void *buf, size_t len)
+{
+	pthread_mutex_lock(&this->mutex);
+	MemOpenFile *file = this->get_file(fd);
+	if (file == NULL) {
+		pthread_mutex_unlock(&this->mutex);
+		return -1;
+	}
+
+	if ((file->flags & O_ACCMODE) == O_RDONLY) {
+		pthread_mutex_unlock(&this->mutex);
+		errno = EBADF;
+		return -1;
+	}
+
+	MemInode *inode = file->inode.get();
+	uint64_t off = file->off;
+	if (len > 0 && this->reserve(inode, off, len)) {
+		pthread_mutex_unlock(&this->mutex);
+		errno = ENOSPC;
+		return -1;
+	}
+	file->off += len;
+	pthread_mutex_unlock(&this->mutex);
+
+	pthread_rwlock_wrlock(&inode->lock);
+	if (inode->data.size() < off + len)
+		inode->data.resize(off + len);
+	memcpy(inode->data.data() + off, buf, len);
+	pthread_rwlock_unlock(&inode->lock);
+
+	return len;
+}
+
+ssize_t MemBackend::pread(int fd, void *buf, size_t len, off_t off)
+{
+	pthread_mutex_lock(&this->mutex);
+	MemOpenFile *file = this->get_file(fd);
+	shared_ptr<MemInode> inode;
+	if (file != NULL)
+		inode = file->inode;
+	pthread_mutex_unlock(&this->mutex);
+
+	if (inode == NULL)
+		return -1;
+
+	if (inode->dir) {
+		errno = EISDIR;
+		return -1;
+	}
+
+	pthread_rwlock_rdlock(&inode->lock);
+	size_t size = inode->data.size();
+	if ((uint64_t) off >= size)
+		len = 0;
+	else
+		len = min(len, size - off);
+	memcpy(buf, inode->data.data() + off, len);
+	pthread_rwlock_unlock(&inode->lock);
+
+	return len;
+}
+
+off_t MemBackend::lseek(int fd, off_t off, int whence)
+{
+	off_t ret = -1;
+
+	pthread_mutex_lock(&this->mutex);
+	MemOpenFile *file = this->get_file(fd);
+	if (file != NULL) {
+		if (whence == SEEK_CUR)
+			off += file->off;
+		else if (whence == SEEK_END)
+			off += file->inode->size;
+		else if (whence != SEEK_SET)
+			off = -1;
+
+		if (off < 0) {
+			errno = EINVAL;
+		} else {
+			file->off = off;
+			ret = off;
+		}
+	}
+	pthread_mutex_unlock(&this->mutex);
+
+	return ret;
+}
+
+int MemBackend::fsync(int fd)
+{
+	return this->fdatasync(fd);
+}
+
+int MemBackend::fdatasync(int fd)
+{
+	pthread_mutex_lock(&this->mutex);
+	MemOpenFile *file = this->get_file(fd);
+	pthread_mutex_unlock(&this->mutex);
+
+	return file ? 0 : -1;
+}
+
+int MemBackend::fadvise(int fd, off_t off, off_t len, int advice)
+{
+	(void) fd;
+	(void) off;
+	(void) len;
+	(void) advice;
+
+	return 0;
+}
+
+int MemBackend::get_flags(int fd)
+{
+	pthread_mutex_lock(&this->mutex);
+	MemOpenFile *file = this->get_file(fd);
+	int flags = file ? file->flags : -1;
+	pthread_mutex_unlock(&this->mutex);
+
+	return flags;
+}
+
+/* Only O_DIRECT can change, like F_SETFL */
+int MemBackend::set_flags(int fd, int flags)
+{
+	pthread_mutex_lock(&this->mutex);
+	MemOpenFile *file = this->get_file(fd);
+	if (file)
+		file->flags = (file->flags & ~O_DIRECT) | (flags & O_DIRECT);
+	pthread_mutex_unlock(&this->mutex);
+
+	return file ? 0 : -1;
+}
+
+int MemBackend::fstat(int fd, struct stat *st)
+{
+	pthread_mutex_lock(&this->mutex);
+	MemOpenFile *file = this->get_file(fd);
+	if (file != NULL) {
+		MemInode *inode = file->inode.get();
+
+		memset(st, 0, sizeof(*st));
+		st->st_ino = inode->ino;
+		st->st_mode = inode->dir ? S_IFDIR | 0700 : S_IFREG | 0600;
+		st->st_nlink = 1;
+		st->st_size = inode->size;
+		st->st_blksize = MEM_BLOCK_SIZE;
+		st->st_blocks = inode->blocks * (MEM_BLOCK_SIZE / 512);
+	}
+	pthread_mutex_unlock(&this->mutex);
+
+	return file ? 0 : -1;
+}
+
+int MemBackend::fiemap(int fd, struct fiemap *map)
+{
+	(void) fd;
+	(void) map;
+
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+int MemBackend::fsetxattr(int fd, const char *name, const void *value,
+			  size_t size)
+{
+	pthread_mutex_lock(&this->mutex);
+	MemOpenFile *file = this->get_file(fd);
+	shared_ptr<MemInode> inode;
+	if (file != NULL)
+		inode = file->inode;
+	pthread_mutex_unlock(&this->mutex);
+
+	if (inode == NULL)
+		return -1;
+
+	pthread_rwlock_wrlock(&inode->lock);
+	inode->xattrs[name] = string((const char *) value, size);
+	pthread_rwlock_unlock(&inode->lock);
+
+	return 0;
+}
+
+ssize_t MemBackend::fgetxattr(int fd, const char *name, void *value,
+			      size_t size)
+{
+	pthread_mutex_lock(&this->mutex);
+	MemOpenFile *file = this->get_file(fd);
+	shared_ptr<MemInode> inode;
+	if (file != NULL)
+		inode = file->inode;
+	pthread_mutex_unlock(&this->mutex);
+
+	if (inode == NULL)
+		return -1;
+
+	ssize_t ret = -1;
+	pthread_rwlock_rdlock(&inode->lock);
+	auto it = inode->xattrs.find(name);
+	if (it == inode->xattrs.end()) {
+		errno = ENODATA;
+	} else if (size > 0 && size < it->second.size()) {
+		errno = ERANGE;
+	} else {
+		if (size > 0)
+			memcpy(value, it->second.data(), it->second.size());
+		ret = it->second.size();
+	}
+	pthread_rwlock_unlock(&inode->lock);
+
+	return ret;
+}
+
+int MemBackend::unlinkat(int dirfd, const char *path)
+{
+	int err = 0;
+
+	pthread_mutex_lock(&this->mutex);
+	string name;
+	if (dirfd == AT_FDCWD) {
+		name = io_normalize_path(path);
+	} else {
+		MemOpenFile *dir = this->get_file(dirfd);
+		if (dir == NULL) {
+			pthread_mutex_unlock(&this->mutex);
+			return -1;
+		}
+		name = io_normalize_path((dir->path + "/" + path).c_str());
+	}
+
+	shared_ptr<MemInode> inode = this->lookup(name);
+	if (inode == NULL) {
+		err = ENOENT;
+	} else if (inode->dir) {
+		err = EISDIR;
+	} else {
+		this->names.erase(name);
+		this->used -= inode->blocks * MEM_BLOCK_SIZE;
+
+		shared_ptr<MemInode> parent = this->lookup(parent_of(name));
+		if (parent != NULL)
+			parent->children--;
+	}
+	pthread_mutex_unlock(&this->mutex);
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+int MemBackend::mkdir(const char *path, mode_t mode)
+{
+	string name = io_normalize_path(path);
+	int err = 0;
+
+	(void) mode;
+
+	// the parent does not need to exist, it is the test directory
+	pthread_mutex_lock(&this->mutex);
+	if (this->lookup(name) != NULL) {
+		err = EEXIST;
+	} else {
+		this->names[name] = make_shared<MemInode>(this->next_ino++,
+							  true);
+
+		shared_ptr<MemInode> parent = this->lookup(parent_of(name));
+		if (parent != NULL)
+			parent->children++;
+	}
+	pthread_mutex_unlock(&this->mutex);
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+int MemBackend::rmdir(const char *path)
+{
+	string name = io_normalize_path(path);
+	int err = 0;
+
+	pthread_mutex_lock(&this->mutex);
+	shared_ptr<MemInode> inode = this->lookup(name);
+	if (inode == NULL) {
+		err = ENOENT;
+	} else if (!inode->dir) {
+		err = ENOTDIR;
+	} else if (inode->children > 0) {
+		err = ENOTEMPTY;
+	} else {
+		this->names.erase(name);
+
+		shared_ptr<MemInode> parent = this->lookup(parent_of(name));
+		if (parent != NULL)
+			parent->children--;
+	}
+	pthread_mutex_unlock(&this->mutex);
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+int MemBackend::statvfs(const char *path, struct statvfs *buf)
+{
+	(void) path;
+
+	memset(buf, 0, sizeof(*buf));
+
+	pthread_mutex_lock(&this->mutex);
+	buf->f_bsize = MEM_BLOCK_SIZE;
+	buf->f_frsize = MEM_BLOCK_SIZE;
+	buf->f_blocks = this->capacity / MEM_BLOCK_SIZE;
+	buf->f_bfree = (this->capacity - this->used) / MEM_BLOCK_SIZE;
+	buf->f_bavail = buf->f_bfree;
+	buf->f_files = this->names.size();
+	buf->f_namemax = 255;
+	pthread_mutex_unlock(&this->mutex);
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __MEMBACKEND_H__
+#define __MEMBACKEND_H__
+
+#include <pthread.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "iobackend.h"
+
+#define MEM_BLOCK_SIZE 4096
+#define MEM_FD_BASE (1 << 24) // far above real file descriptors
+
+/* A file or directory of the memory backend */
+struct MemInode {
+	pthread_rwlock_t lock; // data and xattrs
+	std::vector<char> data;
+	std::map<std::string, std::string> xattrs;
+	uint64_t ino;
+	bool dir;
+
+	// under the mutex of the backend
+	uint64_t size {0};
+	uint64_t blocks {0}; // accounted in the usage
+	size_t children {0}; // entries of a directory
+
+	MemInode(uint64_t ino, bool dir);
+	~MemInode(void);
+};
+
+struct MemOpenFile {
+	std::shared_ptr<MemInode> inode;
+	std::string path;
+	int flags;
+	uint64_t off {0};
+};
+
+/* A filesystem in memory, with a capacity and statvfs() reporting its use,
+ * to run the engine without a real mount and to measure the overhead of
+ * the tool itself. The data is kept, verification reads it back.
+ * Space is freed on unlink, not on the last close.
+ */
+class MemBackend : public IoBackend
+{
+private:
+	pthread_mutex_t mutex; // names, file descriptors and usage
+	uint64_t capacity; // bytes
+	uint64_t used;
+	uint64_t next_ino {1};
+
+	std::unordered_map<std::string, std::shared_ptr<MemInode>> names;
+	std::vector<MemOpenFile *> fds; // index is fd - MEM_FD_BASE
+	std::vector<int> free_fds;
+
+	MemOpenFile *get_file(int fd);
+	std::shared_ptr<MemInode> lookup(const std::string &path);
+	int reserve(MemInode *inode, uint64_t off, size_t &len);
+
+public:
+	MemBackend(uint64_t capacity);
+	~MemBackend(void);
+
+	const char *name(void) { return "mem"; }
+	bool has_page_cache(void) { return false; }
+
+	int open(const char *path, int flags, mode_t mode = 0);
+	int close(int fd);
+	ssize_t write(int fd, const void *buf, size_t len);
+	ssize_t pread(int fd, void *buf, size_t len, off_t off);
+	off_t lseek(int fd, off_t off, int whence);
+	int fsync(int fd);
+	int fdatasync(int fd);
+	int fadvise(int fd, off_t off, off_t len, int advice);
+	int get_flags(int fd);
+	int set_flags(int fd, int flags);
+	int fstat(int fd, struct stat *st);
+	int fiemap(int fd, struct fiemap *map);
+	int fsetxattr(int fd, const char *name, const void *value,
+		      size_t size);
+	ssize_t fgetxattr(int fd, const char *name, void *value, size_t size);
+	int unlinkat(int dirfd, const char *path);
+	int mkdir(const char *path, mode_t mode);
+	int rmdir(const char *path);
+	int statvfs(const char *path, struct statvfs *buf);
+};
+
+#endif // __MEMBACKEND_H__
@@ -0,0 +1,575 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <dirent.h>
+#include <sys/xattr.h>
+#include <set>
+#include <unordered_map>
+
+#include "fstest.h"
+#include "config.h"
+#include "control.h"
+#include "metadata.h"
+#include "ratelimit.h"
+#include "trace.h"
+
+using namespace std;
+
+static int stats_interval = 60;
+
+#define META_VERIFY_OPS 10000 // full namespace check every that many ops
+#define META_XATTR "user.fstest.meta"
+
+/* A regular file of the model, with all its hard links */
+struct MetaInode {
+	uint64_t ino;
+	uint64_t size;
+	nlink_t nlink;
+	string xattr; // empty if never set
+};
+
+/* A name of the model */
+struct MetaEntry {
+	int dir;
+	string name;
+	bool symlink;
+	uint64_t inode; // key of the MetaInode, regular files only
+	string target; // symlinks only
+};
+
+/* One thread of the metadata workload and its model of the namespace */
+class MetaThread
+{
+private:
+	MetaWorkload *work;
+	size_t idx;
+	string base; // <test dir>/meta<idx>/
+	vector<MetaEntry> entries;
+	unordered_map<uint64_t, MetaInode> inodes;
+	uint64_t next_name;
+	uint64_t next_inode;
+	bool failed;
+
+	string dir_path(int dir) const
+	{
+		return this->base + "d" + to_string(dir) + "/";
+	}
+
+	string path(const MetaEntry &entry) const
+	{
+		return this->dir_path(entry.dir) + entry.name;
+	}
+
+	string new_name(void)
+	{
+		return "f" + to_string(this->next_name++);
+	}
+
+	void fail(const string &path, const string &msg);
+	int pick_op(void);
+	MetaEntry *pick_entry(bool regular_only);
+
+	void do_create(void);
+	void do_stat(void);
+	void do_rename(void);
+	void do_link(void);
+	void do_symlink(void);
+	void do_setxattr(void);
+	void do_unlink(void);
+	void verify_namespace(void);
+	void cleanup(void);
+
+public:
+	MetaThread(MetaWorkload *work, size_t idx);
+	void run(void);
+};
+
+MetaThread::MetaThread(MetaWorkload *work, size_t idx)
+{
+	this->work = work;
+	this->idx = idx;
+	this->base = work->fs->get_path() + "meta" + to_string(idx) + "/";
+	this->next_name = 0;
+	this->next_inode = 0;
+	this->failed = false;
+}
+
+void MetaThread::fail(const string &path, const string &msg)
+{
+	cerr << "Metadata error in " << path << ": " << msg << endl;
+	this->failed = true;
+	this->work->fs->set_error_detected();
+}
+
+int MetaThread::pick_op(void)
+{
+	unsigned r = random() % this->work->weight_sum;
+	int op = 0;
+
+	while (r >= this->work->weights[op]) {
+		r -= this->work->weights[op];
+		op++;
+	}
+
+	if (this->entries.empty())
+		return META_CREATE;
+
+	// keep the namespace at its size, but let it churn
+	if (this->entries.size() >= this->work->max_entries &&
+	    (op == META_CREATE || op == META_LINK || op == META_SYMLINK))
+		return META_UNLINK;
+
+	if (op == META_SETXATTR && !this->work->xattr_supported)
+		return META_STAT;
+
+	return op;
+}
+
+/* A random entry, NULL if there is no suitable one */
+MetaEntry *MetaThread::pick_entry(bool regular_only)
+{
+	for (int i = 0; i < 4; i++) {
+		MetaEntry *entry = &this->entries[random() % this->entries.size()];
+
+		if (!regular_only || !entry->symlink)
+			return entry;
+	}
+
+	return NULL;
+}
+
+void MetaThread::do_create(void)
+{
+	MetaEntry entry;
+	entry.dir = random() % META_DIRS;
+	entry.name = this->new_name();
+	entry.symlink = false;
+
+	// half of the files are empty, the others up to 4 KiB
+	size_t size = random() % 2 ? 0 : random() % 4096 + 1;
+	string path = this->path(entry);
+
+	get_rate_limits()->files.acquire(1);
+
+	entry.inode = this->next_inode++;
+	TraceOp op(TRACE_CREATE, entry.inode, 0, size);
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+	op.result = fd == -1 ? -errno : 0;
+	if (fd == -1) {
+		if (errno != ENOSPC)
+			this->fail(path, string("create: ") + strerror(errno));
+		return;
+	}
+
+	if (size > 0) {
+		char buf[4096];
+
+		memset(buf, 'm', size);
+		if (write(fd, buf, size) != (ssize_t) size)
+			size = 0; // out of space, stat will tell
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		this->fail(path, string("fstat: ") + strerror(errno));
+		close(fd);
+		return;
+	}
+	close(fd);
+
+	MetaInode inode;
+	inode.ino = st.st_ino;
+	inode.size = st.st_size;
+	inode.nlink = 1;
+
+	this->inodes[entry.inode] = inode;
+	this->entries.push_back(entry);
+}
+
+void MetaThread::do_stat(void)
+{
+	MetaEntry *entry = this->pick_entry(false);
+	string path = this->path(*entry);
+	struct stat st;
+
+	TraceOp op(TRACE_STAT, entry->inode);
+	if (lstat(path.c_str(), &st) != 0) {
+		op.result = -errno;
+		this->fail(path, string("stat: ") + strerror(errno));
+		return;
+	}
+
+	if (entry->symlink) {
+		char buf[PATH_MAX];
+		ssize_t len = readlink(path.c_str(), buf, sizeof(buf));
+
+		if (!S_ISLNK(st.st_mode) || len < 0 ||
+		    string(buf, len) != entry->target)
+			this->fail(path, "symlink does not match, expected -> " +
+				   entry->target);
+		return;
+	}
+
+	MetaInode &inode = this->inodes[entry->inode];
+	if (!S_ISREG(st.st_mode) || st.st_ino != inode.ino ||
+	    (uint64_t) st.st_size != inode.size || st.st_nlink != inode.nlink) {
+		ostringstream msg;
+
+		msg << "expected ino " << inode.ino << " size " << inode.size
+		    << " nlink " << inode.nlink << ", got mode " << oct
+		    << st.st_mode << dec << " ino " << st.st_ino << " size "
+		    << st.st_size << " nlink " << st.st_nlink;
+		this->fail(path, msg.str());
+		return;
+	}
+
+	if (!inode.xattr.empty()) {
+		char buf[64];
+		ssize_t len = getxattr(path.c_str(), META_XATTR, buf,
+				       sizeof(buf));
+
+		if (len < 0 || string(buf, len) != inode.xattr)
+			this->fail(path, "xattr does not match, expected " +
+				   inode.xattr);
+	}
+}
+
+void MetaThread::do_rename(void)
+{
+	MetaEntry *entry = this->pick_entry(false);
+	string old_path = this->path(*entry);
+	int dir = random() % META_DIRS;
+	string name = this->new_name();
+
+	TraceOp op(TRACE_RENAME, entry->inode);
+	if (rename(old_path.c_str(), (this->dir_path(dir) + name).c_str())) {
+		op.result = -errno;
+		this->fail(old_path, string("rename: ") + strerror(errno));
+		return;
+	}
+
+	entry->dir = dir;
+	entry->name = name;
+}
+
+void MetaThread::do_link(void)
+{
+	MetaEntry *entry = this->pick_entry(true);
+	if (entry == NULL)
+		return;
+
+	MetaEntry new_entry = *entry;
+	new_entry.dir = random() % META_DIRS;
+	new_entry.name = this->new_name();
+
+	string path = this->path(*entry);
+	TraceOp op(TRACE_LINK, entry->inode);
+	if (link(path.c_str(), this->path(new_entry).c_str())) {
+		op.result = -errno;
+		if (errno != ENOSPC && errno != EMLINK)
+			this->fail(path, string("link: ") + strerror(errno));
+		return;
+	}
+
+	this->inodes[entry->inode].nlink++;
+	this->entries.push_back(new_entry);
+}
+
+void MetaThread::do_symlink(void)
+{
+	MetaEntry *entry = this->pick_entry(false);
+
+	MetaEntry new_entry;
+	new_entry.dir = random() % META_DIRS;
+	new_entry.name = this->new_name();
+	new_entry.symlink = true;
+	new_entry.inode = 0;
+	new_entry.target = "../d" + to_string(entry->dir) + "/" + entry->name;
+
+	string path = this->path(new_entry);
+	TraceOp op(TRACE_SYMLINK, entry->inode);
+	if (symlink(new_entry.target.c_str(), path.c_str())) {
+		op.result = -errno;
+		if (errno != ENOSPC)
+			this->fail(path, string("symlink: ") + strerror(errno));
+		return;
+	}
+
+	this->entries.push_back(new_entry);
+}
+
+void MetaThread::do_setxattr(void)
+{
+	MetaEntry *entry = this->pick_entry(true);
+	if (entry == NULL)
+		return;
+
+	string path = this->path(*entry);
+	string value = "v" + to_string(this->next_name++);
+
+	TraceOp op(TRACE_SETXATTR, entry->inode, 0, value.length());
+	if (setxattr(path.c_str(), META_XATTR, value.data(), value.length(),
+		     0)) {
+		op.result = -errno;
+		if (errno == ENOTSUP) {
+			if (this->work->xattr_supported.exchange(false))
+				cout << "No user xattrs on "
+				     << this->work->fs->get_path()
+				     << ", not setting any" << endl;
+		} else if (errno != ENOSPC) {
+			this->fail(path, string("setxattr: ") + strerror(errno));
+		}
+		return;
+	}
+
+	this->inodes[entry->inode].xattr = value;
+}
+
+void MetaThread::do_unlink(void)
+{
+	size_t idx = random() % this->entries.size();
+	MetaEntry &entry = this->entries[idx];
+	string path = this->path(entry);
+
+	get_rate_limits()->files.acquire(1);
+
+	TraceOp op(TRACE_UNLINK, entry.inode);
+	if (unlink(path.c_str())) {
+		op.result = -errno;
+		this->fail(path, string("unlink: ") + strerror(errno));
+		return;
+	}
+
+	if (!entry.symlink) {
+		auto it = this->inodes.find(entry.inode);
+		if (--it->second.nlink == 0)
+			this->inodes.erase(it);
+	}
+
+	entry = this->entries.back();
+	this->entries.pop_back();
+}
+
+/* The directories have to contain exactly the names of the model */
+void MetaThread::verify_namespace(void)
+{
+	vector<set<string>> expected(META_DIRS);
+
+	for (MetaEntry &entry : this->entries)
+		expected[entry.dir].insert(entry.name);
+
+	for (int dir = 0; dir < META_DIRS; dir++) {
+		string path = this->dir_path(dir);
+		DIR *d = opendir(path.c_str());
+
+		if (d == NULL) {
+			this->fail(path, string("opendir: ") + strerror(errno));
+			return;
+		}
+
+		struct dirent *de;
+		while ((de = readdir(d)) != NULL) {
+			if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+				continue;
+
+			if (expected[dir].erase(de->d_name) == 0)
+				this->fail(path + de->d_name, "unexpected entry");
+		}
+		closedir(d);
+
+		for (const string &name : expected[dir])
+			this->fail(path + name, "missing in readdir");
+	}
+}
+
+/* Delete the namespace, unless it is needed to analyse an error */
+void MetaThread::cleanup(void)
+{
+	if (this->failed || get_global_cfg()->get_keep_data())
+		return;
+
+	for (MetaEntry &entry : this->entries)
+		unlink(this->path(entry).c_str());
+
+	for (int dir = 0; dir < META_DIRS; dir++)
+		rmdir(this->dir_path(dir).c_str());
+	rmdir(this->base.c_str());
+}
+
+void MetaThread::run(void)
+{
+	Filesystem *fs = this->work->fs;
+	ssize_t timeout = get_global_cfg()->get_timeout();
+	time_t start = time(NULL);
+	uint64_t num_ops = 0;
+
+	for (int dir = -1; dir < META_DIRS; dir++) {
+		string path = dir < 0 ? this->base : this->dir_path(dir);
+		TraceOp op(TRACE_MKDIR, dir < 0 ? 0 : dir);
+
+		op.result = mkdir(path.c_str(), 0700) ? -errno : 0;
+		if (op.result) {
+			this->fail(path, string("mkdir: ") + strerror(errno));
+			return;
+		}
+	}
+
+	while (!this->failed && !fs->is_terminated()) {
+		control_wait_if_paused();
+
+		int op = this->pick_op();
+		thread_set_state(THREAD_META);
+
+		uint64_t op_start = now_ns();
+		switch (op) {
+		case META_CREATE:   this->do_create();   break;
+		case META_STAT:     this->do_stat();     break;
+		case META_RENAME:   this->do_rename();   break;
+		case META_LINK:     this->do_link();     break;
+		case META_SYMLINK:  this->do_symlink();  break;
+		case META_SETXATTR: this->do_setxattr(); break;
+		case META_UNLINK:   this->do_unlink();   break;
+		}
+		this->work->lat[op].record(now_ns() - op_start);
+
+		if (++num_ops % META_VERIFY_OPS == 0) {
+			this->verify_namespace();
+
+			// without write threads nobody else checks it
+			if (timeout != -1 && time(NULL) - start > timeout)
+				fs->terminate();
+		}
+
+		// the first thread prints the stats of all
+		if (this->idx == 0 &&
+		    time(NULL) - this->work->stats_time > stats_interval)
+			this->work->print_stats();
+	}
+
+	if (!this->failed)
+		this->verify_namespace();
+
+	this->cleanup();
+}
+
+MetaWorkload::MetaWorkload(Filesystem *fs)
+{
+	this->fs = fs;
+	this->max_entries = get_global_cfg()->get_meta_files();
+	this->stats_time = time(NULL);
+
+	parse_mix(get_global_cfg()->get_meta_mix(), this->weights);
+	this->weight_sum = 0;
+	for (int op = 0; op < META_NUM_OPS; op++)
+		this->weight_sum += this->weights[op];
+}
+
+const char *MetaWorkload::op_name(int op)
+{
+	switch (op) {
+	case META_CREATE:   return "create";
+	case META_STAT:     return "stat";
+	case META_RENAME:   return "rename";
+	case META_LINK:     return "link";
+	case META_SYMLINK:  return "symlink";
+	case META_SETXATTR: return "setxattr";
+	case META_UNLINK:   return "unlink";
+	}
+	return "?";
+}
+
+/**
+ * Parse "op=weight,..." into weights, ops not given get 0
+ * Returns -EINVAL on an unknown op or if all weights are 0
+ */
+int MetaWorkload::parse_mix(string mix, unsigned *weights)
+{
+	unsigned sum = 0;
+
+	for (int op = 0; op < META_NUM_OPS; op++)
+		weights[op] = 0;
+
+	istringstream in(mix);
+	string item;
+	while (getline(in, item, ',')) {
+		size_t eq = item.find('=');
+		if (eq == string::npos)
+			return -EINVAL;
+
+		string name = item.substr(0, eq);
+		int op;
+		for (op = 0; op < META_NUM_OPS; op++) {
+			if (name == op_name(op))
+				break;
+		}
+		if (op == META_NUM_OPS)
+			return -EINVAL;
+
+		weights[op] = atoi(item.c_str() + eq + 1);
+		sum += weights[op];
+	}
+
+	return sum > 0 ? 0 : -EINVAL;
+}
+
+void MetaWorkload::print_stats(void)
+{
+	time_t now = time(NULL);
+	double t = max(now - this->stats_time, (time_t) 1);
+	uint64_t total = 0;
+	ostringstream ops;
+
+	for (int op = 0; op < META_NUM_OPS; op++) {
+		LatencySnapshot snap = this->lat[op].snapshot();
+		LatencySnapshot diff = snap - this->lat_old[op];
+
+		total += diff.count;
+		if (this->weights[op] > 0)
+			ops << " " << op_name(op) << ": " << diff.count / t
+			    << "/s p50: " << diff.percentile(50) / 1E3
+			    << " p99: " << diff.percentile(99) / 1E3;
+		this->lat_old[op] = snap;
+	}
+
+	cout << "[meta " << this->fs->get_path() << "] " << now << " ops: "
+	     << total / t << "/s, lat [us]" << ops.str() << endl;
+
+	this->stats_time = now;
+}
+
+/* A thread of the workload */
+void MetaWorkload::run(void)
+{
+	size_t idx = this->next_thread++;
+	MetaThread thread(this, idx);
+
+	thread_register("meta", this->fs->get_path());
+	thread.run();
+
+	if (idx == 0)
+		this->print_stats();
+}
@@ -0,0 +1,86 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __METADATA_H__
+#define __METADATA_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+#include "histogram.h"
+
+class Filesystem;
+
+enum meta_op {
+	META_CREATE,
+	META_STAT,
+	META_RENAME,
+	META_LINK,
+	META_SYMLINK,
+	META_SETXATTR,
+	META_UNLINK,
+	META_NUM_OPS
+};
+
+#define META_DIRS 8 // directories per thread, renames go across them
+#define DEFAULT_META_FILES 1000 // entries per thread
+#define DEFAULT_META_MIX \
+	"create=25,stat=30,rename=10,link=5,symlink=5,setxattr=10,unlink=15"
+
+/* Metadata workload of one target: each thread works on small files in its
+ * own directories and checks the namespace against an in-memory model of
+ * them, so that no locking is needed between the threads.
+ */
+class MetaWorkload
+{
+private:
+	Filesystem *fs;
+	unsigned weights[META_NUM_OPS];
+	unsigned weight_sum;
+	size_t max_entries; // per thread
+	std::atomic<size_t> next_thread {0};
+	std::atomic<bool> xattr_supported {true};
+
+	LatencyHistogram lat[META_NUM_OPS];
+	LatencySnapshot lat_old[META_NUM_OPS]; // at the last stats output
+	time_t stats_time;
+
+	void print_stats(void);
+
+	friend class MetaThread;
+
+public:
+	MetaWorkload(Filesystem *fs);
+
+	void run(void);
+
+	static int parse_mix(std::string mix, unsigned *weights);
+	static const char *op_name(int op);
+};
+
+#endif // __METADATA_H__
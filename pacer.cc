@@ -0,0 +1,203 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "fstest.h"
+#include "config.h"
+#include "cache.h"
+#include "pacer.h"
+
+#define PACER_MIN_LAG ((uint64_t) 64 << 20)
+#define PACER_WINDOW 16         // verified files per lag update
+#define PACER_MAX_CACHED 0.01   // resident part of the checks that grows lag
+#define PACER_WAIT_MS 100       // re-check of the stop flag
+#define PACER_READ_STALL 10     // [s] without writes, readers stop waiting
+
+using namespace std;
+
+Pacer::Pacer(void)
+{
+	pthread_mutex_init(&this->mutex, NULL);
+	pthread_cond_init(&this->cond, NULL);
+
+	this->ratio = 0;
+	this->slack = 0;
+	this->written = 0;
+	this->read = 0;
+	this->lag = PACER_MIN_LAG;
+	this->min_lag = PACER_MIN_LAG;
+	this->max_lag = PACER_MIN_LAG;
+	this->window_pages = 0;
+	this->window_resident = 0;
+	this->window_files = 0;
+}
+
+Pacer::~Pacer(void)
+{
+	pthread_cond_destroy(&this->cond);
+	pthread_mutex_destroy(&this->mutex);
+}
+
+void Pacer::init(uint64_t max_file_size)
+{
+	this->ratio = get_global_cfg()->get_read_write_ratio();
+
+	// a side has to be able to finish its current file
+	this->slack = 2 * max_file_size;
+
+	// more than the memory cannot be cached
+	uint64_t mem = (uint64_t) sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+	this->max_lag = max(mem, this->min_lag);
+}
+
+/* Wait for the other side, the mutex has to be locked */
+void Pacer::wait(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += PACER_WAIT_MS * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	pthread_cond_timedwait(&this->cond, &this->mutex, &ts);
+}
+
+/* Returns the write position after the file, in bytes since the start */
+uint64_t Pacer::add_written(uint64_t bytes)
+{
+	pthread_mutex_lock(&this->mutex);
+	this->written += bytes;
+	uint64_t pos = this->written;
+	pthread_cond_broadcast(&this->cond);
+	pthread_mutex_unlock(&this->mutex);
+
+	return pos;
+}
+
+void Pacer::add_read(uint64_t bytes, const CacheSample &sample)
+{
+	pthread_mutex_lock(&this->mutex);
+	this->read += bytes;
+
+	this->window_pages += sample.pages;
+	this->window_resident += sample.resident;
+	if (++this->window_files >= PACER_WINDOW)
+		this->update_lag();
+
+	pthread_cond_broadcast(&this->cond);
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/* Grow the lag fast if the checked files were still in the page cache,
+ * shrink it slowly if they were not. The mutex has to be locked.
+ */
+void Pacer::update_lag(void)
+{
+	if (this->window_pages > 0) {
+		double cached = (double) this->window_resident /
+				this->window_pages;
+
+		if (cached > PACER_MAX_CACHED)
+			this->lag = min(2 * this->lag, this->max_lag);
+		else if (this->window_resident == 0)
+			this->lag = max(this->lag - this->lag / 8, this->min_lag);
+	}
+
+	this->window_pages = 0;
+	this->window_resident = 0;
+	this->window_files = 0;
+}
+
+/* The writer waits while it is too far ahead of the readers */
+void Pacer::wait_write(const atomic<bool> &stop)
+{
+	pthread_mutex_lock(&this->mutex);
+	while (!stop && this->ratio > 0 &&
+	       this->ratio * this->written > this->read + this->lag + this->slack)
+		this->wait();
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/* A reader waits while the readers are too far ahead of the writer, but
+ * not for a writer that does not write anymore, e.g. after an error
+ */
+void Pacer::wait_read(const atomic<bool> &stop)
+{
+	time_t last_write = time(NULL);
+
+	pthread_mutex_lock(&this->mutex);
+	uint64_t written = this->written;
+	while (!stop && this->ratio > 0 &&
+	       this->read > this->ratio * this->written + this->slack) {
+		this->wait();
+
+		time_t now = time(NULL);
+		if (this->written != written) {
+			written = this->written;
+			last_write = now;
+		} else if (now - last_write >= PACER_READ_STALL)
+			break;
+	}
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/* Nothing is old enough to verify, wait until the next file is written */
+void Pacer::wait_new_write(const atomic<bool> &stop)
+{
+	pthread_mutex_lock(&this->mutex);
+	uint64_t written = this->written;
+	for (int i = 0; i < 1000 / PACER_WAIT_MS; i++) {
+		if (stop || this->written != written)
+			break;
+		this->wait();
+	}
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/* Let the waiting threads check their stop flag */
+void Pacer::wake(void)
+{
+	pthread_mutex_lock(&this->mutex);
+	pthread_cond_broadcast(&this->cond);
+	pthread_mutex_unlock(&this->mutex);
+}
+
+uint64_t Pacer::get_written(void)
+{
+	pthread_mutex_lock(&this->mutex);
+	uint64_t written = this->written;
+	pthread_mutex_unlock(&this->mutex);
+
+	return written;
+}
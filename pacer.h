@@ -0,0 +1,92 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __PACER_H__
+#define __PACER_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+
+struct CacheSample;
+
+/* Paces the write and read threads of a filesystem against each other.
+ *
+ * The readers verify a file only once lag more bytes have been written
+ * after it, so that it is likely out of the page cache. lag follows the
+ * part of the verified files that was still resident: doubled while too
+ * much was, slowly shrunk while nothing was.
+ *
+ * The bandwidths are kept at the read:write ratio. The writer waits while
+ * it is more than lag + slack bytes ahead, a reader while it is more than
+ * slack bytes ahead. The waits are woken by the other side, so both keep
+ * going instead of polling.
+ */
+class Pacer
+{
+private:
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	double ratio;     // read bytes per written byte, 0 for no pacing
+	uint64_t slack;   // bytes a side may be ahead of the ratio
+	uint64_t written; // bytes since the start
+	uint64_t read;
+
+	std::atomic<uint64_t> lag; // bytes written after a file before its check
+	uint64_t min_lag, max_lag;
+
+	// cache samples since the last lag update
+	uint64_t window_pages, window_resident;
+	size_t window_files;
+
+	void update_lag(void);
+	void wait(void);
+
+public:
+	Pacer(void);
+	~Pacer(void);
+
+	void init(uint64_t max_file_size);
+
+	uint64_t add_written(uint64_t bytes);
+	void add_read(uint64_t bytes, const CacheSample &sample);
+
+	void wait_write(const std::atomic<bool> &stop);
+	void wait_read(const std::atomic<bool> &stop);
+	void wait_new_write(const std::atomic<bool> &stop);
+	void wake(void);
+
+	uint64_t get_written(void);
+
+	uint64_t get_lag(void) const
+	{
+		return this->lag;
+	}
+};
+
+#endif // __PACER_H__
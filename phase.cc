@@ -0,0 +1,226 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <errno.h>
+#include <string.h>
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include "fstest.h"
+#include "phase.h"
+
+using namespace std;
+
+PhaseStats::PhaseStats(void)
+{
+	this->phase = PHASE_FILL;
+	this->turnover = 0;
+	this->transition_written = 0;
+}
+
+const char *PhaseStats::name(int phase)
+{
+	switch (phase) {
+	case PHASE_FILL:       return "fill";
+	case PHASE_TRANSITION: return "transition";
+	case PHASE_STEADY:     return "steady";
+	case PHASE_TOTAL:      return "total";
+	}
+	return "?";
+}
+
+void PhaseStats::start(void)
+{
+	this->phases[PHASE_FILL].start_ns = now_ns();
+}
+
+/* Ends the current phase, only ever moves forward */
+void PhaseStats::enter(int phase)
+{
+	int old = this->phase;
+
+	if (old >= phase || !this->phase.compare_exchange_strong(old, phase))
+		return;
+
+	uint64_t now = now_ns();
+	this->phases[old].end_ns = now;
+	this->phases[phase].start_ns = now;
+}
+
+/* The use goal is reached, the writers start to delete files */
+void PhaseStats::set_full(uint64_t use_goal)
+{
+	this->turnover = use_goal / 2;
+	this->enter(PHASE_TRANSITION);
+}
+
+void PhaseStats::written(uint64_t bytes, uint64_t ns)
+{
+	PhaseCounters &counters = this->phases[this->phase];
+
+	counters.write_bytes += bytes;
+	counters.files_written++;
+	counters.write_lat.record(ns);
+	counters.last_ns = now_ns();
+
+	if (this->phase == PHASE_TRANSITION &&
+	    (this->transition_written += bytes) >= this->turnover)
+		this->enter(PHASE_STEADY);
+}
+
+void PhaseStats::verified(uint64_t bytes, uint64_t ns)
+{
+	PhaseCounters &counters = this->phases[this->phase];
+
+	counters.read_bytes += bytes;
+	counters.verify_lat.record(ns);
+	counters.last_ns = now_ns();
+}
+
+/* The test threads are done, the last phase ends with their last I/O */
+void PhaseStats::finish(void)
+{
+	PhaseCounters &counters = this->phases[this->phase];
+
+	if (counters.end_ns == 0)
+		counters.end_ns = counters.last_ns ? (uint64_t) counters.last_ns :
+						     now_ns();
+}
+
+PhaseResult PhaseStats::result(int phase)
+{
+	PhaseResult res;
+	LatencySnapshot write_lat, verify_lat;
+	uint64_t start = 0, end = 0, write = 0, read = 0, files = 0;
+
+	memset(&res, 0, sizeof(res));
+
+	for (int p = 0; p < PHASE_NUM; p++) {
+		PhaseCounters &counters = this->phases[p];
+
+		if ((phase != PHASE_TOTAL && p != phase) || counters.start_ns == 0)
+			continue;
+
+		if (start == 0)
+			start = counters.start_ns;
+		end = counters.end_ns ? (uint64_t) counters.end_ns : now_ns();
+		write += counters.write_bytes;
+		read += counters.read_bytes;
+		files += counters.files_written;
+		write_lat.add(counters.write_lat.snapshot());
+		verify_lat.add(counters.verify_lat.snapshot());
+	}
+
+	if (start == 0)
+		return res;
+
+	res.reached = true;
+	res.seconds = (end - start) / 1E9;
+
+	double t = max(res.seconds, 1E-3);
+	res.write_mib_s = write / t / MEGA;
+	res.read_mib_s = read / t / MEGA;
+	res.files_s = files / t;
+	res.write_p50_ms = write_lat.percentile(50) / 1E6;
+	res.write_p99_ms = write_lat.percentile(99) / 1E6;
+	res.verify_p50_ms = verify_lat.percentile(50) / 1E6;
+	res.verify_p99_ms = verify_lat.percentile(99) / 1E6;
+
+	return res;
+}
+
+/* Summary table, one line per phase */
+void PhaseStats::report(ostream &out)
+{
+	ios_base::fmtflags flags = out.flags();
+	streamsize precision = out.precision();
+
+	out << "Phase        time [s]  write [MiB/s]  read [MiB/s]  files/s"
+	    << "  write p50/p99 [ms]  verify p50/p99 [ms]" << endl;
+	out << fixed << setprecision(1);
+
+	for (int p = 0; p <= PHASE_TOTAL; p++) {
+		PhaseResult res = this->result(p);
+
+		out << left << setw(11) << name(p) << right;
+		if (!res.reached) {
+			out << "  not reached" << endl;
+			continue;
+		}
+
+		out << setw(10) << res.seconds
+		    << setw(15) << res.write_mib_s
+		    << setw(14) << res.read_mib_s
+		    << setw(9) << res.files_s
+		    << setw(11) << res.write_p50_ms << " / "
+		    << setw(6) << res.write_p99_ms
+		    << setw(12) << res.verify_p50_ms << " / "
+		    << setw(6) << res.verify_p99_ms << endl;
+	}
+
+	out.flags(flags);
+	out.precision(precision);
+}
+
+/**
+ * Append the results to a CSV file, label holds the first columns
+ * ("kernel,target,...") that tell the runs apart. The header is written
+ * into a new or empty file.
+ * Returns -errno on failure.
+ */
+int PhaseStats::write_csv(string path, string label)
+{
+	ofstream out(path, ios::app);
+	if (!out) {
+		int err = errno;
+		cerr << "Error: cannot write " << path << ": " << strerror(err)
+		     << endl;
+		return -err;
+	}
+
+	if (out.tellp() == 0)
+		out << "kernel,target,seed,phase,seconds,write_mib_s,"
+		    << "read_mib_s,files_s,write_p50_ms,write_p99_ms,"
+		    << "verify_p50_ms,verify_p99_ms" << endl;
+
+	for (int p = 0; p <= PHASE_TOTAL; p++) {
+		PhaseResult res = this->result(p);
+
+		if (!res.reached)
+			continue;
+
+		out << label << "," << name(p) << "," << res.seconds << ","
+		    << res.write_mib_s << "," << res.read_mib_s << ","
+		    << res.files_s << "," << res.write_p50_ms << ","
+		    << res.write_p99_ms << "," << res.verify_p50_ms << ","
+		    << res.verify_p99_ms << endl;
+	}
+
+	return out ? 0 : -EIO;
+}
@@ -0,0 +1,99 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __PHASE_H__
+#define __PHASE_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <ostream>
+#include <string>
+
+#include "histogram.h"
+
+/* A test goes through the fill-up until the use goal is reached, the
+ * transition to write/delete and then its steady state. The transition
+ * ends once the writers wrote half of the use goal after it began.
+ */
+enum bench_phase {
+	PHASE_FILL,
+	PHASE_TRANSITION,
+	PHASE_STEADY,
+	PHASE_NUM,
+	PHASE_TOTAL = PHASE_NUM // all phases together, for PhaseStats::result()
+};
+
+/* Throughput and latency of a phase */
+struct PhaseResult {
+	bool reached;
+	double seconds;
+	double write_mib_s, read_mib_s;
+	double files_s; // files written per second
+	double write_p50_ms, write_p99_ms;
+	double verify_p50_ms, verify_p99_ms;
+};
+
+struct PhaseCounters {
+	std::atomic<uint64_t> start_ns {0};
+	std::atomic<uint64_t> end_ns {0};
+	std::atomic<uint64_t> last_ns {0}; // end of the last write or verify
+	std::atomic<uint64_t> write_bytes {0};
+	std::atomic<uint64_t> read_bytes {0};
+	std::atomic<uint64_t> files_written {0};
+	LatencyHistogram write_lat;
+	LatencyHistogram verify_lat;
+};
+
+/* Counters of a filesystem per phase, lock free */
+class PhaseStats
+{
+private:
+	PhaseCounters phases[PHASE_NUM];
+	std::atomic<int> phase;
+
+	std::atomic<uint64_t> turnover; // bytes to write in the transition
+	std::atomic<uint64_t> transition_written;
+
+	void enter(int phase);
+
+public:
+	PhaseStats(void);
+
+	void start(void);
+	void set_full(uint64_t use_goal);
+	void written(uint64_t bytes, uint64_t ns);
+	void verified(uint64_t bytes, uint64_t ns);
+	void finish(void);
+
+	PhaseResult result(int phase);
+	void report(std::ostream &out);
+	int write_csv(std::string path, std::string label);
+
+	static const char *name(int phase);
+};
+
+#endif // __PHASE_H__
@@ -0,0 +1,377 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "fstest.h"
+#include "placement.h"
+
+#define MAX_NUMA_NODE 1023
+#define NODE_MASK_LONGS (MAX_NUMA_NODE / (8 * sizeof(long)) + 1)
+
+using namespace std;
+
+static Placement placement;
+
+// memory node of the calling thread, -1 for the default policy
+static thread_local int buf_node = -1;
+
+Placement *get_placement(void)
+{
+	return &placement;
+}
+
+/* The kernel ignores the last bit of maxnode, hence the + 1 */
+static unsigned long node_mask(int node, unsigned long *mask)
+{
+	memset(mask, 0, NODE_MASK_LONGS * sizeof(long));
+	mask[node / (8 * sizeof(long))] |= 1UL << (node % (8 * sizeof(long)));
+
+	return 8 * NODE_MASK_LONGS * sizeof(long) + 1;
+}
+
+Placement::Placement(void)
+{
+	this->active = false;
+	CPU_ZERO(&this->allowed);
+	for (int role = 0; role < ROLE_NUM; role++) {
+		CPU_ZERO(&this->cpus[role]);
+		this->has_cpus[role] = false;
+		this->node[role] = -1;
+		this->node_cpus[role] = false;
+	}
+}
+
+const char *Placement::role_name(int role)
+{
+	static const char *names[ROLE_NUM] = {"writer", "reader", "helper"};
+
+	return names[role];
+}
+
+/* "0-3,8,10-11" as the kernel prints CPU lists */
+int Placement::parse_cpu_list(string list, cpu_set_t *set)
+{
+	istringstream in(list);
+	string item;
+
+	CPU_ZERO(set);
+	while (getline(in, item, ',')) {
+		char *end;
+		unsigned long first = strtoul(item.c_str(), &end, 10);
+		unsigned long last = first;
+		if (end == item.c_str())
+			return -EINVAL;
+		if (*end == '-')
+			last = strtoul(end + 1, &end, 10);
+		if (*end != '\0' || last < first || last >= CPU_SETSIZE)
+			return -EINVAL;
+
+		for (unsigned long cpu = first; cpu <= last; cpu++)
+			CPU_SET(cpu, set);
+	}
+
+	return CPU_COUNT(set) > 0 ? 0 : -EINVAL;
+}
+
+string Placement::format_cpu_list(const cpu_set_t *set)
+{
+	ostringstream out;
+
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, set))
+			continue;
+
+		int last = cpu;
+		while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+			last++;
+
+		if (out.tellp() > 0)
+			out << ",";
+		out << cpu;
+		if (last > cpu)
+			out << "-" << last;
+		cpu = last;
+	}
+
+	return out.str();
+}
+
+/**
+ * Either one value for all roles or "writer=...:reader=...:helper=...",
+ * roles not given get an empty value.
+ */
+int Placement::parse_roles(string spec, string values[ROLE_NUM])
+{
+	for (int role = 0; role < ROLE_NUM; role++)
+		values[role].clear();
+
+	if (spec.find('=') == string::npos) {
+		for (int role = 0; role < ROLE_NUM; role++)
+			values[role] = spec;
+		return 0;
+	}
+
+	istringstream in(spec);
+	string item;
+	while (getline(in, item, ':')) {
+		size_t eq = item.find('=');
+		if (eq == string::npos || eq + 1 == item.size())
+			return -EINVAL;
+
+		int role;
+		for (role = 0; role < ROLE_NUM; role++) {
+			if (item.substr(0, eq) == role_name(role))
+				break;
+		}
+		if (role == ROLE_NUM || !values[role].empty())
+			return -EINVAL;
+
+		values[role] = item.substr(eq + 1);
+	}
+
+	return 0;
+}
+
+/* --cpus, returns -EINVAL for an invalid spec */
+int Placement::parse_cpus(string spec)
+{
+	string values[ROLE_NUM];
+
+	if (parse_roles(spec, values))
+		return -EINVAL;
+
+	for (int role = 0; role < ROLE_NUM; role++) {
+		if (values[role].empty())
+			continue;
+
+		if (parse_cpu_list(values[role], &this->cpus[role]))
+			return -EINVAL;
+		this->has_cpus[role] = true;
+	}
+
+	return 0;
+}
+
+/* --numa, returns -EINVAL for an invalid spec */
+int Placement::parse_numa(string spec)
+{
+	string values[ROLE_NUM];
+
+	if (parse_roles(spec, values))
+		return -EINVAL;
+
+	for (int role = 0; role < ROLE_NUM; role++) {
+		if (values[role].empty())
+			continue;
+
+		char *end;
+		unsigned long node = strtoul(values[role].c_str(), &end, 10);
+		if (*end != '\0' || end == values[role].c_str() ||
+		    node > MAX_NUMA_NODE)
+			return -EINVAL;
+		this->node[role] = node;
+	}
+
+	return 0;
+}
+
+/**
+ * Check the placement against the CPUs and nodes of the machine, roles
+ * with a node but without CPUs get the CPUs of the node.
+ */
+int Placement::setup(void)
+{
+	if (sched_getaffinity(0, sizeof(this->allowed), &this->allowed)) {
+		cerr << "sched_getaffinity failed: " << strerror(errno) << endl;
+		return -1;
+	}
+
+	this->active = false;
+	for (int role = 0; role < ROLE_NUM; role++) {
+		int node = this->node[role];
+
+		if (node >= 0) {
+			string path = "/sys/devices/system/node/node" +
+				      to_string(node) + "/cpulist";
+			ifstream in(path);
+			string list;
+			if (!in) {
+				cerr << "NUMA node " << node
+				     << " of the " << role_name(role)
+				     << " threads does not exist" << endl;
+				return -1;
+			}
+
+			// a node with memory only leaves the CPUs alone
+			getline(in, list);
+			if (!this->has_cpus[role] &&
+			    !parse_cpu_list(list, &this->cpus[role])) {
+				CPU_AND(&this->cpus[role], &this->cpus[role],
+					&this->allowed);
+				this->has_cpus[role] = true;
+				this->node_cpus[role] = true;
+			}
+		}
+
+		if (!this->has_cpus[role])
+			continue;
+
+		if (CPU_COUNT(&this->cpus[role]) == 0) {
+			cerr << "No CPU of node " << this->node[role]
+			     << " is available to the " << role_name(role)
+			     << " threads" << endl;
+			return -1;
+		}
+
+		cpu_set_t missing;
+		CPU_XOR(&missing, &this->cpus[role], &this->allowed);
+		CPU_AND(&missing, &missing, &this->cpus[role]);
+		if (CPU_COUNT(&missing)) {
+			cerr << "CPUs " << format_cpu_list(&missing)
+			     << " of the " << role_name(role)
+			     << " threads are not available, allowed are "
+			     << format_cpu_list(&this->allowed) << endl;
+			return -1;
+		}
+	}
+
+	for (int role = 0; role < ROLE_NUM; role++) {
+		if (this->has_cpus[role] || this->node[role] >= 0)
+			this->active = true;
+	}
+
+	return 0;
+}
+
+/**
+ * Place the calling thread. Threads inherit the placement of the thread
+ * that started them, so roles without one are reset to the default.
+ */
+void Placement::apply(int role)
+{
+	if (!this->active)
+		return;
+
+	const cpu_set_t *set = this->has_cpus[role] ? &this->cpus[role] :
+						       &this->allowed;
+	if (sched_setaffinity(0, sizeof(*set), set)) {
+		cerr << "Placing a " << role_name(role) << " thread failed: "
+		     << strerror(errno) << endl;
+		EXIT(1);
+	}
+
+	// allocations of the thread, like the page cache of its writes,
+	// preferably come from the node
+	int node = this->node[role];
+	long rc;
+	if (node >= 0) {
+		unsigned long mask[NODE_MASK_LONGS];
+		unsigned long maxnode = node_mask(node, mask);
+
+		rc = syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, maxnode);
+	} else {
+		rc = syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+	}
+	if (rc) {
+		cerr << "Setting the memory policy of a " << role_name(role)
+		     << " thread failed: " << strerror(errno) << endl;
+		EXIT(1);
+	}
+
+	buf_node = node;
+}
+
+/* Where the threads of each role run, on stdout at the start */
+void Placement::report(ostream &out)
+{
+	if (!this->active)
+		return;
+
+	for (int role = 0; role < ROLE_NUM; role++) {
+		string label = string(role_name(role)) + " threads";
+		label[0] = toupper(label[0]);
+		label.resize(20, ' ');
+
+		out << label << ": ";
+		if (this->has_cpus[role]) {
+			out << "CPUs " << format_cpu_list(&this->cpus[role]);
+			if (this->node_cpus[role])
+				out << " of node " << this->node[role];
+		} else {
+			out << "all CPUs";
+		}
+		if (this->node[role] >= 0)
+			out << ", memory on node " << this->node[role];
+		out << endl;
+	}
+}
+
+/* Short form of the placement, for the benchmark report */
+string Placement::describe(void)
+{
+	if (!this->active)
+		return "default";
+
+	ostringstream out;
+	for (int role = 0; role < ROLE_NUM; role++) {
+		if (role > 0)
+			out << " ";
+		out << role_name(role) << "=";
+		if (this->has_cpus[role])
+			out << format_cpu_list(&this->cpus[role]);
+		else
+			out << "*";
+		if (this->node[role] >= 0)
+			out << "@node" << this->node[role];
+	}
+
+	return out.str();
+}
+
+/**
+ * Move the pages of an I/O buffer to the memory node of the calling
+ * thread. New pages are placed by the thread's memory policy on first
+ * touch already, this is for memory malloc() had used before. Best effort,
+ * pages that can not be moved stay where they are.
+ */
+void placement_bind_buf(void *buf, size_t size)
+{
+	if (buf_node < 0)
+		return;
+
+	unsigned long mask[NODE_MASK_LONGS];
+	unsigned long maxnode = node_mask(buf_node, mask);
+
+	syscall(SYS_mbind, buf, size, MPOL_PREFERRED, mask, maxnode,
+		MPOL_MF_MOVE);
+}
@@ -0,0 +1,78 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __PLACEMENT_H__
+#define __PLACEMENT_H__
+
+#include <sched.h>
+#include <stddef.h>
+#include <ostream>
+#include <string>
+
+// threads placed by --cpus and --numa
+enum thread_role {
+	ROLE_WRITER, // write_main()
+	ROLE_READER, // read_main()
+	ROLE_HELPER, // verify ranges, cleanup, offline verify and meta threads
+	ROLE_NUM
+};
+
+/* CPU and memory node of each thread role, set by the threads themselves
+ * with apply(). Roles without placement keep the CPUs and the memory
+ * policy fstest was started with.
+ */
+class Placement
+{
+private:
+	bool active;
+	cpu_set_t allowed; // CPUs of the process at setup()
+	cpu_set_t cpus[ROLE_NUM];
+	bool has_cpus[ROLE_NUM];
+	int node[ROLE_NUM]; // -1 for the default memory policy
+	bool node_cpus[ROLE_NUM]; // cpus taken from the node
+
+	static int parse_roles(std::string spec, std::string values[ROLE_NUM]);
+
+public:
+	Placement(void);
+
+	int parse_cpus(std::string spec);
+	int parse_numa(std::string spec);
+	int setup(void);
+	void apply(int role);
+	void report(std::ostream &out);
+	std::string describe(void);
+
+	static int parse_cpu_list(std::string list, cpu_set_t *set);
+	static std::string format_cpu_list(const cpu_set_t *set);
+	static const char *role_name(int role);
+};
+
+Placement *get_placement(void);
+void placement_bind_buf(void *buf, size_t size);
+
+#endif // __PLACEMENT_H__
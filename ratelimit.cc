@@ -0,0 +1,180 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <fstream>
+#include <algorithm>
+
+#include "fstest.h"
+#include "ratelimit.h"
+#include "histogram.h"
+
+using namespace std;
+
+static RateLimits rate_limits;
+
+RateLimits *get_rate_limits(void)
+{
+	return &rate_limits;
+}
+
+TokenBucket::TokenBucket(void)
+{
+	pthread_mutex_init(&this->mutex, NULL);
+	this->rate = 0;
+	this->tokens = 0;
+	this->last_ns = now_ns();
+}
+
+TokenBucket::~TokenBucket(void)
+{
+	pthread_mutex_destroy(&this->mutex);
+}
+
+void TokenBucket::set_rate(double rate)
+{
+	pthread_mutex_lock(&this->mutex);
+	this->rate = rate;
+	this->tokens = 0;
+	this->last_ns = now_ns();
+	pthread_mutex_unlock(&this->mutex);
+}
+
+double TokenBucket::get_rate(void)
+{
+	pthread_mutex_lock(&this->mutex);
+	double rate = this->rate;
+	pthread_mutex_unlock(&this->mutex);
+
+	return rate;
+}
+
+void TokenBucket::acquire(uint64_t num)
+{
+	pthread_mutex_lock(&this->mutex);
+
+	if (this->rate <= 0) {
+		pthread_mutex_unlock(&this->mutex);
+		return;
+	}
+
+	// refill, at most one second worth of burst
+	uint64_t now = now_ns();
+	this->tokens += (now - this->last_ns) / 1E9 * this->rate;
+	this->tokens = min(this->tokens, this->rate);
+	this->last_ns = now;
+
+	this->tokens -= num;
+	double wait = this->tokens < 0 ? -this->tokens / this->rate : 0;
+
+	pthread_mutex_unlock(&this->mutex);
+
+	if (wait > 0)
+		usleep(wait * 1E6);
+}
+
+/* Load a schedule file, lines of "HH:MM <write MiB/s> <read MiB/s> <files/s>",
+ * each one valid from that time of the day until the next line.
+ * 0 is unlimited, '#' starts a comment.
+ */
+int RateLimits::load_schedule(string path)
+{
+	ifstream in(path.c_str());
+	string line;
+	unsigned num = 0;
+
+	if (!in) {
+		cerr << "Failed to open rate schedule " << path << ": "
+		     << strerror(errno) << endl;
+		return -1;
+	}
+
+	while (getline(in, line)) {
+		num++;
+		line = line.substr(0, line.find('#'));
+		if (line.find_first_not_of(" \t") == string::npos)
+			continue;
+
+		RateScheduleEntry entry;
+		unsigned hour, minute;
+		if (sscanf(line.c_str(), "%u:%u %lf %lf %lf", &hour, &minute,
+			   &entry.write, &entry.read, &entry.files) != 5 ||
+		    hour > 23 || minute > 59) {
+			cerr << path << ":" << num << ": invalid line, expected "
+			     << "\"HH:MM <write MiB/s> <read MiB/s> <files/s>\""
+			     << endl;
+			return -1;
+		}
+
+		entry.minute = hour * 60 + minute;
+		this->schedule.push_back(entry);
+	}
+
+	if (this->schedule.empty()) {
+		cerr << "Rate schedule " << path << " is empty" << endl;
+		return -1;
+	}
+
+	sort(this->schedule.begin(), this->schedule.end(),
+	     [](const RateScheduleEntry &a, const RateScheduleEntry &b) {
+		     return a.minute < b.minute;
+	     });
+
+	return 0;
+}
+
+/* Switch to the schedule entry for the current time of the day, the last
+ * entry of the previous day applies before the first one.
+ */
+void RateLimits::update_schedule(void)
+{
+	if (this->schedule.empty())
+		return;
+
+	time_t now = time(NULL);
+	struct tm tm;
+	localtime_r(&now, &tm);
+	unsigned minute = tm.tm_hour * 60 + tm.tm_min;
+
+	int idx = this->schedule.size() - 1;
+	for (size_t i = 0; i < this->schedule.size(); i++) {
+		if (this->schedule[i].minute <= minute)
+			idx = i;
+	}
+
+	if (idx == this->current_entry)
+		return;
+
+	this->current_entry = idx;
+	RateScheduleEntry &entry = this->schedule[idx];
+
+	cout << "Rate schedule: write " << entry.write << " MiB/s read "
+	     << entry.read << " MiB/s files " << entry.files << "/s" << endl;
+
+	this->write.set_rate(entry.write * MEGA);
+	this->read.set_rate(entry.read * MEGA);
+	this->files.set_rate(entry.files);
+}
@@ -0,0 +1,83 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __RATELIMIT_H__
+#define __RATELIMIT_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Token bucket, the rate is in tokens (bytes or files) per second.
+ * A request larger than the available tokens is granted, but makes the
+ * caller sleep until the debt is paid back, so large I/O sizes work with
+ * small rates.
+ */
+class TokenBucket
+{
+private:
+	pthread_mutex_t mutex;
+	double rate; // 0 is unlimited
+	double tokens;
+	uint64_t last_ns;
+
+public:
+	TokenBucket(void);
+	~TokenBucket(void);
+
+	void set_rate(double rate);
+	double get_rate(void);
+
+	void acquire(uint64_t num);
+};
+
+/* A "HH:MM <write MiB/s> <read MiB/s> <files/s>" line of a rate schedule */
+struct RateScheduleEntry {
+	unsigned minute; // minute of the day the entry starts
+	double write, read, files;
+};
+
+/* Limits for the whole process */
+class RateLimits
+{
+private:
+	std::vector<RateScheduleEntry> schedule;
+	int current_entry {-1};
+
+public:
+	TokenBucket write; // bytes per second
+	TokenBucket read; // bytes per second
+	TokenBucket files; // creates plus unlinks per second
+
+	int load_schedule(std::string path);
+	void update_schedule(void);
+};
+
+RateLimits *get_rate_limits(void);
+
+#endif // __RATELIMIT_H__
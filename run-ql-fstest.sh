@@ -14,10 +14,9 @@ options:
 -d <target-dir>         Dir to run ql-fstest in
 -D                      random direct IO
 -e                      Stop on error - fail immediately
--n <num_processes>      Number of processes to start, defaults to ${nproc}
+-n <num_processes>      Number of fstest jobs to start, defaults to ${nproc}
 -p <fill-level>         File system fill level, ql-fstest will write data up
-                        to that level (approximate, with multiple processes),
-                        defaults to 90
+                        to that level (shared by all jobs), defaults to 90
 -t <max-run-time>       How log to run (default: unlimited)
 -h                      This help
 -l <log-dir>            Dir to write log files to
@@ -84,24 +83,9 @@ fi
 
 #make
 
-#tmp script, run from screen
-tmprun="$targetdir/tmp-ql-fstest-run-$$.sh"
-cat <<EOF >${tmprun}
-${CWD}/fstest $opts $targetdir 2>${logdir}/fstest-\$\$.err | tee ${logdir}/fstest-\$\$.log
-EOF
-chmod +x ${tmprun}
-
-# create a screenrc with the given number of ql-fstest processes
-screenrc="${targetdir}/tmp-screenrc_ql_fstest-$$"
-cp ${dir}/screenrc_ql_fstest.in ${screenrc}
-
-# add commands to the screenrc
-for i in $(seq 1 $nproc); do
-cat <<EOF >> $screenrc
-screen -t ql-fstest ${tmprun}
-EOF
-done
-
-echo "Starting tests in screen session"
-screen -S ql_fstests -dm -c $screenrc
-
+echo "Starting ${nproc} ql-fstest jobs, logs in ${logdir}/fstest-${PID}.{log,err}"
+nohup sh -c 'rc=$1; shift; "$@"; echo $? >"$rc"' fstest \
+	${logdir}/fstest-${PID}.rc \
+	${CWD}/fstest --jobs ${nproc} $opts $targetdir \
+	>${logdir}/fstest-${PID}.log 2>${logdir}/fstest-${PID}.err </dev/null &
+echo "Started as pid $!, the exit code goes to ${logdir}/fstest-${PID}.rc when it ends, non-zero if any job failed"
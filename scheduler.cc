@@ -0,0 +1,144 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <algorithm>
+
+#include "fstest.h"
+#include "scheduler.h"
+#include "config.h"
+
+using namespace std;
+
+/* Oldest verification (or write, if never verified) first, then the
+ * file with fewer checks, then write order to make the key unique.
+ */
+bool VerifyScheduler::Entry::operator<(const Entry &other) const
+{
+	if (this->last_verify != other.last_verify)
+		return this->last_verify < other.last_verify;
+
+	if (this->num_checks != other.num_checks)
+		return this->num_checks < other.num_checks;
+
+	return this->seq < other.seq;
+}
+
+VerifyScheduler::VerifyScheduler(void)
+{
+	this->batch_size = 0;
+	if (get_global_cfg()->get_read_order() != READ_ORDER_AGE)
+		this->batch_size = get_global_cfg()->get_read_batch();
+}
+
+/* Queued with its current key, the file must not be queued already */
+void VerifyScheduler::add(File *file)
+{
+	Entry entry = {file->get_last_verify(), file->num_checks,
+		       file->get_seq(), file};
+
+	this->queued[file] = this->queue.insert(entry).first;
+}
+
+void VerifyScheduler::remove(File *file)
+{
+	auto queued = this->queued.find(file);
+	if (queued != this->queued.end()) {
+		this->queue.erase(queued->second);
+		this->queued.erase(queued);
+		return;
+	}
+
+	auto it = find(this->batch.begin(), this->batch.end(), file);
+	if (it != this->batch.end())
+		this->batch.erase(it);
+}
+
+/* Move the next stale files into the batch and sort them by their
+ * physical location. Kept in reverse order, the next file is at the end.
+ */
+void VerifyScheduler::refill_batch(void)
+{
+	while (this->batch.size() < this->batch_size && !this->queue.empty()) {
+		auto first = this->queue.begin();
+		this->batch.push_back(first->file);
+		this->queued.erase(first->file);
+		this->queue.erase(first);
+	}
+
+	sort(this->batch.begin(), this->batch.end(),
+	     [](const File *a, const File *b) {
+		     return a->get_phys_key() > b->get_phys_key();
+	     });
+}
+
+/**
+ * Next file to verify that was written up to max_write_pos. Files written
+ * later are skipped and stay queued, before the filesystem is full these
+ * are the few files within the reader lag.
+ */
+File *VerifyScheduler::peek(uint64_t max_write_pos)
+{
+	if (this->batch_size > 0) {
+		if (this->batch.empty())
+			this->refill_batch();
+
+		for (auto it = this->batch.rbegin(); it != this->batch.rend(); ++it) {
+			if ((*it)->get_write_pos() <= max_write_pos)
+				return *it;
+		}
+	}
+
+	// a batch of only recent files, the older files behind it go first
+	for (const Entry &entry : this->queue) {
+		if (entry.file->get_write_pos() <= max_write_pos)
+			return entry.file;
+	}
+
+	return NULL;
+}
+
+void VerifyAge::compute(vector<time_t> &ages)
+{
+	this->num_files = ages.size();
+	if (ages.empty()) {
+		this->p50 = this->p90 = this->p99 = this->max = 0;
+		return;
+	}
+
+	size_t n = ages.size();
+	size_t i50 = (n - 1) * 50 / 100;
+	size_t i90 = (n - 1) * 90 / 100;
+	size_t i99 = (n - 1) * 99 / 100;
+
+	nth_element(ages.begin(), ages.begin() + i50, ages.end());
+	this->p50 = ages[i50];
+	nth_element(ages.begin() + i50, ages.begin() + i90, ages.end());
+	this->p90 = ages[i90];
+	nth_element(ages.begin() + i90, ages.begin() + i99, ages.end());
+	this->p99 = ages[i99];
+	this->max = *max_element(ages.begin() + i99, ages.end());
+}
@@ -0,0 +1,92 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <stdint.h>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include <time.h>
+
+class File;
+
+/* Order in which the reader verifies files. The file that has gone
+ * unverified for the longest time comes first, so the time a corruption
+ * can stay undetected is bounded by one pass over all files instead of
+ * depending on the index of the file in Filesystem::files.
+ * Not thread safe, the filesystem lock protects it.
+ */
+class VerifyScheduler
+{
+private:
+	// Sort key of a queued file, taken when it is added, so that the
+	// file may be verified and change while it stays queued
+	struct Entry {
+		time_t last_verify;
+		int num_checks;
+		uint64_t seq;
+		File *file;
+
+		bool operator<(const Entry &other) const;
+	};
+
+	std::set<Entry> queue;
+	std::unordered_map<File *, std::set<Entry>::iterator> queued;
+
+	// With a physical read order the stalest files are taken out of
+	// the queue in batches and verified in inode or disk offset order,
+	// to avoid seeking on spinning disks. Each batch is sorted again.
+	std::vector<File *> batch;
+	size_t batch_size;
+
+	void refill_batch(void);
+
+public:
+	VerifyScheduler(void);
+
+	void add(File *file);
+	void remove(File *file);
+
+	File *peek(uint64_t max_write_pos);
+
+	size_t size(void) const
+	{
+		return this->queue.size() + this->batch.size();
+	}
+};
+
+/* Distribution of "time since last verify" over a set of files */
+struct VerifyAge {
+	time_t p50, p90, p99, max;
+	size_t num_files;
+
+	void compute(std::vector<time_t> &ages);
+};
+
+#endif // __SCHEDULER_H__
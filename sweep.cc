@@ -0,0 +1,533 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#include "fstest.h"
+#include "config.h"
+#include "sweep.h"
+
+#define SWEEP_KNEE 0.9 // part of the best throughput that is saturated
+#define SWEEP_POLL_MS 100
+#define SWEEP_MAX_THREADS 1024 // threads and qd, per point
+
+using namespace std;
+
+/* Result of the running point, in memory shared with its child */
+struct SweepShared {
+	bool recorded;
+	bool error;
+	bool steady;
+	PhaseResult result;
+};
+
+static SweepShared *sweep_shared;
+static bool sweep_child; // this process runs a point
+
+/* Called with the test threads done, keeps the result of a sweep point */
+void sweep_record(PhaseStats *phases, bool error)
+{
+	if (!sweep_child)
+		return;
+
+	PhaseResult steady = phases->result(PHASE_STEADY);
+
+	sweep_shared->steady = steady.reached;
+	sweep_shared->result = steady.reached ? steady :
+						phases->result(PHASE_TOTAL);
+	sweep_shared->error = error;
+	sweep_shared->recorded = true;
+}
+
+Sweep::Sweep(void)
+{
+	for (int dim = 0; dim < SWEEP_NUM_DIMS; dim++)
+		this->swept[dim] = false;
+}
+
+const char *Sweep::dim_name(int dim)
+{
+	switch (dim) {
+	case SWEEP_THREADS:   return "threads";
+	case SWEEP_QD:        return "qd";
+	case SWEEP_IO_SIZE:   return "io-size";
+	case SWEEP_FILE_BITS: return "file-bits";
+	case SWEEP_SYNC:      return "sync";
+	}
+	return "?";
+}
+
+/* The largest value of a numeric parameter, also bounds the doubling */
+static unsigned max_value(int dim)
+{
+	switch (dim) {
+	case SWEEP_THREADS:
+	case SWEEP_QD:        return SWEEP_MAX_THREADS;
+	case SWEEP_IO_SIZE:   return DEFAULT_IO_SIZE_KB;
+	case SWEEP_FILE_BITS: return 40;
+	}
+	return 0;
+}
+
+/**
+ * Values of a parameter: "a,b,c", numbers also as "a-b", which doubles
+ * from a up to b for threads, qd and io-size and counts up for file-bits.
+ * Returns -EINVAL on an invalid value.
+ */
+int Sweep::parse_dim(int dim, string list)
+{
+	istringstream in(list);
+	string item;
+	vector<unsigned> numbers;
+
+	this->values[dim].clear();
+	this->swept[dim] = true;
+
+	while (getline(in, item, ',')) {
+		if (dim == SWEEP_SYNC) {
+			if (item != "fdatasync" && item != "fsync" &&
+			    item != "none" && item != "direct")
+				return -EINVAL;
+			this->values[dim].push_back(item);
+			continue;
+		}
+
+		char *end;
+		unsigned long first = strtoul(item.c_str(), &end, 10);
+		unsigned long last = first;
+		if (*end == '-')
+			last = strtoul(end + 1, &end, 10);
+		if (*end != '\0' || first == 0 || last < first ||
+		    last > max_value(dim))
+			return -EINVAL;
+
+		for (unsigned val = first; val < last;
+		     val = dim == SWEEP_FILE_BITS ? val + 1 : val * 2)
+			numbers.push_back(val);
+		numbers.push_back(last);
+	}
+
+	sort(numbers.begin(), numbers.end());
+	numbers.erase(unique(numbers.begin(), numbers.end()), numbers.end());
+	for (unsigned val : numbers) {
+		if (dim == SWEEP_IO_SIZE &&
+		    (val < MIN_IO_SIZE_KB || (val & (val - 1))))
+			return -EINVAL;
+
+		this->values[dim].push_back(to_string(val));
+	}
+
+	return this->values[dim].empty() ? -EINVAL : 0;
+}
+
+/* One of the points sets the parameter to the value */
+bool Sweep::has_value(int dim, string value) const
+{
+	const vector<string> &values = this->values[dim];
+
+	return this->swept[dim] &&
+	       find(values.begin(), values.end(), value) != values.end();
+}
+
+/**
+ * Parse "threads=1-8:io-size=64,1024:..." and set up the points, the
+ * parameters not given keep their configured value.
+ * Returns -EINVAL on an invalid spec.
+ */
+int Sweep::parse(string spec)
+{
+	Config_fstest *cfg = get_global_cfg();
+	istringstream in(spec);
+	string item;
+
+	while (getline(in, item, ':')) {
+		size_t eq = item.find('=');
+		if (eq == string::npos)
+			return -EINVAL;
+
+		int dim;
+		for (dim = 0; dim < SWEEP_NUM_DIMS; dim++) {
+			if (item.substr(0, eq) == dim_name(dim))
+				break;
+		}
+		if (dim == SWEEP_NUM_DIMS || this->swept[dim] ||
+		    this->parse_dim(dim, item.substr(eq + 1)))
+			return -EINVAL;
+	}
+
+	// the configured values, only shown
+	size_t min_bits = cfg->get_min_size_bits();
+	size_t max_bits = cfg->get_max_size_bits();
+	string defaults[SWEEP_NUM_DIMS] = {
+		to_string(max(cfg->get_num_writers(), (size_t) 1)),
+		to_string(cfg->get_num_readers()),
+		to_string(cfg->get_io_size() / KILO),
+		min_bits == max_bits ? to_string(min_bits) :
+			to_string(min_bits) + "-" + to_string(max_bits),
+		cfg->get_direct_io() ? "direct" :
+		cfg->get_sync_policy() == SYNC_FSYNC ? "fsync" :
+		cfg->get_sync_policy() == SYNC_NONE ? "none" : "fdatasync",
+	};
+
+	size_t num_points = 1;
+	for (int dim = 0; dim < SWEEP_NUM_DIMS; dim++) {
+		if (!this->swept[dim])
+			this->values[dim].push_back(defaults[dim]);
+		num_points *= this->values[dim].size();
+	}
+
+	this->points.resize(num_points);
+	for (size_t i = 0; i < num_points; i++) {
+		SweepPoint &point = this->points[i];
+		size_t rest = i;
+
+		memset(&point, 0, sizeof(point));
+		for (int dim = 0; dim < SWEEP_NUM_DIMS; dim++) {
+			point.idx[dim] = rest % this->values[dim].size();
+			rest /= this->values[dim].size();
+		}
+	}
+
+	return 0;
+}
+
+/* Configure the child of a point */
+void Sweep::apply(const SweepPoint &point)
+{
+	Config_fstest *cfg = get_global_cfg();
+
+	for (int dim = 0; dim < SWEEP_NUM_DIMS; dim++) {
+		if (!this->swept[dim])
+			continue;
+
+		const string &val = this->values[dim][point.idx[dim]];
+		switch (dim) {
+		case SWEEP_THREADS:
+			cfg->set_num_writers(atoi(val.c_str()));
+			break;
+		case SWEEP_QD:
+			cfg->set_num_readers(atoi(val.c_str()));
+			break;
+		case SWEEP_IO_SIZE:
+			cfg->set_io_size_kb(atoi(val.c_str()));
+			break;
+		case SWEEP_FILE_BITS:
+			cfg->set_min_size_bits(atoi(val.c_str()));
+			cfg->set_max_size_bits(atoi(val.c_str()));
+			break;
+		case SWEEP_SYNC:
+			if (val == "direct") {
+				cfg->set_direct_io();
+				cfg->set_sync_policy("fdatasync");
+			} else {
+				cfg->set_sync_policy(val);
+			}
+			break;
+		}
+	}
+}
+
+string Sweep::describe(const SweepPoint &point) const
+{
+	ostringstream desc;
+
+	for (int dim = 0; dim < SWEEP_NUM_DIMS; dim++)
+		desc << (dim ? " " : "") << dim_name(dim) << "="
+		     << this->values[dim][point.idx[dim]];
+
+	return desc.str();
+}
+
+/**
+ * Run the test for a point in a forked child with its output discarded.
+ * Returns 0, or 1 if the child failed or detected an error.
+ */
+int Sweep::run_point(SweepPoint &point)
+{
+	memset(sweep_shared, 0, sizeof(*sweep_shared));
+	cout.flush();
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork() failed: ");
+		EXIT(1);
+	}
+
+	if (pid == 0) {
+		sweep_child = true;
+		this->apply(point);
+		srandom(get_global_cfg()->get_seed());
+
+		int null = open("/dev/null", O_WRONLY);
+		if (null >= 0) {
+			dup2(null, STDOUT_FILENO);
+			close(null);
+		}
+
+		start_threads();
+		exit(sweep_shared->error ? EXIT_FAILURE : 0);
+	}
+
+	bool stop_forwarded = false;
+	int status;
+	while (true) {
+		pid_t rc = waitpid(pid, &status, WNOHANG);
+
+		if (rc < 0) {
+			perror("waitpid() failed: ");
+			EXIT(1);
+		}
+		if (rc == pid)
+			break;
+
+		// the child stops and cleans up itself
+		if (get_stop_signal() && !stop_forwarded) {
+			kill(pid, SIGTERM);
+			stop_forwarded = true;
+		}
+		usleep(SWEEP_POLL_MS * 1000);
+	}
+
+	point.done = sweep_shared->recorded;
+	point.failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+		       !sweep_shared->recorded;
+	point.steady = sweep_shared->steady;
+	point.result = sweep_shared->result;
+
+	return point.failed ? 1 : 0;
+}
+
+/* The knee is searched along the first swept numeric parameter */
+int Sweep::knee_dim(void) const
+{
+	for (int dim = 0; dim < SWEEP_SYNC; dim++) {
+		if (this->values[dim].size() > 1)
+			return dim;
+	}
+	return -1;
+}
+
+/**
+ * Along dim, for each combination of the other parameters, the first
+ * point that reaches SWEEP_KNEE of the best throughput of its series:
+ * more of dim does not buy much after it.
+ * Returns the indexes of the knee points.
+ */
+vector<size_t> Sweep::find_knees(int dim) const
+{
+	map<vector<size_t>, vector<size_t>> series;
+	vector<size_t> knees;
+
+	for (size_t i = 0; i < this->points.size(); i++) {
+		const SweepPoint &point = this->points[i];
+		if (!point.done)
+			continue;
+
+		vector<size_t> key(point.idx, point.idx + SWEEP_NUM_DIMS);
+		key[dim] = 0;
+		series[key].push_back(i); // in the order of dim
+	}
+
+	for (auto &it : series) {
+		double best = 0;
+		for (size_t i : it.second)
+			best = max(best, this->points[i].result.write_mib_s);
+
+		for (size_t i : it.second) {
+			if (this->points[i].result.write_mib_s >=
+			    SWEEP_KNEE * best) {
+				knees.push_back(i);
+				break;
+			}
+		}
+	}
+
+	return knees;
+}
+
+void Sweep::write_csv(ostream &out) const
+{
+	for (int dim = 0; dim < SWEEP_NUM_DIMS; dim++)
+		out << dim_name(dim) << ",";
+	out << "phase,seconds,write_mib_s,read_mib_s,files_s,write_p99_ms,"
+	    << "verify_p99_ms,failed" << endl;
+
+	for (const SweepPoint &point : this->points) {
+		if (!point.done)
+			continue;
+
+		const PhaseResult &res = point.result;
+		for (int dim = 0; dim < SWEEP_NUM_DIMS; dim++)
+			out << this->values[dim][point.idx[dim]] << ",";
+		out << (point.steady ? "steady" : "total") << ","
+		    << res.seconds << "," << res.write_mib_s << ","
+		    << res.read_mib_s << "," << res.files_s << ","
+		    << res.write_p99_ms << "," << res.verify_p99_ms << ","
+		    << point.failed << endl;
+	}
+}
+
+/* numbers as they are, everything else as a string */
+static string json_value(const string &val)
+{
+	if (!val.empty() && val.find_first_not_of("0123456789") == string::npos)
+		return val;
+	return "\"" + val + "\"";
+}
+
+void Sweep::write_json(ostream &out) const
+{
+	int dim = this->knee_dim();
+	vector<size_t> knees;
+	if (dim >= 0)
+		knees = this->find_knees(dim);
+
+	out << "{\n  \"points\": [";
+	bool first = true;
+	for (size_t i = 0; i < this->points.size(); i++) {
+		const SweepPoint &point = this->points[i];
+		if (!point.done)
+			continue;
+
+		const PhaseResult &res = point.result;
+		out << (first ? "" : ",") << "\n    { ";
+		for (int d = 0; d < SWEEP_NUM_DIMS; d++)
+			out << "\"" << dim_name(d) << "\": "
+			    << json_value(this->values[d][point.idx[d]]) << ", ";
+		out << "\"phase\": \"" << (point.steady ? "steady" : "total")
+		    << "\", \"seconds\": " << res.seconds
+		    << ", \"write_mib_s\": " << res.write_mib_s
+		    << ", \"read_mib_s\": " << res.read_mib_s
+		    << ", \"files_s\": " << res.files_s
+		    << ", \"write_p99_ms\": " << res.write_p99_ms
+		    << ", \"verify_p99_ms\": " << res.verify_p99_ms
+		    << ", \"failed\": " << (point.failed ? "true" : "false")
+		    << ", \"knee\": "
+		    << (find(knees.begin(), knees.end(), i) != knees.end() ?
+			"true" : "false")
+		    << " }";
+		first = false;
+	}
+	out << "\n  ],\n  \"knee_parameter\": "
+	    << (dim >= 0 ? json_value(dim_name(dim)) : "null") << "\n}"
+	    << endl;
+}
+
+/**
+ * Run all points one after the other, print the matrix and the knees and
+ * write it into --sweep-out.
+ * Returns 0, or 1 if a point failed.
+ */
+int Sweep::run(void)
+{
+	Config_fstest *cfg = get_global_cfg();
+	int ret = 0;
+
+	void *mem = mmap(NULL, sizeof(SweepShared), PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		perror("mmap of the shared sweep state failed: ");
+		return 1;
+	}
+	sweep_shared = (SweepShared *) mem;
+
+	install_stop_signals();
+
+	cout << "Sweep               : " << this->points.size() << " points of ";
+	if (cfg->get_sweep_bytes_mb())
+		cout << cfg->get_sweep_bytes_mb() << " MiB" << endl;
+	else
+		cout << cfg->get_timeout() << " s" << endl;
+
+	for (size_t i = 0; i < this->points.size(); i++) {
+		SweepPoint &point = this->points[i];
+
+		if (get_stop_signal()) {
+			cout << "Signal " << get_stop_signal()
+			     << " received, stopping the sweep" << endl;
+			break;
+		}
+
+		if (this->run_point(point))
+			ret = 1;
+
+		const PhaseResult &res = point.result;
+		cout << "Point " << i + 1 << "/" << this->points.size() << " "
+		     << this->describe(point) << ": ";
+		if (!point.done)
+			cout << "failed" << endl;
+		else
+			cout << res.write_mib_s << " MiB/s, " << res.files_s
+			     << " files/s, write p99 " << res.write_p99_ms
+			     << " ms (" << (point.steady ? "steady" : "total")
+			     << (point.failed ? ", failed" : "") << ")" << endl;
+	}
+
+	int dim = this->knee_dim();
+	if (dim >= 0) {
+		for (size_t i : this->find_knees(dim)) {
+			const SweepPoint &point = this->points[i];
+
+			cout << "Knee over " << dim_name(dim) << ": "
+			     << this->describe(point) << ", "
+			     << point.result.write_mib_s << " MiB/s, write p99 "
+			     << point.result.write_p99_ms << " ms" << endl;
+		}
+	}
+
+	string path = cfg->get_sweep_out();
+	if (!path.empty()) {
+		ofstream out(path);
+		bool json = path.size() > 5 &&
+			    path.compare(path.size() - 5, 5, ".json") == 0;
+
+		if (json)
+			this->write_json(out);
+		else
+			this->write_csv(out);
+
+		if (!out) {
+			cerr << "Error: writing " << path << " failed" << endl;
+			ret = 1;
+		}
+	}
+
+	return ret;
+}
@@ -0,0 +1,89 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __SWEEP_H__
+#define __SWEEP_H__
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "phase.h"
+
+// parameters of a sweep, the first one is varied fastest
+enum sweep_dim {
+	SWEEP_THREADS,   // write threads
+	SWEEP_QD,        // read threads, the reads in flight
+	SWEEP_IO_SIZE,   // KiB per write and read call
+	SWEEP_FILE_BITS, // file size
+	SWEEP_SYNC,      // fdatasync, fsync, none or direct
+	SWEEP_NUM_DIMS
+};
+
+/* One combination of the parameters and its result */
+struct SweepPoint {
+	size_t idx[SWEEP_NUM_DIMS]; // into Sweep::values
+	bool done;
+	bool failed;
+	bool steady; // result is of the steady state, otherwise of the run
+	PhaseResult result;
+};
+
+/* Runs the test once per combination of the given parameter values, each
+ * run in a forked child, and reports throughput and latency per point and
+ * where the throughput saturates.
+ */
+class Sweep
+{
+private:
+	std::vector<std::string> values[SWEEP_NUM_DIMS];
+	bool swept[SWEEP_NUM_DIMS];
+	std::vector<SweepPoint> points;
+
+	int parse_dim(int dim, std::string list);
+	void apply(const SweepPoint &point);
+	int run_point(SweepPoint &point);
+	std::string describe(const SweepPoint &point) const;
+	int knee_dim(void) const;
+	std::vector<size_t> find_knees(int dim) const;
+
+	void write_csv(std::ostream &out) const;
+	void write_json(std::ostream &out) const;
+
+public:
+	Sweep(void);
+
+	int parse(std::string spec);
+	int run(void);
+	bool has_value(int dim, std::string value) const;
+
+	static const char *dim_name(int dim);
+};
+
+void sweep_record(PhaseStats *phases, bool error);
+
+#endif // __SWEEP_H__
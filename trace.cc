@@ -0,0 +1,298 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <signal.h>
+#include <sys/syscall.h>
+#include <algorithm>
+
+#include "fstest.h"
+#include "trace.h"
+
+using namespace std;
+
+/* Header of a dump file, followed by the records of all threads */
+struct TraceHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t pid;
+	uint32_t num_records;
+	uint64_t dump_ns; // CLOCK_MONOTONIC at the time of the dump
+	char reason[40];
+};
+
+/* Thread id of a record in the dump file */
+struct TraceDumpRecord {
+	TraceRecord rec;
+	uint32_t tid;
+	uint32_t pad;
+};
+
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static vector<TraceRing *> rings; // never freed, threads come and go
+static string dump_prefix = "fstest-trace";
+static atomic<int> num_dumps {0};
+static volatile sig_atomic_t dump_requested = 0;
+
+/* Gives the ring of the thread back when the thread exits */
+struct ThreadRing {
+	TraceRing *ring {NULL};
+
+	~ThreadRing(void)
+	{
+		if (this->ring)
+			this->ring->in_use = false;
+	}
+};
+
+static thread_local ThreadRing thread_ring;
+
+TraceRing *get_trace_ring(void)
+{
+	if (thread_ring.ring != NULL)
+		return thread_ring.ring;
+
+	TraceRing *ring = NULL;
+
+	pthread_mutex_lock(&rings_mutex);
+	for (TraceRing *r : rings) {
+		if (!r->in_use) {
+			ring = r;
+			break;
+		}
+	}
+
+	if (ring == NULL) {
+		ring = new TraceRing;
+		rings.push_back(ring);
+	}
+
+	ring->in_use = true;
+	ring->tid = syscall(SYS_gettid);
+	pthread_mutex_unlock(&rings_mutex);
+
+	thread_ring.ring = ring;
+	return ring;
+}
+
+void trace_set_prefix(string prefix)
+{
+	dump_prefix = prefix;
+}
+
+static void trace_signal_handler(int sig)
+{
+	(void) sig;
+	dump_requested = 1;
+}
+
+/* SIGUSR1 requests a dump, done by the monitoring loop */
+void trace_install_signal(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = trace_signal_handler;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &sa, NULL);
+}
+
+/* Returns true once after SIGUSR1 */
+bool trace_dump_requested(void)
+{
+	if (!dump_requested)
+		return false;
+
+	dump_requested = 0;
+	return true;
+}
+
+/* Write the rings of all threads to <prefix>.<pid>.<n> */
+void trace_dump(const char *reason)
+{
+	vector<TraceDumpRecord> dump;
+
+	int n = num_dumps++;
+	if (n >= TRACE_MAX_DUMPS) {
+		if (n == TRACE_MAX_DUMPS)
+			cerr << "Too many trace dumps, not dumping anymore"
+			     << endl;
+		return;
+	}
+
+	pthread_mutex_lock(&rings_mutex);
+	for (TraceRing *ring : rings) {
+		uint64_t head = ring->head.load(memory_order_acquire);
+		uint64_t start = head > TRACE_RING_SIZE ?
+			head - TRACE_RING_SIZE : 0;
+
+		for (uint64_t i = start; i < head; i++) {
+			TraceDumpRecord d;
+
+			d.rec = ring->records[i & (TRACE_RING_SIZE - 1)];
+			d.tid = d.rec.tid;
+			d.pad = 0;
+			dump.push_back(d);
+		}
+	}
+	pthread_mutex_unlock(&rings_mutex);
+
+	TraceHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = TRACE_MAGIC;
+	hdr.version = TRACE_VERSION;
+	hdr.pid = getpid();
+	hdr.num_records = dump.size();
+	hdr.dump_ns = now_ns();
+	strncpy(hdr.reason, reason, sizeof(hdr.reason) - 1);
+
+	string path = dump_prefix + "." + to_string(getpid()) + "." +
+		      to_string(n);
+
+	FILE *f = fopen(path.c_str(), "w");
+	if (f == NULL) {
+		cerr << "Creating trace dump " << path << " failed: "
+		     << strerror(errno) << endl;
+		return;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(dump.data(), sizeof(TraceDumpRecord), dump.size(), f) !=
+	    dump.size() || fclose(f) != 0) {
+		cerr << "Writing trace dump " << path << " failed: "
+		     << strerror(errno) << endl;
+		return;
+	}
+
+	cerr << "Trace (" << reason << ", " << dump.size()
+	     << " operations) dumped to " << path << endl;
+}
+
+const char *trace_op_name(uint32_t op)
+{
+	switch (op) {
+	case TRACE_CREATE:  return "create";
+	case TRACE_OPEN:    return "open";
+	case TRACE_WRITE:   return "write";
+	case TRACE_FSYNC:   return "fsync";
+	case TRACE_CLOSE:   return "close";
+	case TRACE_READ:    return "read";
+	case TRACE_CHECK:   return "check";
+	case TRACE_UNLINK:  return "unlink";
+	case TRACE_MKDIR:   return "mkdir";
+	case TRACE_RMDIR:   return "rmdir";
+	case TRACE_CORRUPT: return "CORRUPT";
+	case TRACE_STAT:    return "stat";
+	case TRACE_RENAME:  return "rename";
+	case TRACE_LINK:    return "link";
+	case TRACE_SYMLINK: return "symlink";
+	case TRACE_SETXATTR: return "setxattr";
+	}
+	return "?";
+}
+
+/* The operations that are in progress in any thread */
+vector<TraceInflight> trace_get_inflight(void)
+{
+	vector<TraceInflight> inflight;
+
+	pthread_mutex_lock(&rings_mutex);
+	for (TraceRing *ring : rings) {
+		TraceInflight op;
+
+		if (!ring->in_use)
+			continue;
+
+		op.start_ns = ring->inflight_start;
+		if (op.start_ns == 0)
+			continue;
+
+		op.tid = ring->tid;
+		op.op = ring->inflight_op;
+		op.file_id = ring->inflight_file;
+		inflight.push_back(op);
+	}
+	pthread_mutex_unlock(&rings_mutex);
+
+	return inflight;
+}
+
+/**
+ * Print a dump file as text, sorted by start time. Times are relative to
+ * the dump, in ms.
+ */
+int trace_decode(string path)
+{
+	FILE *f = fopen(path.c_str(), "r");
+	if (f == NULL) {
+		cerr << "Opening trace " << path << " failed: "
+		     << strerror(errno) << endl;
+		return 1;
+	}
+
+	TraceHeader hdr;
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != TRACE_MAGIC ||
+	    hdr.version != TRACE_VERSION) {
+		cerr << path << " is not a trace dump" << endl;
+		fclose(f);
+		return 1;
+	}
+
+	vector<TraceDumpRecord> dump(hdr.num_records);
+	size_t num = fread(dump.data(), sizeof(TraceDumpRecord),
+			   hdr.num_records, f);
+	fclose(f);
+
+	if (num != hdr.num_records)
+		cerr << "Trace truncated, " << num << " of "
+		     << hdr.num_records << " records" << endl;
+	dump.resize(num);
+
+	sort(dump.begin(), dump.end(),
+	     [](const TraceDumpRecord &a, const TraceDumpRecord &b) {
+		     return a.rec.start_ns < b.rec.start_ns;
+	     });
+
+	hdr.reason[sizeof(hdr.reason) - 1] = '\0';
+	cout << "# pid " << hdr.pid << ", reason: " << hdr.reason << ", "
+	     << num << " operations" << endl;
+	cout << "# start_ms dur_us tid op file offset len result" << endl;
+
+	for (const TraceDumpRecord &d : dump) {
+		const TraceRecord &r = d.rec;
+		char line[160];
+
+		snprintf(line, sizeof(line),
+			 "%.3f %.1f %u %s %x %llu %llu %d",
+			 ((double) r.start_ns - (double) hdr.dump_ns) / 1E6,
+			 (r.end_ns - r.start_ns) / 1E3, d.tid, trace_op_name(r.op),
+			 r.file_id, (unsigned long long) r.offset,
+			 (unsigned long long) r.len, r.result);
+		cout << line << endl;
+	}
+
+	return 0;
+}
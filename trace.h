@@ -0,0 +1,171 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "histogram.h"
+
+#define TRACE_MAGIC 0x45435254 // "TRCE"
+#define TRACE_VERSION 1
+#define TRACE_RING_SIZE 4096 // records per thread, power of 2
+#define TRACE_MAX_DUMPS 16 // per process, e.g. many corrupt files
+
+enum trace_op {
+	TRACE_CREATE = 1,
+	TRACE_OPEN,
+	TRACE_WRITE,
+	TRACE_FSYNC,
+	TRACE_CLOSE,
+	TRACE_READ,
+	TRACE_CHECK,
+	TRACE_UNLINK,
+	TRACE_MKDIR,
+	TRACE_RMDIR,
+	TRACE_CORRUPT,
+	TRACE_STAT,
+	TRACE_RENAME,
+	TRACE_LINK,
+	TRACE_SYMLINK,
+	TRACE_SETXATTR,
+};
+
+/* One operation, as written to the dump file */
+struct TraceRecord {
+	uint64_t start_ns; // CLOCK_MONOTONIC
+	uint64_t end_ns;
+	uint64_t offset;
+	uint64_t len;
+	uint32_t file_id; // the file pattern, which is also its name
+	int32_t result;
+	uint32_t op;
+	uint32_t tid; // rings are reused, so each record has its thread
+};
+
+/* Ring of the last operations of one thread. Only the owning thread writes,
+ * a dump reads it without locking, so a record that is overwritten during
+ * the dump might be torn. Rings of exited threads are reused, with the old
+ * records still in them.
+ */
+struct TraceRing {
+	TraceRecord records[TRACE_RING_SIZE];
+	std::atomic<uint64_t> head {0}; // number of records ever written
+	std::atomic<bool> in_use {false};
+	uint32_t tid;
+
+	// the operation in progress, for the stall watchdog
+	std::atomic<uint64_t> inflight_start {0}; // 0 for none
+	std::atomic<uint32_t> inflight_op {0};
+	std::atomic<uint32_t> inflight_file {0};
+
+	void add(const TraceRecord &rec)
+	{
+		uint64_t h = this->head.load(std::memory_order_relaxed);
+
+		this->records[h & (TRACE_RING_SIZE - 1)] = rec;
+		this->head.store(h + 1, std::memory_order_release);
+	}
+};
+
+TraceRing *get_trace_ring(void);
+
+/* Records an operation into the ring of the calling thread when it goes
+ * out of scope, e.g.
+ *	TraceOp op(TRACE_WRITE, id, offset, len);
+ *	op.result = write(...);
+ */
+class TraceOp
+{
+private:
+	TraceRecord rec;
+	TraceRing *ring;
+
+	// the enclosing operation, e.g. the check around a read
+	uint64_t outer_start;
+	uint32_t outer_op, outer_file;
+
+public:
+	int32_t result {0};
+
+	TraceOp(enum trace_op op, uint32_t file_id, uint64_t offset = 0,
+		uint64_t len = 0)
+	{
+		this->rec.start_ns = now_ns();
+		this->rec.offset = offset;
+		this->rec.len = len;
+		this->rec.file_id = file_id;
+		this->rec.op = op;
+
+		this->ring = get_trace_ring();
+		this->rec.tid = this->ring->tid;
+		this->outer_start = this->ring->inflight_start;
+		this->outer_op = this->ring->inflight_op;
+		this->outer_file = this->ring->inflight_file;
+
+		this->ring->inflight_op = op;
+		this->ring->inflight_file = file_id;
+		this->ring->inflight_start = this->rec.start_ns;
+	}
+
+	~TraceOp(void)
+	{
+		this->rec.end_ns = now_ns();
+		this->rec.result = this->result;
+		this->ring->add(this->rec);
+
+		// the enclosing operation made progress, a stall is the
+		// time since then
+		this->ring->inflight_start = 0;
+		this->ring->inflight_op = this->outer_op;
+		this->ring->inflight_file = this->outer_file;
+		if (this->outer_start)
+			this->ring->inflight_start = this->rec.end_ns;
+	}
+};
+
+/* An operation in progress */
+struct TraceInflight {
+	uint32_t tid;
+	uint32_t op;
+	uint32_t file_id;
+	uint64_t start_ns;
+};
+
+void trace_set_prefix(std::string prefix);
+void trace_install_signal(void);
+void trace_dump(const char *reason);
+bool trace_dump_requested(void);
+int trace_decode(std::string path);
+std::vector<TraceInflight> trace_get_inflight(void);
+const char *trace_op_name(uint32_t op);
+
+#endif // __TRACE_H__
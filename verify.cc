@@ -0,0 +1,355 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <dirent.h>
+#include <sys/xattr.h>
+
+#include "fstest.h"
+#include "verify.h"
+#include "histogram.h"
+#include "crc32c.h"
+#include "placement.h"
+
+using namespace std;
+
+static void *run_verify_thread(void *arg)
+{
+	VerifyPool *pool = (VerifyPool *) arg;
+
+	get_placement()->apply(ROLE_HELPER);
+	pool->worker();
+	return NULL;
+}
+
+VerifyPool::VerifyPool(size_t num_threads)
+{
+	pthread_mutex_init(&this->mutex, NULL);
+	pthread_cond_init(&this->not_empty, NULL);
+	pthread_cond_init(&this->not_full, NULL);
+	this->closed = false;
+	this->start_ns = now_ns();
+	this->end_ns = 0;
+
+	this->threads.resize(max(num_threads, (size_t) 1));
+	for (size_t i = 0; i < this->threads.size(); i++) {
+		int rc = pthread_create(&this->threads[i], NULL,
+					run_verify_thread, this);
+		if (rc) {
+			cerr << "Failed to start verify thread " << i << ": "
+			     << strerror(rc) << endl;
+			EXIT(1);
+		}
+	}
+}
+
+VerifyPool::~VerifyPool(void)
+{
+	this->finish();
+
+	pthread_cond_destroy(&this->not_full);
+	pthread_cond_destroy(&this->not_empty);
+	pthread_mutex_destroy(&this->mutex);
+}
+
+/* Queue a file, blocks while the verify threads are busy */
+void VerifyPool::push(const VerifyItem &item)
+{
+	pthread_mutex_lock(&this->mutex);
+	while (this->queue.size() >= 16 * this->threads.size())
+		pthread_cond_wait(&this->not_full, &this->mutex);
+
+	this->queue.push_back(item);
+	pthread_cond_signal(&this->not_empty);
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/* No more files, wait until all queued files are verified */
+void VerifyPool::finish(void)
+{
+	pthread_mutex_lock(&this->mutex);
+	if (this->closed) {
+		pthread_mutex_unlock(&this->mutex);
+		return;
+	}
+	this->closed = true;
+	pthread_cond_broadcast(&this->not_empty);
+	pthread_mutex_unlock(&this->mutex);
+
+	for (pthread_t &thread : this->threads)
+		pthread_join(thread, NULL);
+
+	this->end_ns = now_ns();
+}
+
+void VerifyPool::worker(void)
+{
+	while (true) {
+		pthread_mutex_lock(&this->mutex);
+		while (this->queue.empty() && !this->closed)
+			pthread_cond_wait(&this->not_empty, &this->mutex);
+
+		if (this->queue.empty()) {
+			pthread_mutex_unlock(&this->mutex);
+			return;
+		}
+
+		VerifyItem item = this->queue.front();
+		this->queue.pop_front();
+		pthread_cond_signal(&this->not_full);
+		pthread_mutex_unlock(&this->mutex);
+
+		this->verify(item);
+	}
+}
+
+void VerifyPool::verify(const VerifyItem &item)
+{
+	struct stat st;
+
+	this->num_files++;
+
+	if (stat(item.path.c_str(), &st) != 0) {
+		if (!item.synced) {
+			this->num_unsynced_lost++;
+			return;
+		}
+
+		cerr << "Acknowledged file lost: " << item.path << ": "
+		     << strerror(errno) << endl;
+		this->num_missing++;
+		return;
+	}
+
+	uint64_t size = item.size < 0 ? st.st_size : item.size;
+
+	File file(item.path, item.pattern, size);
+	if (!item.pattern_known)
+		file.set_pattern_unknown();
+
+	file.lock_shared();
+	int rc = file.check();
+	file.unlock();
+
+	// removed between the stat() and the open()
+	if (rc == -ENOENT) {
+		if (!item.synced) {
+			this->num_unsynced_lost++;
+			return;
+		}
+
+		cerr << "Acknowledged file lost: " << item.path << endl;
+		this->num_missing++;
+		return;
+	}
+
+	this->num_bytes += min(size, (uint64_t) st.st_size);
+
+	if (rc == 0)
+		this->num_ok++;
+	else if (!item.synced)
+		this->num_unsynced_lost++;
+	else
+		this->num_corrupt++;
+}
+
+void VerifyPool::print_summary(ostream &out)
+{
+	double t = max((this->end_ns - this->start_ns) / 1E9, 1E-3);
+
+	out << "Verified files      : " << this->num_files << " ("
+	    << this->num_bytes / MEGA << " MiB in " << t << " s, "
+	    << this->num_bytes / t / MEGA << " MiB/s, "
+	    << this->num_files / t << " files/s)" << endl;
+	out << "Intact              : " << this->num_ok << endl;
+	out << "Corrupt             : " << this->num_corrupt << endl;
+	out << "Acknowledged lost   : " << this->num_missing << endl;
+	out << "Never synced, lost  : " << this->num_unsynced_lost << endl;
+}
+
+/* Parallel directory walk, feeding the files to a VerifyPool */
+struct TreeScan {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	deque<string> dirs;
+	size_t busy; // directories queued or being read
+	VerifyPool *pool;
+	atomic<uint64_t> num_dirs {0}, num_skipped {0};
+};
+
+/* fstest file names are the pattern in hex */
+static bool parse_pattern(const char *name, uint32_t &pattern)
+{
+	size_t len = strlen(name);
+
+	if (len == 0 || len > 8 || strspn(name, "0123456789abcdef") != len)
+		return false;
+
+	pattern = strtoul(name, NULL, 16);
+	return true;
+}
+
+static void scan_dir(TreeScan *scan, const string &path)
+{
+	DIR *dir = opendir(path.c_str());
+	if (dir == NULL) {
+		cerr << "Opening directory " << path << " failed: "
+		     << strerror(errno) << endl;
+		scan->num_skipped++;
+		return;
+	}
+
+	scan->num_dirs++;
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		const char *name = entry->d_name;
+
+		if (!strcmp(name, ".") || !strcmp(name, ".."))
+			continue;
+
+		string entry_path = path + name;
+		unsigned char type = entry->d_type;
+
+		if (type == DT_UNKNOWN) {
+			struct stat st;
+
+			if (lstat(entry_path.c_str(), &st) != 0)
+				continue;
+			if (S_ISDIR(st.st_mode))
+				type = DT_DIR;
+			else if (S_ISREG(st.st_mode))
+				type = DT_REG;
+		}
+
+		if (type == DT_DIR) {
+			pthread_mutex_lock(&scan->mutex);
+			scan->dirs.push_back(entry_path + "/");
+			scan->busy++;
+			pthread_cond_signal(&scan->cond);
+			pthread_mutex_unlock(&scan->mutex);
+			continue;
+		}
+
+		VerifyItem item;
+		if (type != DT_REG) {
+			scan->num_skipped++;
+			continue;
+		}
+
+		// without a pattern in the name only the checksum is checked
+		if (!parse_pattern(name, item.pattern)) {
+			if (getxattr(entry_path.c_str(), CSUM_XATTR, NULL, 0) < 0) {
+				scan->num_skipped++;
+				continue;
+			}
+			item.pattern = 0;
+			item.pattern_known = false;
+		}
+
+		item.path = entry_path;
+		item.size = -1;
+		item.synced = true;
+		scan->pool->push(item);
+	}
+
+	closedir(dir);
+}
+
+static void *run_scan_thread(void *arg)
+{
+	TreeScan *scan = (TreeScan *) arg;
+
+	get_placement()->apply(ROLE_HELPER);
+	pthread_mutex_lock(&scan->mutex);
+	while (true) {
+		while (scan->dirs.empty() && scan->busy > 0)
+			pthread_cond_wait(&scan->cond, &scan->mutex);
+
+		if (scan->busy == 0)
+			break;
+
+		string path = scan->dirs.back(); // depth first
+		scan->dirs.pop_back();
+		pthread_mutex_unlock(&scan->mutex);
+
+		scan_dir(scan, path);
+
+		pthread_mutex_lock(&scan->mutex);
+		if (--scan->busy == 0)
+			pthread_cond_broadcast(&scan->cond);
+	}
+	pthread_mutex_unlock(&scan->mutex);
+
+	return NULL;
+}
+
+/**
+ * Verify all files below dir, e.g. the fstest.<pid> tree of an earlier run.
+ * The directories are read by num_threads threads and the files verified by
+ * as many. Returns non-zero if a file is corrupt.
+ */
+int verify_tree(string dir, size_t num_threads)
+{
+	if (dir.empty() || dir.at(dir.length() - 1) != '/')
+		dir += '/';
+
+	num_threads = max(num_threads, (size_t) 1);
+
+	TreeScan scan;
+	pthread_mutex_init(&scan.mutex, NULL);
+	pthread_cond_init(&scan.cond, NULL);
+	scan.dirs.push_back(dir);
+	scan.busy = 1;
+
+	VerifyPool pool(num_threads);
+	scan.pool = &pool;
+
+	vector<pthread_t> threads(num_threads);
+	for (size_t i = 0; i < num_threads; i++) {
+		int rc = pthread_create(&threads[i], NULL, run_scan_thread,
+					&scan);
+		if (rc) {
+			cerr << "Failed to start scan thread " << i << ": "
+			     << strerror(rc) << endl;
+			EXIT(1);
+		}
+	}
+
+	for (pthread_t &thread : threads)
+		pthread_join(thread, NULL);
+
+	pool.finish();
+
+	cout << "Directories         : " << scan.num_dirs << endl;
+	cout << "Skipped entries     : " << scan.num_skipped << endl;
+	pool.print_summary(cout);
+
+	pthread_cond_destroy(&scan.cond);
+	pthread_mutex_destroy(&scan.mutex);
+
+	return pool.has_errors() ? 1 : 0;
+}
@@ -0,0 +1,86 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __VERIFY_H__
+#define __VERIFY_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/* A file to verify, that was not created by this process */
+struct VerifyItem {
+	std::string path;
+	uint32_t pattern;
+	int64_t size; // -1 to take the size of the file on disk
+	bool synced; // the data was acknowledged by fdatasync()
+	bool pattern_known {true}; // false: only the checksum xattr is checked
+};
+
+/* Thread pool verifying existing files, e.g. after a reboot. Files whose
+ * data was acknowledged and that are missing or corrupt are errors, files
+ * that were never synced are only counted.
+ */
+class VerifyPool
+{
+private:
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty, not_full;
+	std::deque<VerifyItem> queue;
+	bool closed;
+	std::vector<pthread_t> threads;
+	uint64_t start_ns, end_ns;
+
+	void verify(const VerifyItem &item);
+
+public:
+	std::atomic<uint64_t> num_files {0}, num_bytes {0};
+	std::atomic<uint64_t> num_ok {0}, num_corrupt {0}, num_missing {0};
+	std::atomic<uint64_t> num_unsynced_lost {0}; // never synced, expected
+
+	VerifyPool(size_t num_threads);
+	~VerifyPool(void);
+
+	void push(const VerifyItem &item);
+	void finish(void);
+	void worker(void);
+
+	bool has_errors(void) const
+	{
+		return this->num_corrupt > 0 || this->num_missing > 0;
+	}
+
+	void print_summary(std::ostream &out);
+};
+
+int verify_tree(std::string dir, size_t num_threads);
+
+#endif // __VERIFY_H__
@@ -0,0 +1,230 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+#include "fstest.h"
+#include "control.h"
+#include "trace.h"
+#include "watchdog.h"
+
+#define WATCHDOG_MIN_PERIOD_MS 10
+#define WATCHDOG_MAX_PERIOD_MS 1000
+
+using namespace std;
+
+static Watchdog watchdog;
+
+Watchdog *get_watchdog(void)
+{
+	return &watchdog;
+}
+
+Watchdog::Watchdog(void)
+{
+	pthread_mutex_init(&this->mutex, NULL);
+	memset(&this->stats, 0, sizeof(this->stats));
+}
+
+static void *run_watchdog(void *arg)
+{
+	Watchdog *watchdog = (Watchdog *) arg;
+
+	watchdog->run();
+	return NULL;
+}
+
+/* Threshold in seconds, 0 for no watchdog */
+int Watchdog::start(double threshold, bool stacks)
+{
+	if (threshold <= 0)
+		return 0;
+
+	this->threshold_ns = threshold * 1E9;
+	this->stacks = stacks;
+
+	int rc = pthread_create(&this->thread, NULL, run_watchdog, this);
+	if (rc) {
+		cerr << "Failed to start the watchdog: " << strerror(rc)
+		     << endl;
+		return -rc;
+	}
+
+	this->running = true;
+	return 0;
+}
+
+void Watchdog::shutdown(void)
+{
+	if (!this->running)
+		return;
+
+	this->stopped = true;
+	pthread_join(this->thread, NULL);
+	this->running = false;
+}
+
+void Watchdog::run(void)
+{
+	uint64_t period_ms = this->threshold_ns / 4 / 1000000;
+
+	period_ms = max(period_ms, (uint64_t) WATCHDOG_MIN_PERIOD_MS);
+	period_ms = min(period_ms, (uint64_t) WATCHDOG_MAX_PERIOD_MS);
+
+	while (!this->stopped) {
+		usleep(period_ms * 1000);
+		this->scan();
+	}
+}
+
+void Watchdog::report(uint32_t tid, const Stall &stall, uint64_t duration_ns)
+{
+	char file[16];
+
+	snprintf(file, sizeof(file), "%08x", stall.file_id);
+	cerr << "Stall: " << trace_op_name(stall.op) << " of file " << file
+	     << " in " << thread_describe(tid) << " running for "
+	     << duration_ns / 1E9 << " s" << endl;
+
+	if (!this->stacks)
+		return;
+
+	string path = "/proc/self/task/" + to_string(tid) + "/stack";
+	ifstream in(path);
+	string line;
+
+	if (!getline(in, line)) {
+		cerr << "  no kernel stack in " << path << endl;
+		return;
+	}
+
+	do {
+		cerr << "  " << line << endl;
+	} while (getline(in, line));
+}
+
+/* Compare the operations in progress with the known stalls */
+void Watchdog::scan(void)
+{
+	vector<TraceInflight> inflight = trace_get_inflight();
+	uint64_t now = now_ns();
+	bool new_stall = false;
+
+	pthread_mutex_lock(&this->mutex);
+
+	// stalls that are not in progress anymore ended
+	for (auto it = this->stalls.begin(); it != this->stalls.end(); ) {
+		bool running = false;
+
+		for (TraceInflight &op : inflight) {
+			if (op.tid == it->first.first &&
+			    op.start_ns == it->first.second) {
+				running = true;
+				break;
+			}
+		}
+
+		if (running) {
+			++it;
+			continue;
+		}
+
+		uint64_t duration = now - it->first.second;
+		char file[16];
+
+		snprintf(file, sizeof(file), "%08x", it->second.file_id);
+		cerr << "Stall ended: " << trace_op_name(it->second.op)
+		     << " of file " << file << " in "
+		     << thread_describe(it->first.first) << " after about "
+		     << duration / 1E9 << " s" << endl;
+
+		this->stats.total_ns += duration;
+		this->stats.max_ns = max(this->stats.max_ns, duration);
+		it = this->stalls.erase(it);
+	}
+
+	for (TraceInflight &op : inflight) {
+		if (op.start_ns > now || now - op.start_ns < this->threshold_ns)
+			continue;
+
+		uint64_t duration = now - op.start_ns;
+		auto key = make_pair(op.tid, op.start_ns);
+		auto it = this->stalls.find(key);
+
+		if (it == this->stalls.end()) {
+			Stall stall = { op.op, op.file_id, now };
+
+			this->stalls[key] = stall;
+			this->stats.count++;
+			this->report(op.tid, stall, duration);
+			new_stall = true;
+		} else if (now - it->second.last_report_ns >= this->threshold_ns) {
+			// still stuck
+			it->second.last_report_ns = now;
+			this->report(op.tid, it->second, duration);
+		}
+
+		this->stats.max_ns = max(this->stats.max_ns, duration);
+	}
+
+	this->stats.current = this->stalls.size();
+	pthread_mutex_unlock(&this->mutex);
+
+	// what led to it, and what the other threads were doing
+	if (new_stall)
+		trace_dump("stall");
+}
+
+StallStats Watchdog::get_stats(void)
+{
+	pthread_mutex_lock(&this->mutex);
+	StallStats stats = this->stats;
+	uint64_t now = now_ns();
+
+	for (auto &stall : this->stalls)
+		stats.total_ns += now - stall.first.second;
+	pthread_mutex_unlock(&this->mutex);
+
+	return stats;
+}
+
+/* Stall counts for a stats line, nothing without stalls */
+void print_stall_stats(ostream &out)
+{
+	StallStats stats = get_watchdog()->get_stats();
+
+	if (stats.count == 0)
+		return;
+
+	out << " stalls: " << stats.count << " (" << stats.current
+	    << " now) total [s]: " << stats.total_ns / 1E9
+	    << " max [s]: " << stats.max_ns / 1E9;
+}
@@ -0,0 +1,86 @@
+/************************************************************************
+ *
+ * Filesystem stress and verify
+ *
+ * Authors: Goswin von Brederlow <brederlo@informatik.uni-tuebingen.de>
+ *          Bernd Schubert <bernd.schubert@fastmail.fm>
+ *
+ * Copyright (C) 2007 Q-leap Networks, Goswin von Brederlow
+ *               2010 DataDirect Networks, Bernd Schubert
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *    USA
+ *
+ ************************************************************************/
+
+#ifndef __WATCHDOG_H__
+#define __WATCHDOG_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <ostream>
+#include <utility>
+
+/* Stalled operations since the start */
+struct StallStats {
+	uint64_t count;    // operations that took longer than the threshold
+	uint64_t total_ns; // their summed up duration, also of running ones
+	uint64_t max_ns;
+	size_t current;    // stalled right now
+};
+
+/* Looks at the operation each thread has in progress (see TraceOp) and
+ * reports the ones that run longer than the threshold, independent of the
+ * test threads, which might be stuck in the stalled operation themselves.
+ */
+class Watchdog
+{
+private:
+	pthread_t thread;
+	std::atomic<bool> stopped {false};
+	bool running {false};
+	uint64_t threshold_ns {0};
+	bool stacks {false};
+
+	// stalled operations by thread id and start time
+	struct Stall {
+		uint32_t op;
+		uint32_t file_id;
+		uint64_t last_report_ns;
+	};
+	std::map<std::pair<uint32_t, uint64_t>, Stall> stalls;
+
+	pthread_mutex_t mutex;
+	StallStats stats;
+
+	void scan(void);
+	void report(uint32_t tid, const Stall &stall, uint64_t duration_ns);
+
+public:
+	Watchdog(void);
+
+	int start(double threshold, bool stacks);
+	void shutdown(void);
+	void run(void);
+
+	StallStats get_stats(void);
+};
+
+Watchdog *get_watchdog(void);
+void print_stall_stats(std::ostream &out);
+
+#endif // __WATCHDOG_H__